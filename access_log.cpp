@@ -0,0 +1,191 @@
+#include "access_log.h"
+#include "trace.h"
+#include "metrics.h"
+#include <QSysInfo>
+#include <QDebug>
+
+namespace {
+
+Metrics::Counter* droppedCounter()
+{
+    static Metrics::Counter* const counter = Metrics::counter(
+        "fp_audit_dropped_total", "Audit events lost to a full queue or a failed final commit.");
+    return counter;
+}
+
+} // namespace
+
+AccessEventQueue::AccessEventQueue(int capacity)
+    : m_pushPos(0)
+    , m_popPos(0)
+{
+    size_t size = 2;
+    while (size < size_t(qMax(capacity, 2))) {
+        size <<= 1;
+    }
+    m_cells.reset(new Cell[size]);
+    for (size_t i = 0; i < size; ++i) {
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    m_mask = size - 1;
+}
+
+bool AccessEventQueue::push(AccessEvent&& event)
+{
+    // A cell is free for position pos when its sequence equals pos
+    size_t pos = m_pushPos.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;) {
+        cell = &m_cells[pos & m_mask];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        intptr_t diff = intptr_t(sequence) - intptr_t(pos);
+        if (diff == 0) {
+            if (m_pushPos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            return false; // Full: the consumer has not freed this cell yet
+        } else {
+            pos = m_pushPos.load(std::memory_order_relaxed);
+        }
+    }
+    cell->event = std::move(event);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool AccessEventQueue::pop(AccessEvent& event)
+{
+    size_t pos = m_popPos.load(std::memory_order_relaxed);
+    Cell& cell = m_cells[pos & m_mask];
+    size_t sequence = cell.sequence.load(std::memory_order_acquire);
+    if (intptr_t(sequence) - intptr_t(pos + 1) < 0) {
+        return false; // Empty, or the producer is still writing this cell
+    }
+    event = std::move(cell.event);
+    cell.sequence.store(pos + m_mask + 1, std::memory_order_release);
+    m_popPos.store(pos + 1, std::memory_order_relaxed);
+    return true;
+}
+
+int AccessEventQueue::size() const
+{
+    size_t pushed = m_pushPos.load(std::memory_order_relaxed);
+    size_t popped = m_popPos.load(std::memory_order_relaxed);
+    return pushed > popped ? int(pushed - popped) : 0;
+}
+
+AccessLog::AccessLog(DatabaseManager* dbManager, int capacity, QObject* parent)
+    : QThread(parent)
+    , m_dbManager(dbManager)
+    , m_queue(capacity)
+    , m_readerName(qEnvironmentVariable("FP_READER_NAME", QSysInfo::machineHostName()))
+    , m_maxBatch(64)
+    , m_flushInterval(500)
+    , m_stopping(false)
+{
+    setObjectName("AccessLog");
+}
+
+AccessLog::~AccessLog()
+{
+    stop();
+}
+
+void AccessLog::setBatching(int maxBatch, int flushIntervalMsec)
+{
+    m_maxBatch = qBound(1, maxBatch, m_queue.capacity());
+    m_flushInterval = qMax(1, flushIntervalMsec);
+}
+
+void AccessLog::record(const QString& kind, const QString& result, int userId, int score,
+                       qint64 latencyNsecs, const QString& reader)
+{
+    static Metrics::Counter* const queued = Metrics::counter("fp_audit_queued_total", "Audit events accepted by the queue.");
+
+    if (m_stopping.load(std::memory_order_relaxed)) {
+        droppedCounter()->increment();
+        return;
+    }
+
+    AccessEvent event;
+    event.occurredAt = QDateTime::currentDateTimeUtc();
+    event.kind = kind;
+    event.result = result;
+    event.userId = userId;
+    event.score = score;
+    event.latencyMs = int(latencyNsecs / 1000000);
+    event.reader = reader.isEmpty() ? m_readerName : reader;
+
+    if (!m_queue.push(std::move(event))) {
+        droppedCounter()->increment();
+        return;
+    }
+    queued->increment();
+
+    // Wake the writer once per full batch only; a wake that slips past it is
+    // covered by the flush interval
+    if (m_queue.size() == m_maxBatch) {
+        m_wake.wakeOne();
+    }
+}
+
+void AccessLog::stop()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stopping = true;
+    }
+    m_wake.wakeAll();
+    wait();
+}
+
+void AccessLog::run()
+{
+    static Metrics::Counter* const written = Metrics::counter("fp_audit_written_total", "Audit events committed to access_events.");
+    static Metrics::Counter* const failures = Metrics::counter("fp_audit_commit_failures_total", "Audit batches that failed to commit.");
+    static Metrics::Gauge* const depth = Metrics::gauge("fp_audit_queue_depth", "Audit events waiting for the writer.");
+
+    Trace::setThreadName("AccessLog");
+    QVector<AccessEvent> batch;
+    batch.reserve(m_maxBatch);
+    bool retry = false;
+
+    for (;;) {
+        {
+            QMutexLocker locker(&m_mutex);
+            // After a failed commit the full interval passes before the next attempt
+            if (!m_stopping && (retry || m_queue.size() < m_maxBatch)) {
+                m_wake.wait(&m_mutex, m_flushInterval);
+            }
+        }
+        bool stopping = m_stopping.load();
+
+        AccessEvent event;
+        while (batch.size() < m_maxBatch && m_queue.pop(event)) {
+            batch.append(std::move(event));
+        }
+        depth->set(m_queue.size());
+
+        if (!batch.isEmpty()) {
+            if (m_dbManager->insertAccessEvents(batch)) {
+                written->increment(batch.size());
+                batch.clear();
+                retry = false;
+            } else {
+                // Kept for the next round; the queue absorbs new events meanwhile
+                failures->increment();
+                retry = true;
+            }
+        }
+
+        if (stopping) {
+            if (retry) {
+                int lost = batch.size() + m_queue.size();
+                droppedCounter()->increment(lost);
+                qWarning() << "AccessLog: dropping" << lost << "audit events at shutdown:" << m_dbManager->getLastError();
+                break;
+            }
+            if (m_queue.size() == 0) break;
+        }
+    }
+    depth->set(0);
+}
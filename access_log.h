@@ -0,0 +1,79 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QString>
+#include <QVector>
+#include <atomic>
+#include <memory>
+
+#include "database_manager.h"
+
+// Bounded multi-producer queue (Vyukov ring): push and pop are a few atomic
+// operations, never a lock or an allocation beyond the event's own strings.
+class AccessEventQueue {
+public:
+    explicit AccessEventQueue(int capacity); // Rounded up to a power of two
+
+    bool push(AccessEvent&& event); // false when full
+    bool pop(AccessEvent& event);   // Single consumer
+    int size() const;               // Approximate while producers run
+    int capacity() const { return int(m_mask + 1); }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        AccessEvent event;
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    size_t m_mask;
+    alignas(64) std::atomic<size_t> m_pushPos;
+    alignas(64) std::atomic<size_t> m_popPos;
+};
+
+// Write-behind audit trail of verify and identify outcomes.
+//
+// record() only stamps the event and pushes it on the queue, so it is safe
+// and cheap on any thread, including the match path. The writer thread
+// commits the queue to access_events in one transaction per batch: as soon
+// as maxBatch events are waiting, otherwise every flushInterval. A full
+// queue drops the new event and counts it in fp_audit_dropped_total.
+class AccessLog : public QThread {
+    Q_OBJECT
+
+public:
+    explicit AccessLog(DatabaseManager* dbManager, int capacity = 4096, QObject* parent = nullptr);
+    ~AccessLog() override;
+
+    // Before start()
+    void setBatching(int maxBatch, int flushIntervalMsec);
+    // Reader column for events recorded without one; defaults to FP_READER_NAME or the host name
+    void setReaderName(const QString& name) { m_readerName = name; }
+    QString readerName() const { return m_readerName; }
+
+    // kind: verify or identify; result: match, no_match, cancelled or error
+    void record(const QString& kind, const QString& result, int userId, int score,
+                qint64 latencyNsecs, const QString& reader = QString());
+
+    // Commits what is queued and joins the writer (call before the database goes away)
+    void stop();
+
+protected:
+    void run() override;
+
+private:
+    DatabaseManager* m_dbManager;
+    AccessEventQueue m_queue;
+    QString m_readerName;
+    int m_maxBatch;
+    int m_flushInterval;
+
+    QMutex m_mutex; // Writer sleeps on m_wake; producers never take it
+    QWaitCondition m_wake;
+    std::atomic<bool> m_stopping;
+};
+
+#endif // ACCESS_LOG_H
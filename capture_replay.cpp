@@ -0,0 +1,189 @@
+#include "capture_replay.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QRandomGenerator>
+#include <QDebug>
+
+namespace {
+
+const int kConnectTimeoutMs = 200;
+const int kRetryMs = 100;
+const int kMaxImageSide = 5000; // virtual_image rejects larger frames
+
+} // namespace
+
+bool CaptureReplay::isEnabled()
+{
+    return !qEnvironmentVariableIsEmpty("FP_REPLAY_DIR");
+}
+
+QString CaptureReplay::socketPath()
+{
+    return QDir::temp().filePath(QString("fp-replay-%1.sock").arg(QCoreApplication::applicationPid()));
+}
+
+bool CaptureReplay::prepareEnvironment()
+{
+    if (!isEnabled()) {
+        return false;
+    }
+
+    qputenv("FP_VIRTUAL_IMAGE", QFile::encodeName(socketPath()));
+    // Only the virtual reader, so a plugged-in U.are.U is never picked instead.
+    // Older libfprint releases read the WHITELIST spelling.
+    qputenv("FP_DRIVERS_ALLOWLIST", "virtual_image");
+    qputenv("FP_DRIVERS_WHITELIST", "virtual_image");
+    return true;
+}
+
+CaptureReplay::CaptureReplay(QObject* parent)
+    : QObject(parent)
+    , m_socket(new QLocalSocket(this))
+    , m_next(0)
+    , m_pending(0)
+    , m_interval(100)
+    , m_jitter(0)
+    , m_framesSent(0)
+{
+    m_timer.setSingleShot(true);
+    connect(&m_timer, &QTimer::timeout, this, &CaptureReplay::sendFrame);
+}
+
+bool CaptureReplay::configureFromEnvironment()
+{
+    bool ok = false;
+    int interval = qEnvironmentVariableIntValue("FP_REPLAY_INTERVAL_MS", &ok);
+    setInterval(ok ? interval : 100, qEnvironmentVariableIntValue("FP_REPLAY_JITTER_MS"));
+    return loadImages(qEnvironmentVariable("FP_REPLAY_DIR"));
+}
+
+QStringList CaptureReplay::imageFiles(const QString& directory)
+{
+    QDir dir(directory);
+    QStringList paths;
+    const QStringList files = dir.entryList({"*.png", "*.pgm", "*.bmp", "*.jpg", "*.jpeg", "*.tif", "*.tiff"},
+                                            QDir::Files, QDir::Name);
+    for (const QString& file : files) {
+        paths.append(dir.filePath(file));
+    }
+    return paths;
+}
+
+bool CaptureReplay::loadImages(const QString& directory)
+{
+    if (!loadImageFiles(imageFiles(directory))) {
+        m_lastError = QString("No usable images in %1").arg(directory);
+        return false;
+    }
+    qDebug() << "CaptureReplay: loaded" << m_frames.size() << "frames from" << directory;
+    return true;
+}
+
+bool CaptureReplay::loadImageFiles(const QStringList& paths)
+{
+    m_frames.clear();
+    m_names.clear();
+    m_next = 0;
+
+    for (const QString& path : paths) {
+        QImage image(path);
+        QString file = QFileInfo(path).fileName();
+        if (image.isNull() || image.width() > kMaxImageSide || image.height() > kMaxImageSide) {
+            qWarning() << "CaptureReplay: skipping" << file;
+            continue;
+        }
+        image = image.convertToFormat(QImage::Format_Grayscale8);
+
+        // virtual_image wire format: gint32 width, gint32 height, then rows of
+        // 8-bit pixels without padding, host byte order
+        qint32 header[2] = { qint32(image.width()), qint32(image.height()) };
+        QByteArray frame;
+        frame.reserve(int(sizeof(header)) + image.width() * image.height());
+        frame.append(reinterpret_cast<const char*>(header), sizeof(header));
+        for (int y = 0; y < image.height(); ++y) {
+            frame.append(reinterpret_cast<const char*>(image.constScanLine(y)), image.width());
+        }
+
+        m_frames.append(frame);
+        m_names.append(file);
+    }
+
+    if (m_frames.isEmpty()) {
+        m_lastError = "No usable images";
+        return false;
+    }
+    return true;
+}
+
+void CaptureReplay::setInterval(int msec, int jitterMsec)
+{
+    m_interval = qMax(0, msec);
+    m_jitter = qMax(0, jitterMsec);
+}
+
+void CaptureReplay::onCaptureStarted()
+{
+    ++m_pending;
+    if (!m_timer.isActive()) {
+        scheduleNext();
+    }
+}
+
+void CaptureReplay::onEnrollmentProgress(int current, int total)
+{
+    // current counts finished stages; the reader is already waiting for the next one
+    if (current > 0 && current < total) {
+        onCaptureStarted();
+    }
+}
+
+void CaptureReplay::scheduleNext()
+{
+    int delay = m_interval;
+    if (m_jitter > 0) {
+        delay += QRandomGenerator::global()->bounded(m_jitter + 1);
+    }
+    m_timer.start(delay);
+}
+
+bool CaptureReplay::ensureConnected()
+{
+    if (m_socket->state() == QLocalSocket::ConnectedState) {
+        return true;
+    }
+
+    // The driver opens its listener when the reader is opened
+    m_socket->abort();
+    m_socket->connectToServer(socketPath());
+    return m_socket->waitForConnected(kConnectTimeoutMs);
+}
+
+void CaptureReplay::sendFrame()
+{
+    if (m_pending <= 0 || m_frames.isEmpty()) {
+        return;
+    }
+
+    if (!ensureConnected()) {
+        m_lastError = QString("Cannot reach virtual reader: %1").arg(m_socket->errorString());
+        emit replayError(m_lastError);
+        m_timer.start(kRetryMs);
+        return;
+    }
+
+    int index = m_next;
+    m_next = (m_next + 1) % m_frames.size();
+
+    m_socket->write(m_frames[index]);
+    m_socket->flush();
+    --m_pending;
+    ++m_framesSent;
+    emit frameSent(m_names[index]);
+
+    if (m_pending > 0) {
+        scheduleNext();
+    }
+}
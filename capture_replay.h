@@ -0,0 +1,75 @@
+#ifndef CAPTURE_REPLAY_H
+#define CAPTURE_REPLAY_H
+
+#include <QObject>
+#include <QLocalSocket>
+#include <QTimer>
+#include <QVector>
+#include <QStringList>
+#include <QByteArray>
+
+// Hardware-free capture source for testing and profiling.
+//
+// libfprint's virtual_image driver listens on the socket named by
+// FP_VIRTUAL_IMAGE and treats every 8-bit grayscale frame written to it as a
+// finger placed on a real image reader. FingerprintManager therefore runs its
+// normal enroll/verify/identify paths; this class only plays recorded frames
+// into that socket, one per capture the DeviceWorker starts. Enrollment is a
+// single capture call that waits for every stage, so each stage reported by
+// enrollmentProgress that leaves more to go queues another frame.
+//
+// Environment:
+//   FP_REPLAY_DIR          directory of recorded images (png, pgm, bmp, ...)
+//   FP_REPLAY_INTERVAL_MS  delay between capture start and frame (default 100)
+//   FP_REPLAY_JITTER_MS    extra random delay, 0..jitter (default 0)
+class CaptureReplay : public QObject {
+    Q_OBJECT
+
+public:
+    // Call before libfprint is initialized. Points the virtual_image driver at
+    // our socket and hides physical readers. Returns true when replay is on.
+    static bool prepareEnvironment();
+    static bool isEnabled();
+    static QString socketPath();
+
+    explicit CaptureReplay(QObject* parent = nullptr);
+
+    bool configureFromEnvironment();
+    bool loadImages(const QString& directory);
+    // Replaces the frames with these files, played in order from the first
+    bool loadImageFiles(const QStringList& paths);
+    static QStringList imageFiles(const QString& directory); // Supported images, sorted by name
+    void setInterval(int msec, int jitterMsec = 0);
+
+    int imageCount() const { return m_frames.size(); }
+    qint64 framesSent() const { return m_framesSent; }
+    QString getLastError() const { return m_lastError; }
+
+public slots:
+    void onCaptureStarted(); // Queues one frame for the capture that just began
+    void onEnrollmentProgress(int current, int total); // Queues one for the next stage
+
+signals:
+    void frameSent(const QString& fileName);
+    void replayError(const QString& error);
+
+private slots:
+    void sendFrame();
+
+private:
+    bool ensureConnected();
+    void scheduleNext();
+
+    QLocalSocket* m_socket;
+    QTimer m_timer;
+    QVector<QByteArray> m_frames; // Header + pixels, ready to write
+    QStringList m_names;
+    int m_next;
+    int m_pending;
+    int m_interval;
+    int m_jitter;
+    qint64 m_framesSent;
+    QString m_lastError;
+};
+
+#endif // CAPTURE_REPLAY_H
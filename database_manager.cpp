@@ -1,5 +1,9 @@
 #include "database_manager.h"
 #include "migration_manager.h"
+#include "user_archive.h"
+#include "fingerprint_template.h"
+#include "trace.h"
+#include "metrics.h"
 #include <QSqlError>
 #include <QSqlRecord>
 #include <QVariant>
@@ -8,9 +12,58 @@
 #include <QFileInfo>
 #include <QDir>
 #include <QStandardPaths>
+#include <QStringList>
+#include <QThread>
+#include <QVersionNumber>
+
+// Trace span plus a latency series per public call; name must be a literal
+#define DB_OPERATION(name) \
+    TRACE_SCOPE("db", name); \
+    static Metrics::Histogram* const dbLatency = Metrics::histogram( \
+        "fp_db_call_seconds", "Database call latency by operation.", "op=\"" name "\""); \
+    Metrics::ScopedTimer dbTimer(dbLatency)
+
+namespace {
+
+// Pre-filter signature for a template, NULL when it carries no minutiae
+QVariant signatureValue(const QByteArray& fingerprintTemplate)
+{
+    FingerprintTemplate decoded = FingerprintTemplate::fromSerialized(fingerprintTemplate);
+    if (!decoded.isValid()) {
+        return QVariant(QMetaType::fromType<QByteArray>());
+    }
+    return decoded.signature().toBytes();
+}
+
+} // namespace
+
+// Connection owned by one non-owner thread, deleted by QThreadStorage on thread exit
+struct DatabaseManager::ThreadConnection {
+    QString name;
+    int generation = -1;
+    QHash<QString, QSqlQuery> statements;
+    QString lastError;
+
+    void release()
+    {
+        statements.clear(); // Queries must go before the connection is removed
+        if (name.isEmpty()) return;
+        {
+            QSqlDatabase db = QSqlDatabase::database(name, false);
+            db.close();
+        }
+        QSqlDatabase::removeDatabase(name);
+        name.clear();
+    }
+
+    ~ThreadConnection() { release(); }
+};
 
 DatabaseManager::DatabaseManager(QObject* parent)
     : QObject(parent)
+    , m_connectionName(QString("fingerprint_%1").arg(quintptr(this), 0, 16))
+    , m_generation(0)
+    , m_sqlite(false)
 {
 }
 
@@ -21,6 +74,9 @@ DatabaseManager::~DatabaseManager()
 
 void DatabaseManager::close()
 {
+    m_generation++;
+    m_statements.clear();
+
     if (m_db.isOpen()) {
         m_db.close();
     }
@@ -33,10 +89,107 @@ void DatabaseManager::close()
     }
 }
 
+DatabaseManager::ThreadConnection* DatabaseManager::threadConnection()
+{
+    if (!m_threadConnections.hasLocalData()) {
+        m_threadConnections.setLocalData(new ThreadConnection());
+    }
+    return m_threadConnections.localData();
+}
+
+QSqlDatabase DatabaseManager::connection()
+{
+    if (QThread::currentThread() == thread()) {
+        return m_db;
+    }
+
+    ThreadConnection* tc = threadConnection();
+    int generation = m_generation.load();
+    if (tc->generation != generation) {
+        tc->release(); // Opened before the last initialize()
+
+        QString name = QString("%1_%2_%3").arg(m_connectionName)
+                           .arg(quintptr(QThread::currentThreadId()), 0, 16)
+                           .arg(generation);
+        bool opened = false;
+        QString error;
+        {
+            // The by-name overload is the thread-safe one
+            QSqlDatabase db = QSqlDatabase::cloneDatabase(m_connectionName, name);
+            opened = db.open();
+            if (!opened) error = db.lastError().text();
+        }
+        if (opened) {
+            QSqlDatabase db = QSqlDatabase::database(name, false);
+            opened = configureConnection(db);
+            if (!opened) error = getLastError();
+        }
+        if (!opened) {
+            QSqlDatabase::removeDatabase(name);
+            setError(QString("Failed to open thread connection: %1").arg(error));
+            return QSqlDatabase();
+        }
+
+        tc->name = name;
+        tc->generation = generation;
+        qDebug() << "Opened database connection" << name << "for thread" << QThread::currentThread();
+    }
+    return QSqlDatabase::database(tc->name, false);
+}
+
+bool DatabaseManager::configureConnection(QSqlDatabase& db)
+{
+    if (db.driverName() != "QSQLITE") {
+        return true;
+    }
+
+    // WAL lets listing reads run alongside enrollment writes; NORMAL is still
+    // crash-safe in WAL mode and avoids an fsync per commit
+    const QStringList pragmas = {
+        "PRAGMA journal_mode = WAL",
+        "PRAGMA synchronous = NORMAL",
+        "PRAGMA cache_size = -16000",     // KiB, about 16 MB of page cache
+        "PRAGMA mmap_size = 268435456",   // Map up to 256 MB of the file
+        "PRAGMA temp_store = MEMORY"
+    };
+
+    QSqlQuery query(db);
+    for (const QString& pragma : pragmas) {
+        if (!query.exec(pragma)) {
+            setError(QString("Failed to apply '%1': %2").arg(pragma).arg(query.lastError().text()));
+            return false;
+        }
+    }
+    query.finish();
+    return true;
+}
+
+QSqlQuery DatabaseManager::preparedQuery(const QString& sql)
+{
+    QSqlDatabase db = connection();
+    QHash<QString, QSqlQuery>& cache = QThread::currentThread() == thread()
+        ? m_statements : threadConnection()->statements;
+
+    auto it = cache.find(sql);
+    if (it != cache.end()) {
+        it->finish(); // Drop any unread rows from the previous use
+        return *it;   // Copies share the prepared statement
+    }
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (query.prepare(sql)) {
+        cache.insert(sql, query);
+    } // On failure exec() reports the prepare error to the caller
+    return query;
+}
+
 bool DatabaseManager::initialize(const DatabaseConfigDialog::Config& config)
 {
+    DB_OPERATION("initialize");
     // Close existing connection if any
     close();
+    m_dbPath.clear();
 
     // Re-establish connection
     if (config.type == "SQLITE") {
@@ -63,10 +216,15 @@ bool DatabaseManager::initialize(const DatabaseConfigDialog::Config& config)
             }
         }
         
-        m_db = QSqlDatabase::addDatabase("QSQLITE");
+        m_db = QSqlDatabase::addDatabase("QSQLITE", m_connectionName);
+        m_sqlite = true;
         m_db.setDatabaseName(dbPath);
+        // Wait for a competing writer instead of failing with SQLITE_BUSY; clones inherit this
+        m_db.setConnectOptions("QSQLITE_BUSY_TIMEOUT=5000");
+        m_dbPath = finalFi.absoluteFilePath();
     } else {
-        m_db = QSqlDatabase::addDatabase("QPSQL");
+        m_db = QSqlDatabase::addDatabase("QPSQL", m_connectionName);
+        m_sqlite = false;
         m_db.setHostName(config.host);
         m_db.setPort(config.port);
         m_db.setDatabaseName(config.name);
@@ -79,6 +237,10 @@ bool DatabaseManager::initialize(const DatabaseConfigDialog::Config& config)
         return false;
     }
 
+    if (!configureConnection(m_db)) {
+        return false;
+    }
+
     // Run Migrations automatically
     if (!runMigrations()) {
         return false;
@@ -88,8 +250,40 @@ bool DatabaseManager::initialize(const DatabaseConfigDialog::Config& config)
     return true;
 }
 
+// SQLite: migration 006 indexes users with FTS5's trigram tokenizer, new in 3.34.
+// PostgreSQL: migration 008 records xid8 transaction ids with pg_current_xact_id(), new in 13.
+bool DatabaseManager::checkServerVersion()
+{
+    QSqlQuery query(m_db);
+    if (!m_sqlite) {
+        if (!query.exec("SHOW server_version_num") || !query.next()) {
+            setError(QString("Failed to read the PostgreSQL version: %1").arg(query.lastError().text()));
+            return false;
+        }
+        int versionNum = query.value(0).toInt();
+        if (versionNum < 130000) {
+            setError(QString("PostgreSQL %1.%2 is too old, 13 or later is required")
+                         .arg(versionNum / 10000).arg(versionNum >= 100000 ? versionNum % 10000 : versionNum / 100 % 100));
+            return false;
+        }
+        return true;
+    }
+
+    if (!query.exec("SELECT sqlite_version()") || !query.next()) {
+        setError(QString("Failed to read the SQLite version: %1").arg(query.lastError().text()));
+        return false;
+    }
+    QString version = query.value(0).toString();
+    if (QVersionNumber::fromString(version) < QVersionNumber(3, 34)) {
+        setError(QString("SQLite %1 is too old, 3.34 or later with FTS5 is required").arg(version));
+        return false;
+    }
+    return true;
+}
+
 bool DatabaseManager::runMigrations()
 {
+    DB_OPERATION("runMigrations");
     if (!isOpen()) {
         setError("Database not open");
         return false;
@@ -105,13 +299,17 @@ bool DatabaseManager::runMigrations()
         migrationDir = ":/migrations/postgresql";
     }
     
+    if (!checkServerVersion()) {
+        return false;
+    }
+
     MigrationManager migrator(m_db, migrationDir);
     if (!migrator.migrate()) {
         setError(QString("Migration failed: %1").arg(migrator.getLastError()));
         return false;
     }
     
-    qDebug() << "Migrations executed successfully";
+    qDebug() << "Schema at version" << migrator.appliedVersion();
     return true;
 }
 
@@ -122,6 +320,7 @@ bool DatabaseManager::isOpen() const
 
 bool DatabaseManager::addUser(const QString& name, const QString& email, const QByteArray& fingerprintTemplate, int& userId)
 {
+    DB_OPERATION("addUser");
     if (name.trimmed().isEmpty()) {
         setError("Name cannot be empty");
         return false;
@@ -132,11 +331,12 @@ bool DatabaseManager::addUser(const QString& name, const QString& email, const Q
         return false;
     }
 
-    QSqlQuery query(m_db);
-    query.prepare("INSERT INTO users (name, email, fingerprint_template) VALUES (:name, :email, :template)");
+    QSqlQuery query = preparedQuery("INSERT INTO users (name, email, fingerprint_template, fingerprint_signature, updated_at) "
+                                    "VALUES (:name, :email, :template, :signature, CURRENT_TIMESTAMP)");
     query.bindValue(":name", name.trimmed());
     query.bindValue(":email", email.trimmed());
     query.bindValue(":template", fingerprintTemplate);
+    query.bindValue(":signature", signatureValue(fingerprintTemplate));
 
     if (!query.exec()) {
         setError(QString("Failed to add user: %1").arg(query.lastError().text()));
@@ -145,19 +345,22 @@ bool DatabaseManager::addUser(const QString& name, const QString& email, const Q
 
     userId = query.lastInsertId().toInt();
     qDebug() << "User added successfully. ID:" << userId;
+    emit userAdded(userId, fingerprintTemplate);
     return true;
 }
 
 bool DatabaseManager::updateUserFingerprint(int userId, const QByteArray& fingerprintTemplate)
 {
+    DB_OPERATION("updateUserFingerprint");
     if (fingerprintTemplate.isEmpty()) {
         setError("Fingerprint template cannot be empty");
         return false;
     }
 
-    QSqlQuery query(m_db);
-    query.prepare("UPDATE users SET fingerprint_template = :template, updated_at = CURRENT_TIMESTAMP WHERE id = :id");
+    QSqlQuery query = preparedQuery("UPDATE users SET fingerprint_template = :template, fingerprint_signature = :signature, "
+                                    "updated_at = CURRENT_TIMESTAMP WHERE id = :id");
     query.bindValue(":template", fingerprintTemplate);
+    query.bindValue(":signature", signatureValue(fingerprintTemplate));
     query.bindValue(":id", userId);
 
     if (!query.exec()) {
@@ -171,13 +374,14 @@ bool DatabaseManager::updateUserFingerprint(int userId, const QByteArray& finger
     }
 
     qDebug() << "Fingerprint updated successfully for user ID:" << userId;
+    emit userFingerprintUpdated(userId, fingerprintTemplate);
     return true;
 }
 
 bool DatabaseManager::getUserById(int userId, User& user)
 {
-    QSqlQuery query(m_db);
-    query.prepare("SELECT id, name, email, fingerprint_template, created_at, updated_at FROM users WHERE id = :id");
+    DB_OPERATION("getUserById");
+    QSqlQuery query = preparedQuery("SELECT id, name, email, fingerprint_template, created_at, updated_at, change_seq FROM users WHERE id = :id");
     query.bindValue(":id", userId);
 
     if (!query.exec()) {
@@ -196,14 +400,61 @@ bool DatabaseManager::getUserById(int userId, User& user)
     user.fingerprintTemplate = query.value(3).toByteArray();
     user.createdAt = query.value(4).toString();
     user.updatedAt = query.value(5).toString();
+    user.changeSeq = query.value(6).toLongLong();
+    query.finish();
+
+    return true;
+}
+
+bool DatabaseManager::getUserSummaryById(int userId, UserSummary& user)
+{
+    DB_OPERATION("getUserSummaryById");
+    QSqlQuery query = preparedQuery("SELECT id, name, email FROM users WHERE id = :id");
+    query.bindValue(":id", userId);
+
+    if (!query.exec()) {
+        setError(QString("Failed to get user: %1").arg(query.lastError().text()));
+        return false;
+    }
+
+    if (!query.next()) {
+        setError("User not found");
+        return false;
+    }
+
+    user.id = query.value(0).toInt();
+    user.name = query.value(1).toString();
+    user.email = query.value(2).toString();
+    query.finish();
 
     return true;
 }
 
+bool DatabaseManager::getUserChangeSeq(int userId, qint64& changeSeq)
+{
+    DB_OPERATION("getUserChangeSeq");
+    QSqlQuery query = preparedQuery("SELECT change_seq FROM users WHERE id = :id");
+    query.bindValue(":id", userId);
+
+    if (!query.exec()) {
+        setError(QString("Failed to get user: %1").arg(query.lastError().text()));
+        return false;
+    }
+
+    if (!query.next()) {
+        setError("User not found");
+        return false;
+    }
+
+    changeSeq = query.value(0).toLongLong();
+    query.finish();
+    return true;
+}
+
 bool DatabaseManager::getUserByName(const QString& name, User& user)
 {
-    QSqlQuery query(m_db);
-    query.prepare("SELECT id, name, email, fingerprint_template, created_at, updated_at FROM users WHERE name = :name");
+    DB_OPERATION("getUserByName");
+    QSqlQuery query = preparedQuery("SELECT id, name, email, fingerprint_template, created_at, updated_at, change_seq FROM users WHERE name = :name");
     query.bindValue(":name", name.trimmed());
 
     if (!query.exec()) {
@@ -222,16 +473,19 @@ bool DatabaseManager::getUserByName(const QString& name, User& user)
     user.fingerprintTemplate = query.value(3).toByteArray();
     user.createdAt = query.value(4).toString();
     user.updatedAt = query.value(5).toString();
+    user.changeSeq = query.value(6).toLongLong();
+    query.finish();
 
     return true;
 }
 
 QVector<User> DatabaseManager::getAllUsers()
 {
+    DB_OPERATION("getAllUsers");
     QVector<User> users;
 
-    QSqlQuery query(m_db);
-    if (!query.exec("SELECT id, name, email, fingerprint_template, created_at, updated_at FROM users ORDER BY name")) {
+    QSqlQuery query = preparedQuery("SELECT id, name, email, fingerprint_template, created_at, updated_at, change_seq FROM users ORDER BY name");
+    if (!query.exec()) {
         setError(QString("Failed to get users: %1").arg(query.lastError().text()));
         return users;
     }
@@ -244,6 +498,7 @@ QVector<User> DatabaseManager::getAllUsers()
         user.fingerprintTemplate = query.value(3).toByteArray();
         user.createdAt = query.value(4).toString();
         user.updatedAt = query.value(5).toString();
+        user.changeSeq = query.value(6).toLongLong();
         users.append(user);
     }
 
@@ -251,10 +506,210 @@ QVector<User> DatabaseManager::getAllUsers()
     return users;
 }
 
+bool DatabaseManager::getAllTemplates(QMap<int, QByteArray>& templates, QMap<int, QByteArray>* signatures,
+                                      GalleryWatermark* watermark)
+{
+    DB_OPERATION("getAllTemplates");
+    templates.clear();
+    if (signatures) signatures->clear();
+
+    // With a watermark both reads share one snapshot, so a concurrent writer
+    // can never stamp these rows with a newer watermark
+    QSqlDatabase db = connection();
+    if (watermark) {
+        if (!db.transaction()) {
+            setError(QString("Failed to start template read: %1").arg(db.lastError().text()));
+            return false;
+        }
+        if (db.driverName() != "QSQLITE") {
+            QSqlQuery isolation(db);
+            isolation.exec("SET TRANSACTION ISOLATION LEVEL REPEATABLE READ");
+        }
+        if (!getGalleryWatermark(*watermark)) {
+            db.rollback();
+            return false;
+        }
+    }
+
+    QSqlQuery query = preparedQuery("SELECT id, fingerprint_template, fingerprint_signature FROM users WHERE fingerprint_template IS NOT NULL");
+    if (!query.exec()) {
+        setError(QString("Failed to get templates: %1").arg(query.lastError().text()));
+        if (watermark) db.rollback();
+        return false;
+    }
+
+    while (query.next()) {
+        QByteArray tpl = query.value(1).toByteArray();
+        if (!tpl.isEmpty()) {
+            int id = query.value(0).toInt();
+            templates.insert(id, tpl);
+            if (signatures && !query.isNull(2)) {
+                signatures->insert(id, query.value(2).toByteArray());
+            }
+        }
+    }
+    if (watermark) {
+        query.finish();
+        db.commit(); // Read only, nothing to lose if this fails
+    }
+
+    qDebug() << "Retrieved" << templates.size() << "templates";
+    return true;
+}
+
+bool DatabaseManager::updateSignatures(const QMap<int, QByteArray>& signatures)
+{
+    DB_OPERATION("updateSignatures");
+    if (signatures.isEmpty()) return true;
+
+    QSqlDatabase db = connection();
+    if (!db.transaction()) {
+        setError(QString("Failed to start signature update: %1").arg(db.lastError().text()));
+        return false;
+    }
+
+    // change_seq stays as is: the template did not change, caches and sync cursors stay valid
+    QSqlQuery query = preparedQuery("UPDATE users SET fingerprint_signature = :signature WHERE id = :id");
+    for (auto it = signatures.constBegin(); it != signatures.constEnd(); ++it) {
+        query.bindValue(":signature", it.value());
+        query.bindValue(":id", it.key());
+        if (!query.exec()) {
+            setError(QString("Failed to store signature: %1").arg(query.lastError().text()));
+            db.rollback();
+            return false;
+        }
+    }
+
+    if (!db.commit()) {
+        setError(QString("Failed to commit signatures: %1").arg(db.lastError().text()));
+        db.rollback();
+        return false;
+    }
+    return true;
+}
+
+bool DatabaseManager::getGalleryWatermark(GalleryWatermark& watermark)
+{
+    DB_OPERATION("getGalleryWatermark");
+    // Every template write and every delete takes the next change_seq, so the
+    // larger of the row and tombstone maxima never goes back
+    QSqlQuery query = preparedQuery("SELECT COUNT(*), MAX(id), "
+                                    "(SELECT MAX(change_seq) FROM users), (SELECT MAX(change_seq) FROM deleted_users) "
+                                    "FROM users WHERE fingerprint_template IS NOT NULL");
+    if (!query.exec() || !query.next()) {
+        setError(QString("Failed to read gallery watermark: %1").arg(query.lastError().text()));
+        return false;
+    }
+
+    watermark.templateCount = query.value(0).toInt();
+    watermark.maxUserId = query.value(1).toInt();
+    watermark.lastChangeSeq = qMax(query.value(2).toLongLong(), query.value(3).toLongLong());
+    query.finish();
+    return true;
+}
+
+bool DatabaseManager::changeCursor(QString& cursor)
+{
+    // A sequence that was never used reports its start value with is_called false
+    bool sqlite = connection().driverName() == "QSQLITE";
+    QSqlQuery query = preparedQuery(sqlite
+        ? "SELECT value FROM change_sequence"
+        : "SELECT CASE WHEN is_called THEN last_value ELSE 0 END, "
+          "CAST(pg_snapshot_xmin(pg_current_snapshot()) AS TEXT) FROM user_change_seq");
+    if (!query.exec() || !query.next()) {
+        setError(QString("Failed to read change sequence: %1").arg(query.lastError().text()));
+        return false;
+    }
+
+    cursor = QString::number(query.value(0).toLongLong());
+    if (!sqlite) {
+        cursor += ":" + query.value(1).toString();
+    }
+    query.finish();
+    return true;
+}
+
+bool DatabaseManager::fetchChangesSince(const QString& since, QVector<UserChange>& changes, QString& nextSince)
+{
+    DB_OPERATION("fetchChangesSince");
+    changes.clear();
+
+    bool sqlite = connection().driverName() == "QSQLITE";
+    qint64 sinceSeq = 0;
+    QString sinceXmin;
+    if (!since.isEmpty()) {
+        QStringList parts = since.split(':');
+        bool seqOk = false;
+        bool xminOk = sqlite;
+        sinceSeq = parts.value(0).toLongLong(&seqOk);
+        if (!sqlite) {
+            sinceXmin = parts.value(1);
+            sinceXmin.toULongLong(&xminOk);
+        }
+        if (!seqOk || !xminOk || parts.size() != (sqlite ? 1 : 2)) {
+            setError(QString("Invalid change cursor: %1").arg(since));
+            return false;
+        }
+    }
+
+    // Taken before reading, so anything written meanwhile is seen by the next call
+    QString cursor;
+    if (!changeCursor(cursor)) {
+        return false;
+    }
+
+    // SQLite commits in sequence order. On PostgreSQL a transaction that was
+    // running at the last read may commit a value below sinceSeq afterwards;
+    // its transaction id is at least that read's xmin.
+    QString filter = sqlite ? "change_seq > :seq" : "(change_seq > :seq OR change_xid >= CAST(:xmin AS xid8))";
+
+    QString sql = "SELECT id, fingerprint_template, change_seq FROM users";
+    if (!since.isEmpty()) {
+        sql += " WHERE " + filter;
+    }
+    QSqlQuery query = preparedQuery(sql);
+    if (!since.isEmpty()) {
+        query.bindValue(":seq", sinceSeq);
+        if (!sqlite) query.bindValue(":xmin", sinceXmin);
+    }
+    if (!query.exec()) {
+        setError(QString("Failed to fetch changed users: %1").arg(query.lastError().text()));
+        return false;
+    }
+    while (query.next()) {
+        UserChange change;
+        change.id = query.value(0).toInt();
+        change.fingerprintTemplate = query.value(1).toByteArray();
+        change.changeSeq = query.value(2).toLongLong();
+        changes.append(change);
+    }
+
+    // A full feed has nothing to delete
+    if (!since.isEmpty()) {
+        QSqlQuery tombstones = preparedQuery("SELECT id, change_seq FROM deleted_users WHERE " + filter);
+        tombstones.bindValue(":seq", sinceSeq);
+        if (!sqlite) tombstones.bindValue(":xmin", sinceXmin);
+        if (!tombstones.exec()) {
+            setError(QString("Failed to fetch deleted users: %1").arg(tombstones.lastError().text()));
+            return false;
+        }
+        while (tombstones.next()) {
+            UserChange change;
+            change.id = tombstones.value(0).toInt();
+            change.deleted = true;
+            change.changeSeq = tombstones.value(1).toLongLong();
+            changes.append(change);
+        }
+    }
+
+    nextSince = cursor;
+    return true;
+}
+
 bool DatabaseManager::deleteUser(int userId)
 {
-    QSqlQuery query(m_db);
-    query.prepare("DELETE FROM users WHERE id = :id");
+    DB_OPERATION("deleteUser");
+    QSqlQuery query = preparedQuery("DELETE FROM users WHERE id = :id");
     query.bindValue(":id", userId);
 
     if (!query.exec()) {
@@ -268,29 +723,34 @@ bool DatabaseManager::deleteUser(int userId)
     }
 
     qDebug() << "User deleted successfully. ID:" << userId;
+    emit userDeleted(userId);
     return true;
 }
 
 bool DatabaseManager::userExists(const QString& name)
 {
-    QSqlQuery query(m_db);
-    query.prepare("SELECT COUNT(*) FROM users WHERE name = :name");
+    DB_OPERATION("userExists");
+    QSqlQuery query = preparedQuery("SELECT COUNT(*) FROM users WHERE name = :name");
     query.bindValue(":name", name.trimmed());
 
     if (!query.exec() || !query.next()) {
         return false;
     }
 
-    return query.value(0).toInt() > 0;
+    bool exists = query.value(0).toInt() > 0;
+    query.finish();
+    return exists;
 }
 
 QVector<User> DatabaseManager::searchUsers(const QString& searchTerm)
 {
+    DB_OPERATION("searchUsers");
     QVector<User> users;
+    QString term = searchTerm.trimmed();
 
-    QSqlQuery query(m_db);
-    query.prepare("SELECT id, name, email, fingerprint_template, created_at, updated_at FROM users WHERE name LIKE :term OR email LIKE :term ORDER BY name");
-    query.bindValue(":term", QString("%%1%").arg(searchTerm.trimmed()));
+    QSqlQuery query = preparedQuery(QString("SELECT id, name, email, fingerprint_template, created_at, updated_at, change_seq FROM users WHERE %1 ORDER BY name, id")
+                                        .arg(searchCondition(term)));
+    bindSearch(query, term);
 
     if (!query.exec()) {
         setError(QString("Failed to search users: %1").arg(query.lastError().text()));
@@ -305,15 +765,328 @@ QVector<User> DatabaseManager::searchUsers(const QString& searchTerm)
         user.fingerprintTemplate = query.value(3).toByteArray();
         user.createdAt = query.value(4).toString();
         user.updatedAt = query.value(5).toString();
+        user.changeSeq = query.value(6).toLongLong();
+        users.append(user);
+    }
+
+    return users;
+}
+
+bool DatabaseManager::useFullTextSearch(const QString& searchTerm) const
+{
+    // users_fts (SQLite only); the trigram tokenizer only indexes runs of three or more characters
+    return m_sqlite && searchTerm.toUcs4().size() >= 3;
+}
+
+QString DatabaseManager::searchCondition(const QString& searchTerm) const
+{
+    if (useFullTextSearch(searchTerm)) {
+        return "id IN (SELECT rowid FROM users_fts WHERE users_fts MATCH :match)";
+    }
+    // SQLite LIKE already ignores ASCII case; on PostgreSQL the trigram indexes serve ILIKE
+    QString like = m_sqlite ? "LIKE" : "ILIKE";
+    return QString("(name %1 :term ESCAPE '\\' OR email %1 :term ESCAPE '\\')").arg(like);
+}
+
+void DatabaseManager::bindSearch(QSqlQuery& query, const QString& searchTerm) const
+{
+    if (useFullTextSearch(searchTerm)) {
+        // One quoted phrase: a plain substring match, FTS5 operators in the term stay literal
+        QString phrase = searchTerm;
+        query.bindValue(":match", QString("\"%1\"").arg(phrase.replace('"', "\"\"")));
+        return;
+    }
+
+    QString escaped = searchTerm;
+    escaped.replace('\\', "\\\\").replace('%', "\\%").replace('_', "\\_");
+    query.bindValue(":term", QString("%%1%").arg(escaped));
+}
+
+QVector<UserSummary> DatabaseManager::getUserSummaries(int limit, const QString& afterName, int afterId)
+{
+    return querySummaries(QString(), limit, afterName, afterId);
+}
+
+QVector<UserSummary> DatabaseManager::searchUserSummaries(const QString& searchTerm, int limit, const QString& afterName, int afterId)
+{
+    return querySummaries(searchTerm.trimmed(), limit, afterName, afterId);
+}
+
+int DatabaseManager::countUsers()
+{
+    DB_OPERATION("countUsers");
+    QSqlQuery query = preparedQuery("SELECT COUNT(*) FROM users");
+    if (!query.exec() || !query.next()) {
+        setError(QString("Failed to count users: %1").arg(query.lastError().text()));
+        return -1;
+    }
+
+    int count = query.value(0).toInt();
+    query.finish();
+    return count;
+}
+
+bool DatabaseManager::exportUsers(QIODevice* device, int& exported, std::function<void(int)> progressCb)
+{
+    DB_OPERATION("exportUsers");
+    exported = 0;
+
+    UserArchiveWriter writer(device);
+    if (!writer.writeHeader()) {
+        setError(writer.getLastError());
+        return false;
+    }
+
+    QSqlQuery query = preparedQuery("SELECT name, email, fingerprint_template, CAST(created_at AS TEXT) FROM users ORDER BY id");
+    if (!query.exec()) {
+        setError(QString("Failed to export users: %1").arg(query.lastError().text()));
+        return false;
+    }
+
+    while (query.next()) {
+        User user;
+        user.id = 0;
+        user.name = query.value(0).toString();
+        user.email = query.value(1).toString();
+        user.fingerprintTemplate = query.value(2).toByteArray();
+        user.createdAt = query.value(3).toString();
+        if (!writer.writeUser(user)) {
+            query.finish();
+            setError(writer.getLastError());
+            return false;
+        }
+
+        ++exported;
+        if (progressCb && exported % 1000 == 0) {
+            progressCb(exported);
+        }
+    }
+
+    if (!writer.finish()) {
+        setError(writer.getLastError());
+        return false;
+    }
+
+    if (progressCb) progressCb(exported);
+    qDebug() << "Exported" << exported << "users";
+    return true;
+}
+
+bool DatabaseManager::importUsers(QIODevice* device, int& imported, std::function<void(int)> progressCb)
+{
+    DB_OPERATION("importUsers");
+    // 5 parameters per row keeps a full batch under SQLite's 999 variable limit
+    const int batchSize = 150;
+    imported = 0;
+
+    UserArchiveReader reader(device);
+    if (!reader.readHeader()) {
+        setError(reader.getLastError());
+        return false;
+    }
+
+    QSqlDatabase db = connection();
+    if (!db.transaction()) {
+        setError(QString("Failed to start import transaction: %1").arg(db.lastError().text()));
+        return false;
+    }
+
+    QVector<User> batch;
+    batch.reserve(batchSize);
+    int count = 0;
+    bool ok = true;
+    User user;
+
+    while (ok && reader.readNext(user)) {
+        if (user.name.trimmed().isEmpty()) {
+            setError(QString("Archive record %1 has no name").arg(count + batch.size() + 1));
+            ok = false;
+            break;
+        }
+
+        batch.append(user);
+        if (batch.size() == batchSize) {
+            ok = insertUserBatch(batch);
+            count += batch.size();
+            batch.clear();
+            if (ok && progressCb) progressCb(count);
+        }
+    }
+
+    if (ok && !reader.atEnd()) {
+        setError(reader.getLastError());
+        ok = false;
+    }
+    if (ok && !batch.isEmpty()) {
+        ok = insertUserBatch(batch);
+        count += batch.size();
+    }
+
+    if (!ok) {
+        db.rollback();
+        return false;
+    }
+    if (!db.commit()) {
+        setError(QString("Failed to commit import: %1").arg(db.lastError().text()));
+        db.rollback();
+        return false;
+    }
+
+    imported = count;
+    if (progressCb) progressCb(imported);
+    qDebug() << "Imported" << imported << "users";
+    emit usersImported(imported);
+    return true;
+}
+
+bool DatabaseManager::insertUserBatch(const QVector<User>& users)
+{
+    // Keep the archived created_at, fall back to now for archives without one
+    QString createdAt = connection().driverName() == "QSQLITE"
+        ? "COALESCE(?, CURRENT_TIMESTAMP)"
+        : "COALESCE(CAST(? AS TIMESTAMP), CURRENT_TIMESTAMP)";
+    QString row = QString("(?, ?, ?, ?, %1, CURRENT_TIMESTAMP)").arg(createdAt);
+
+    QStringList rows;
+    rows.reserve(users.size());
+    for (int i = 0; i < users.size(); ++i) {
+        rows << row;
+    }
+
+    // Full batches share one SQL text, so the statement is prepared once
+    QSqlQuery query = preparedQuery("INSERT INTO users (name, email, fingerprint_template, fingerprint_signature, created_at, updated_at) VALUES "
+                                    + rows.join(", "));
+    int index = 0;
+    for (const User& user : users) {
+        query.bindValue(index++, user.name.trimmed());
+        query.bindValue(index++, user.email.trimmed());
+        query.bindValue(index++, user.fingerprintTemplate.isEmpty()
+                                     ? QVariant(QMetaType::fromType<QByteArray>())
+                                     : QVariant(user.fingerprintTemplate));
+        query.bindValue(index++, signatureValue(user.fingerprintTemplate));
+        query.bindValue(index++, user.createdAt.isEmpty()
+                                     ? QVariant(QMetaType::fromType<QString>())
+                                     : QVariant(user.createdAt));
+    }
+
+    if (!query.exec()) {
+        setError(QString("Failed to import users: %1").arg(query.lastError().text()));
+        return false;
+    }
+    return true;
+}
+
+bool DatabaseManager::insertAccessEvents(const QVector<AccessEvent>& events)
+{
+    DB_OPERATION("insertAccessEvents");
+    if (events.isEmpty()) return true;
+
+    QSqlDatabase db = connection();
+    if (!db.transaction()) {
+        setError(QString("Failed to start audit transaction: %1").arg(db.lastError().text()));
+        return false;
+    }
+
+    QString occurredAt = db.driverName() == "QSQLITE" ? "?" : "CAST(? AS TIMESTAMP)";
+    QSqlQuery query = preparedQuery(QString("INSERT INTO access_events (occurred_at, kind, result, user_id, score, latency_ms, reader) "
+                                            "VALUES (%1, ?, ?, ?, ?, ?, ?)").arg(occurredAt));
+    for (const AccessEvent& event : events) {
+        // Same text form as CURRENT_TIMESTAMP, with milliseconds
+        query.bindValue(0, event.occurredAt.toUTC().toString("yyyy-MM-dd hh:mm:ss.zzz"));
+        query.bindValue(1, event.kind);
+        query.bindValue(2, event.result);
+        query.bindValue(3, event.userId >= 0 ? QVariant(event.userId) : QVariant(QMetaType::fromType<int>()));
+        query.bindValue(4, event.score);
+        query.bindValue(5, event.latencyMs);
+        query.bindValue(6, event.reader);
+        if (!query.exec()) {
+            setError(QString("Failed to write access event: %1").arg(query.lastError().text()));
+            db.rollback();
+            return false;
+        }
+    }
+
+    if (!db.commit()) {
+        setError(QString("Failed to commit access events: %1").arg(db.lastError().text()));
+        db.rollback();
+        return false;
+    }
+    return true;
+}
+
+QVector<UserSummary> DatabaseManager::querySummaries(const QString& searchTerm, int limit, const QString& afterName, int afterId)
+{
+    DB_OPERATION("querySummaries");
+    QVector<UserSummary> users;
+
+    QStringList conditions;
+    if (!searchTerm.isEmpty()) {
+        conditions << searchCondition(searchTerm);
+    }
+    bool keyset = !afterName.isNull();
+    if (keyset) {
+        // Row-value comparison spelled out, works on both SQLite and PostgreSQL
+        conditions << "(name > :afterName OR (name = :afterName AND id > :afterId))";
+    }
+
+    QString sql = "SELECT id, name, email FROM users";
+    if (!conditions.isEmpty()) {
+        sql += " WHERE " + conditions.join(" AND ");
+    }
+    sql += " ORDER BY name, id";
+    if (limit > 0) {
+        sql += " LIMIT :limit";
+    }
+
+    QSqlQuery query = preparedQuery(sql);
+    if (!searchTerm.isEmpty()) {
+        bindSearch(query, searchTerm);
+    }
+    if (keyset) {
+        query.bindValue(":afterName", afterName);
+        query.bindValue(":afterId", afterId);
+    }
+    if (limit > 0) {
+        query.bindValue(":limit", limit);
+    }
+
+    if (!query.exec()) {
+        setError(QString("Failed to list users: %1").arg(query.lastError().text()));
+        return users;
+    }
+
+    if (limit > 0) {
+        users.reserve(limit);
+    }
+    while (query.next()) {
+        UserSummary user;
+        user.id = query.value(0).toInt();
+        user.name = query.value(1).toString();
+        user.email = query.value(2).toString();
         users.append(user);
     }
 
     return users;
 }
 
+QString DatabaseManager::getLastError() const
+{
+    if (QThread::currentThread() == thread()) {
+        return m_lastError;
+    }
+    return m_threadConnections.hasLocalData() ? m_threadConnections.localData()->lastError : QString();
+}
+
 void DatabaseManager::setError(const QString& error)
 {
-    m_lastError = error;
+    static Metrics::Counter* const errors = Metrics::counter("fp_db_errors_total", "Failed database calls.");
+    errors->increment();
+
+    if (QThread::currentThread() == thread()) {
+        m_lastError = error;
+    } else {
+        threadConnection()->lastError = error;
+    }
     qWarning() << "DatabaseManager Error:" << error;
 }
 
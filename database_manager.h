@@ -6,7 +6,13 @@
 #include <QSqlDatabase>
 #include <QSqlQuery>
 #include <QVector>
+#include <QMap>
 #include <QByteArray>
+#include <QHash>
+#include <QDateTime>
+#include <QThreadStorage>
+#include <atomic>
+#include <functional>
 #include "database_config_dialog.h"
 
 struct User {
@@ -16,8 +22,51 @@ struct User {
     QByteArray fingerprintTemplate;
     QString createdAt;
     QString updatedAt;
+    qint64 changeSeq = 0; // Moves on every template write; 0 when not read from the database
 };
 
+// Lightweight listing projection (no template blob)
+struct UserSummary {
+    int id;
+    QString name;
+    QString email;
+};
+
+// One row of the change feed; deleted rows come from the deleted_users tombstones
+struct UserChange {
+    int id = 0;
+    bool deleted = false;
+    QByteArray fingerprintTemplate; // Empty when deleted or no template enrolled
+    qint64 changeSeq = 0;           // change_seq of the row or tombstone
+};
+
+// Cheap change detector for the users table, compared against on-disk caches.
+// lastChangeSeq covers tombstones too, so it grows with every write.
+struct GalleryWatermark {
+    int templateCount = 0;
+    int maxUserId = 0;
+    qint64 lastChangeSeq = 0;
+
+    bool operator==(const GalleryWatermark& other) const {
+        return templateCount == other.templateCount && maxUserId == other.maxUserId
+            && lastChangeSeq == other.lastChangeSeq;
+    }
+    bool operator!=(const GalleryWatermark& other) const { return !(*this == other); }
+};
+
+// One verify or identify outcome, a row of access_events
+struct AccessEvent {
+    QDateTime occurredAt; // UTC
+    QString kind;         // verify or identify
+    QString result;       // match, no_match, cancelled or error
+    int userId = -1;      // Claimed user for verify, matched user for identify; -1 for none
+    int score = 0;
+    int latencyMs = 0;
+    QString reader;
+};
+
+class QIODevice;
+
 class DatabaseManager : public QObject {
     Q_OBJECT
 
@@ -28,30 +77,91 @@ public:
     bool initialize(const DatabaseConfigDialog::Config& config);
     void close(); // Close connection
     bool isOpen() const;
-    QString getLastError() const { return m_lastError; }
+    QString getLastError() const; // Last error raised on the calling thread
+    QString databaseFilePath() const { return m_dbPath; } // SQLite only, empty for PostgreSQL
 
     // Migration
     bool runMigrations(); // Explicitly run migrations
 
+    // Every method may be called from any thread. The owner thread uses the
+    // main connection; other threads get their own named clone, opened on first
+    // use, reopened after initialize() and removed when the thread exits.
+    QSqlDatabase connection();
+    // Prepared once per connection and cached; returned reset and ready to bind
+    QSqlQuery preparedQuery(const QString& sql);
+
     // User operations
     bool addUser(const QString& name, const QString& email, const QByteArray& fingerprintTemplate, int& userId);
     bool updateUserFingerprint(int userId, const QByteArray& fingerprintTemplate);
     bool getUserById(int userId, User& user);
     bool getUserByName(const QString& name, User& user);
+    bool getUserSummaryById(int userId, UserSummary& user);
+    bool getUserChangeSeq(int userId, qint64& changeSeq); // Freshness probe, no template read
     QVector<User> getAllUsers();
+    bool getAllTemplates(QMap<int, QByteArray>& templates, // id -> template, users with templates only
+                         QMap<int, QByteArray>* signatures = nullptr, // id -> stored pre-filter signature, where present
+                         GalleryWatermark* watermark = nullptr); // Read in the same transaction, describes exactly these rows
+    bool updateSignatures(const QMap<int, QByteArray>& signatures); // Backfill, leaves change_seq alone
+    bool getGalleryWatermark(GalleryWatermark& watermark);
+
+    // Change feed over change_seq and tombstones. Cursors are opaque text
+    // (empty = everything): the sequence position, plus on PostgreSQL the
+    // oldest transaction still running when it was taken, whose rows are
+    // fetched again next time because they may commit lower sequence values late.
+    bool changeCursor(QString& cursor);
+    bool fetchChangesSince(const QString& since, QVector<UserChange>& changes, QString& nextSince);
     bool deleteUser(int userId);
     bool userExists(const QString& name);
 
-    // Search operations
+    // Search operations: case-insensitive substring match on name or email.
+    // Served by the users_fts trigram index on SQLite (terms of 3+ characters)
+    // and by pg_trgm GIN indexes on PostgreSQL.
     QVector<User> searchUsers(const QString& searchTerm);
 
+    // Template-less listing, ordered by (name, id).
+    // Keyset paging: pass the last row of the previous page as afterName/afterId, limit <= 0 means no limit.
+    QVector<UserSummary> getUserSummaries(int limit = 0, const QString& afterName = QString(), int afterId = 0);
+    QVector<UserSummary> searchUserSummaries(const QString& searchTerm, int limit = 0, const QString& afterName = QString(), int afterId = 0);
+    int countUsers();
+
+    // Bulk transfer in the UserArchive format. Export streams rows through a
+    // forward-only cursor; import inserts multi-row batches inside a single
+    // transaction, all or nothing. progressCb gets the running row count.
+    bool exportUsers(QIODevice* device, int& exported, std::function<void(int)> progressCb = nullptr);
+    bool importUsers(QIODevice* device, int& imported, std::function<void(int)> progressCb = nullptr);
+
+    // Appends audit events in one transaction, so a batch costs one commit
+    bool insertAccessEvents(const QVector<AccessEvent>& events);
+
+signals:
+    // Emitted after a successful write, used to keep in-memory galleries current
+    void userAdded(int userId, const QByteArray& fingerprintTemplate);
+    void userFingerprintUpdated(int userId, const QByteArray& fingerprintTemplate);
+    void userDeleted(int userId);
+    void usersImported(int count); // Bulk import committed, per-row signals are not sent
+
 private:
-    QSqlDatabase m_db;
+    struct ThreadConnection;
+    ThreadConnection* threadConnection();
+
+    QSqlDatabase m_db; // Owner-thread connection, template for the clones
+    QString m_connectionName;
     QString m_dbPath;
-    QString m_lastError;
+    QString m_lastError; // Owner thread only
+    QHash<QString, QSqlQuery> m_statements; // Owner-thread statement cache
+    QThreadStorage<ThreadConnection*> m_threadConnections;
+    std::atomic<int> m_generation; // Bumped by close(), invalidates thread clones
+    std::atomic<bool> m_sqlite; // Driver chosen by initialize(); m_db itself is owner-thread only
 
     bool createTables();
     void setError(const QString& error);
+    QVector<UserSummary> querySummaries(const QString& searchTerm, int limit, const QString& afterName, int afterId);
+    bool insertUserBatch(const QVector<User>& users);
+    bool configureConnection(QSqlDatabase& db); // Per-connection setup, run right after open()
+    bool checkServerVersion(); // Oldest server the migrations run on
+    bool useFullTextSearch(const QString& searchTerm) const;
+    QString searchCondition(const QString& searchTerm) const; // Substring match on name or email
+    void bindSearch(QSqlQuery& query, const QString& searchTerm) const;
 };
 
 #endif // DATABASE_MANAGER_H
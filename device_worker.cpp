@@ -0,0 +1,563 @@
+#include "device_worker.h"
+#include "fingerprint_template.h"
+#include "trace.h"
+#include "metrics.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <glib.h>
+#include <fprint.h>
+
+// DigitalPersona Library
+#include <digitalpersona.h>
+
+// A selected reader. Device-thread only, except that cancellable and
+// requestId are written under m_mutex so requestCancel() can find the capture.
+struct DeviceWorker::Reader {
+    DeviceWorker* worker = nullptr;
+    QString id;
+    FpDevice* device = nullptr;
+    bool opened = false;                 // Set by onReaderOpened
+    QString error;                       // Open failure
+    GCancellable* cancellable = nullptr; // Running capture, under m_mutex
+    GPtrArray* gallery = nullptr;        // Empty gallery of the running capture
+    quint64 requestId = 0;               // Running capture, 0 when idle
+    QQueue<quint64> queued;              // Captures waiting for this reader
+    QElapsedTimer started;
+};
+
+namespace {
+
+// FP1 bytes of a scanned print. Probes are matched in process, so the print
+// must carry NBIS minutiae; a match-on-chip reader would hand back none.
+QString serializeProbe(FpPrint* print, QByteArray& probe)
+{
+    guchar* data = nullptr;
+    gsize length = 0;
+    GError* gerror = nullptr;
+    if (!fp_print_serialize(print, &data, &length, &gerror)) {
+        QString error = QString("Failed to serialize print: %1").arg(QString::fromUtf8(gerror->message));
+        g_clear_error(&gerror);
+        return error;
+    }
+    probe = QByteArray(reinterpret_cast<const char*>(data), int(length));
+    g_free(data);
+
+    if (!FingerprintTemplate::fromSerialized(probe).isValid()) {
+        probe.clear();
+        return "Reader returned a print without minutiae; probe capture needs an image reader";
+    }
+    return QString();
+}
+
+} // namespace
+
+DeviceWorker::DeviceWorker(QObject* parent)
+    : QThread(parent)
+    , m_fpManager(nullptr)
+    , m_ownsContext(false)
+    , m_fpContext(nullptr)
+    , m_pendingOps(0)
+    , m_stopping(false)
+    , m_readerOpen(false)
+    , m_busy(false)
+    , m_nextRequestId(0)
+{
+    setObjectName("DeviceWorker");
+}
+
+DeviceWorker::~DeviceWorker()
+{
+    shutdown();
+}
+
+QVector<ReaderInfo> DeviceWorker::availableReaders()
+{
+    QVector<ReaderInfo> readers;
+    FpContext* context = fp_context_new();
+    GPtrArray* devices = fp_context_get_devices(context); // Owned by the context
+    for (guint i = 0; i < devices->len; ++i) {
+        FpDevice* device = FP_DEVICE(g_ptr_array_index(devices, i));
+        ReaderInfo reader;
+        reader.id = QString::fromUtf8(fp_device_get_device_id(device));
+        reader.name = QString::fromUtf8(fp_device_get_name(device));
+        reader.driver = QString::fromUtf8(fp_device_get_driver(device));
+        readers.append(reader);
+    }
+    g_object_unref(context);
+    return readers;
+}
+
+void DeviceWorker::shutdown()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stopping = true;
+        m_commands.clear();
+    }
+    cancelAll();
+    m_condition.wakeAll();
+    g_main_context_wakeup(g_main_context_default());
+    wait();
+}
+
+void DeviceWorker::requestCancel(quint64 requestId)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_liveRequests.contains(requestId)) return; // Finished already
+    m_cancelledRequests.insert(requestId);
+    for (Reader* reader : m_readers) {
+        if (reader->requestId == requestId && reader->cancellable) {
+            g_cancellable_cancel(reader->cancellable);
+        }
+    }
+}
+
+void DeviceWorker::cancelAll()
+{
+    QMutexLocker locker(&m_mutex);
+    m_cancelledRequests = m_liveRequests;
+    for (Reader* reader : m_readers) {
+        if (reader->cancellable) {
+            g_cancellable_cancel(reader->cancellable);
+        }
+    }
+}
+
+quint64 DeviceWorker::addRequest()
+{
+    quint64 requestId = ++m_nextRequestId;
+    QMutexLocker locker(&m_mutex);
+    m_liveRequests.insert(requestId);
+    return requestId;
+}
+
+bool DeviceWorker::isCancelled(quint64 requestId) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_cancelledRequests.contains(requestId);
+}
+
+bool DeviceWorker::finishRequest(quint64 requestId)
+{
+    QMutexLocker locker(&m_mutex);
+    m_liveRequests.remove(requestId);
+    return m_cancelledRequests.remove(requestId);
+}
+
+QStringList DeviceWorker::openReaderIds() const
+{
+    QMutexLocker locker(&m_mutex);
+    QStringList ids;
+    for (const Reader* reader : m_readers) {
+        ids.append(reader->id);
+    }
+    return ids;
+}
+
+void DeviceWorker::post(std::function<void()> command)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_stopping) return;
+        m_commands.enqueue(command);
+        m_condition.wakeOne();
+    }
+    // An idle device thread blocks in the main context, see run()
+    g_main_context_wakeup(g_main_context_default());
+}
+
+void DeviceWorker::run()
+{
+    // libfprint's *_sync calls iterate the global default GMainContext, and
+    // its async calls complete there. This thread owns it for its whole
+    // lifetime; the GUI runs without the GLib event dispatcher (see
+    // main_app.cpp), so there is no contention.
+    Trace::setThreadName("DeviceWorker");
+    GMainContext* context = g_main_context_default();
+    m_ownsContext = g_main_context_acquire(context);
+    if (!m_ownsContext) {
+        qWarning() << "DeviceWorker: default GMainContext is owned by another thread";
+    }
+
+    m_fpManager = new FingerprintManager();
+    m_fpManager->setProgressCallback([this](int current, int total, QString message) {
+        emit enrollmentProgress(current, total, message);
+    });
+
+    for (;;) {
+        std::function<void()> command;
+        {
+            QMutexLocker locker(&m_mutex);
+            // Without the context no reader can run; sleep until a command arrives
+            while (!m_ownsContext && m_commands.isEmpty() && !m_stopping) {
+                m_condition.wait(&m_mutex);
+            }
+            if (m_stopping) break;
+            if (!m_commands.isEmpty()) command = m_commands.dequeue();
+        }
+
+        if (command) {
+            m_busy = true;
+            command();
+            m_busy = false;
+        } else {
+            // Idle: run reader callbacks until one fires or post() wakes the context
+            g_main_context_iteration(context, TRUE);
+        }
+    }
+
+    closeSelectedReaders();
+    m_fpManager->cleanup();
+    delete m_fpManager;
+    m_fpManager = nullptr;
+    m_readerOpen = false;
+
+    if (m_ownsContext) {
+        g_main_context_release(context);
+        m_ownsContext = false;
+    }
+}
+
+void DeviceWorker::initializeReader()
+{
+    post([this]() {
+        TRACE_SCOPE("device", "initializeReader");
+        if (m_readerOpen && m_readers.size() == m_readerIds.size()) {
+            emit readerInitialized(true, QString());
+            return;
+        }
+        // A second worker in the same process would iterate the first one's
+        // context from another thread; libfprint only supports one here
+        if (!m_ownsContext) {
+            emit readerInitialized(false, "Another reader thread owns the GLib main context; "
+                                          "only one DeviceWorker per process is supported");
+            return;
+        }
+
+        if (!m_readerIds.isEmpty()) {
+            // Succeeds when any reader opened; error then names the ones that did not
+            QString error;
+            bool ok = openSelectedReaders(error);
+            emit readerInitialized(ok, error);
+            return;
+        } else if (!m_fpManager->initialize() || !m_fpManager->openReader()) {
+            emit readerInitialized(false, m_fpManager->getLastError());
+            return;
+        }
+
+        m_readerOpen = true;
+        emit readerInitialized(true, QString());
+    });
+}
+
+bool DeviceWorker::openSelectedReaders(QString& error)
+{
+    if (!m_fpContext) {
+        m_fpContext = fp_context_new();
+    }
+    GPtrArray* devices = fp_context_get_devices(m_fpContext);
+
+    // All opens run at once and complete on this thread's main context
+    QStringList failures;
+    QVector<Reader*> opening;
+    for (const QString& id : m_readerIds) {
+        if (findReader(id)) continue; // Opened by an earlier call
+
+        FpDevice* device = nullptr;
+        for (guint i = 0; i < devices->len && !device; ++i) {
+            FpDevice* candidate = FP_DEVICE(g_ptr_array_index(devices, i));
+            if (id == QString::fromUtf8(fp_device_get_device_id(candidate))) {
+                device = FP_DEVICE(g_object_ref(candidate));
+            }
+        }
+        if (!device) {
+            failures.append(QString("No reader with id %1 is attached").arg(id));
+            continue;
+        }
+
+        Reader* reader = new Reader();
+        reader->worker = this;
+        reader->id = id;
+        reader->device = device;
+        opening.append(reader);
+        ++m_pendingOps;
+        fp_device_open(device, nullptr, &DeviceWorker::onReaderOpened, reader);
+    }
+    waitForPending();
+
+    for (Reader* reader : opening) {
+        if (reader->opened) {
+            QMutexLocker locker(&m_mutex);
+            m_readers.append(reader);
+        } else {
+            failures.append(reader->error);
+            g_object_unref(reader->device);
+            delete reader;
+        }
+    }
+
+    error = failures.join("; ");
+    m_readerOpen = !m_readers.isEmpty();
+    return m_readerOpen;
+}
+
+void DeviceWorker::closeSelectedReaders()
+{
+    // Running captures end with a cancelled error; queued ones are dropped
+    {
+        QMutexLocker locker(&m_mutex);
+        for (Reader* reader : m_readers) {
+            reader->queued.clear();
+            if (reader->cancellable) g_cancellable_cancel(reader->cancellable);
+        }
+    }
+    for (Reader* reader : m_readers) {
+        while (reader->requestId != 0) {
+            g_main_context_iteration(g_main_context_default(), TRUE);
+        }
+    }
+
+    for (Reader* reader : m_readers) {
+        ++m_pendingOps;
+        fp_device_close(reader->device, nullptr, &DeviceWorker::onReaderClosed, reader);
+    }
+    waitForPending();
+
+    QVector<Reader*> readers;
+    {
+        QMutexLocker locker(&m_mutex);
+        readers.swap(m_readers);
+    }
+    for (Reader* reader : readers) {
+        g_object_unref(reader->device);
+        delete reader;
+    }
+    g_clear_object(&m_fpContext);
+}
+
+DeviceWorker::Reader* DeviceWorker::findReader(const QString& id) const
+{
+    for (Reader* reader : m_readers) {
+        if (reader->id == id) return reader;
+    }
+    return nullptr;
+}
+
+void DeviceWorker::waitForPending()
+{
+    while (m_pendingOps > 0) {
+        g_main_context_iteration(g_main_context_default(), TRUE);
+    }
+}
+
+void DeviceWorker::onReaderOpened(GObject* source, GAsyncResult* result, void* data)
+{
+    Reader* reader = static_cast<Reader*>(data);
+    GError* gerror = nullptr;
+    if (fp_device_open_finish(FP_DEVICE(source), result, &gerror)) {
+        reader->opened = true;
+        qInfo() << "Opened reader" << reader->id << fp_device_get_name(reader->device);
+    } else {
+        reader->error = QString("Failed to open reader %1: %2").arg(reader->id).arg(QString::fromUtf8(gerror->message));
+        g_clear_error(&gerror);
+    }
+    --reader->worker->m_pendingOps;
+}
+
+void DeviceWorker::onReaderClosed(GObject* source, GAsyncResult* result, void* data)
+{
+    Reader* reader = static_cast<Reader*>(data);
+    GError* gerror = nullptr;
+    if (!fp_device_close_finish(FP_DEVICE(source), result, &gerror)) {
+        qWarning() << "DeviceWorker: closing reader" << reader->id << "failed:" << gerror->message;
+        g_clear_error(&gerror);
+    }
+    --reader->worker->m_pendingOps;
+}
+
+void DeviceWorker::startEnrollment()
+{
+    post([this]() {
+        bool ok = m_fpManager->startEnrollment();
+        emit enrollmentStarted(ok, ok ? QString() : m_fpManager->getLastError());
+    });
+}
+
+void DeviceWorker::captureEnrollmentSample()
+{
+    post([this]() {
+        QString message;
+        int quality = 0;
+        emit captureStarted();
+        int result;
+        {
+            TRACE_SCOPE("device", "captureEnrollmentSample");
+            static Metrics::Histogram* const latency = Metrics::histogram(
+                "fp_capture_seconds", "Reader capture time for one enrollment sample, finger wait included.");
+            Metrics::ScopedTimer timer(latency);
+            result = m_fpManager->addEnrollmentSample(message, quality, nullptr);
+        }
+
+        QByteArray templateData;
+        QString error;
+        if (result < 0) {
+            static Metrics::Counter* const failures = Metrics::counter("fp_capture_failures_total", "Enrollment captures the reader rejected.");
+            failures->increment();
+            error = m_fpManager->getLastError();
+        } else if (result == 1) {
+            TRACE_SCOPE("device", "createEnrollmentTemplate");
+            if (!m_fpManager->createEnrollmentTemplate(templateData)) {
+                error = "Failed to create fingerprint template";
+                templateData.clear();
+            }
+        }
+
+        emit enrollmentSampleFinished(result, message, templateData, error);
+    });
+}
+
+void DeviceWorker::cancelEnrollment()
+{
+    post([this]() {
+        m_fpManager->cancelEnrollment();
+    });
+}
+
+void DeviceWorker::verify(const QByteArray& fingerprintTemplate)
+{
+    post([this, fingerprintTemplate]() {
+        int score = 0;
+        emit captureStarted();
+        TRACE_SCOPE("device", "verify"); // Capture and match, the library does both
+        static Metrics::Histogram* const latency = Metrics::histogram(
+            "fp_reader_call_seconds", "Library capture-and-match calls on the device thread.", "op=\"verify\"");
+        Metrics::ScopedTimer timer(latency);
+        bool matched = m_fpManager->verifyFingerprint(fingerprintTemplate, score);
+        QString error = (!matched && score == 0) ? m_fpManager->getLastError() : QString();
+        emit verifyFinished(matched, score, error);
+    });
+}
+
+quint64 DeviceWorker::identify(const QMap<int, QByteArray>& templates)
+{
+    quint64 requestId = addRequest();
+    post([this, templates, requestId]() {
+        auto progressCb = [this](int current, int total) {
+            emit identifyProgress(current, total);
+        };
+        // Only this request's flag; a cancel aimed at an earlier one does not leak in
+        auto cancelCb = [this, requestId]() -> bool {
+            return isCancelled(requestId);
+        };
+
+        int score = 0;
+        emit captureStarted();
+        TRACE_SCOPE("device", "identify"); // Capture plus library 1:N
+        static Metrics::Histogram* const latency = Metrics::histogram(
+            "fp_reader_call_seconds", "Library capture-and-match calls on the device thread.", "op=\"identify\"");
+        Metrics::ScopedTimer timer(latency);
+        int userId = m_fpManager->identifyUser(templates, score, progressCb, cancelCb);
+        bool cancelled = finishRequest(requestId);
+        emit identifyFinished(userId, score, cancelled, requestId);
+    });
+    return requestId;
+}
+
+quint64 DeviceWorker::captureProbe(const QString& readerId)
+{
+    quint64 requestId = addRequest();
+    post([this, readerId, requestId]() {
+        Reader* reader = findReader(readerId);
+        if (!reader) {
+            finishRequest(requestId);
+            emit probeCaptured(readerId, QByteArray(), m_readerIds.isEmpty()
+                ? QString("Probe capture needs a reader selected by id")
+                : QString("Reader %1 is not open").arg(readerId), requestId);
+            return;
+        }
+
+        // One capture per reader at a time; the other readers keep scanning meanwhile
+        reader->queued.enqueue(requestId);
+        if (reader->requestId == 0) {
+            startCapture(reader);
+        }
+    });
+    return requestId;
+}
+
+void DeviceWorker::startCapture(Reader* reader)
+{
+    // Captures cancelled while they waited never reach the reader
+    quint64 requestId = reader->queued.dequeue();
+    while (isCancelled(requestId)) {
+        finishRequest(requestId);
+        emit probeCaptured(reader->id, QByteArray(), "Capture cancelled", requestId);
+        if (reader->queued.isEmpty()) return;
+        requestId = reader->queued.dequeue();
+    }
+
+    GCancellable* cancellable = g_cancellable_new();
+    {
+        QMutexLocker locker(&m_mutex);
+        reader->requestId = requestId;
+        reader->cancellable = cancellable;
+    }
+
+    // An image reader scans and extracts minutiae before comparing; with an
+    // empty gallery nothing matches and the scanned print comes back.
+    // serializeProbe() rejects prints without minutiae.
+    reader->gallery = g_ptr_array_new();
+    reader->started.start();
+    emit captureStarted();
+    fp_device_identify(reader->device, reader->gallery, cancellable, nullptr, nullptr, nullptr,
+                       &DeviceWorker::onProbeIdentified, reader);
+}
+
+void DeviceWorker::onProbeIdentified(GObject* source, GAsyncResult* result, void* data)
+{
+    Reader* reader = static_cast<Reader*>(data);
+    DeviceWorker* worker = reader->worker;
+
+    FpPrint* match = nullptr;
+    FpPrint* print = nullptr;
+    GError* gerror = nullptr;
+    bool ok = fp_device_identify_finish(FP_DEVICE(source), result, &match, &print, &gerror);
+
+    static Metrics::Histogram* const latency = Metrics::histogram(
+        "fp_reader_call_seconds", "Library capture-and-match calls on the device thread.", "op=\"capture_probe\"");
+    latency->observeNanoseconds(reader->started.nsecsElapsed());
+
+    GCancellable* cancellable;
+    quint64 requestId;
+    {
+        QMutexLocker locker(&worker->m_mutex);
+        cancellable = reader->cancellable;
+        requestId = reader->requestId;
+        reader->cancellable = nullptr;
+        reader->requestId = 0;
+    }
+    g_object_unref(cancellable);
+    g_ptr_array_unref(reader->gallery);
+    reader->gallery = nullptr;
+
+    QByteArray probe;
+    QString error;
+    if (!ok) {
+        error = g_error_matches(gerror, G_IO_ERROR, G_IO_ERROR_CANCELLED)
+            ? QString("Capture cancelled") : QString::fromUtf8(gerror->message);
+    } else if (!print) {
+        error = "Reader returned no print";
+    } else {
+        error = serializeProbe(print, probe);
+    }
+    g_clear_object(&match);
+    g_clear_object(&print);
+    g_clear_error(&gerror);
+
+    worker->finishRequest(requestId);
+    emit worker->probeCaptured(reader->id, probe, error, requestId);
+
+    if (!reader->queued.isEmpty()) {
+        worker->startCapture(reader);
+    }
+}
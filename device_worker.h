@@ -0,0 +1,141 @@
+#ifndef DEVICE_WORKER_H
+#define DEVICE_WORKER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QMap>
+#include <QSet>
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <atomic>
+#include <functional>
+
+class FingerprintManager;
+typedef struct _FpContext FpContext;
+typedef struct _FpDevice FpDevice;
+typedef struct _GObject GObject;
+typedef struct _GAsyncResult GAsyncResult;
+
+// An attached reader as libfprint lists it; id is stable for the USB port
+struct ReaderInfo {
+    QString id;
+    QString name;
+    QString driver;
+};
+
+// Single reader-owner thread. The FingerprintManager is created, used and
+// destroyed on this thread only; callers queue commands and receive results
+// through (queued) signals, so the UI never blocks on libfprint.
+// One per process: the thread must own GLib's default main context, and
+// FingerprintManager opens whichever reader libfprint lists first.
+//
+// With reader ids set, initializeReader() opens each of those devices through
+// libfprint's async API instead, and captureProbe() scans a print on one of
+// them for the caller to match. Captures on different readers run at the same
+// time: between commands the thread iterates the main context, which drives
+// every open device, so one process serves all readers with one gallery and
+// one matcher pool. Readers deliberately share this thread instead of each
+// getting its own; see run() for why one thread owns the context. The GUI
+// app uses the library's single reader only.
+class DeviceWorker : public QThread {
+    Q_OBJECT
+
+public:
+    explicit DeviceWorker(QObject* parent = nullptr);
+    ~DeviceWorker() override;
+
+    // Enumerates on the calling thread; call before any DeviceWorker starts
+    static QVector<ReaderInfo> availableReaders();
+
+    // Before start(); empty keeps the library's own reader
+    void setReaderIds(const QStringList& ids) { m_readerIds = ids; }
+    QStringList readerIds() const { return m_readerIds; }
+    bool capturesProbes() const { return !m_readerIds.isEmpty(); }
+    QStringList openReaderIds() const; // Selected readers that opened, thread-safe
+
+    // Thread-safe state
+    bool isReaderOpen() const { return m_readerOpen.load(); }
+    bool isBusy() const { return m_busy.load(); }
+
+    // Commands, executed in FIFO order on the device thread. Captures return
+    // a request id that their finish signal echoes, so clients sharing the
+    // worker only take their own results.
+    void initializeReader();
+    void startEnrollment();
+    void captureEnrollmentSample();
+    void cancelEnrollment();
+    void verify(const QByteArray& fingerprintTemplate);
+    quint64 identify(const QMap<int, QByteArray>& templates);
+    quint64 captureProbe(const QString& readerId); // Selected readers only, answered by probeCaptured
+
+    // Cancels one identify or probe capture by the id its call returned: a
+    // running identification stops at the library's next cancel poll, a
+    // running probe capture ends with a "Capture cancelled" error, and a
+    // queued one is answered that way without scanning. Other requests and
+    // readers are left alone.
+    void requestCancel(quint64 requestId);
+
+    // Drops queued commands, closes the readers and joins the thread. Probe
+    // captures are cancelled; a library capture already waiting for a finger
+    // has to complete first.
+    void shutdown();
+
+signals:
+    void readerInitialized(bool ok, const QString& error);
+    void captureStarted(); // Device thread is about to wait for a finger
+    void enrollmentStarted(bool ok, const QString& error);
+    void enrollmentProgress(int current, int total, const QString& message);
+    // result: <0 error, 0 more samples needed, 1 complete (templateData filled)
+    void enrollmentSampleFinished(int result, const QString& message, const QByteArray& templateData, const QString& error);
+    void verifyFinished(bool matched, int score, const QString& error);
+    void identifyProgress(int current, int total);
+    void identifyFinished(int userId, int score, bool cancelled, quint64 requestId); // userId -1: no match
+    void probeCaptured(const QString& readerId, const QByteArray& probeTemplate, const QString& error,
+                       quint64 requestId); // FP1 print, empty on error
+
+protected:
+    void run() override;
+
+private:
+    struct Reader;
+
+    void post(std::function<void()> command);
+    bool openSelectedReaders(QString& error);
+    void closeSelectedReaders();
+    Reader* findReader(const QString& id) const;
+    void cancelAll(); // Shutdown: every live request
+    quint64 addRequest();
+    bool isCancelled(quint64 requestId) const;
+    bool finishRequest(quint64 requestId); // Returns whether it was cancelled
+    void startCapture(Reader* reader);
+    void waitForPending(); // Iterates the main context until async opens/closes finish
+
+    // libfprint completion callbacks, dispatched on the device thread
+    static void onReaderOpened(GObject* source, GAsyncResult* result, void* data);
+    static void onReaderClosed(GObject* source, GAsyncResult* result, void* data);
+    static void onProbeIdentified(GObject* source, GAsyncResult* result, void* data);
+
+    FingerprintManager* m_fpManager; // Device thread only
+    bool m_ownsContext;              // Device thread only, see run()
+    QStringList m_readerIds;
+    FpContext* m_fpContext;          // Device thread only, selected readers
+    QVector<Reader*> m_readers;      // Open selected readers; changed on the device thread under m_mutex
+    int m_pendingOps;                // Device thread only, async opens/closes in flight
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_condition;
+    QQueue<std::function<void()>> m_commands;
+    bool m_stopping;
+    QSet<quint64> m_liveRequests;      // Identify and probe captures not yet answered, under m_mutex
+    QSet<quint64> m_cancelledRequests; // Subset of m_liveRequests, under m_mutex
+
+    std::atomic<bool> m_readerOpen;
+    std::atomic<bool> m_busy;
+    std::atomic<quint64> m_nextRequestId;
+};
+
+#endif // DEVICE_WORKER_H
@@ -0,0 +1,226 @@
+#include "enrollment_preview.h"
+#include "trace.h"
+#include <QPainter>
+#include <QRadialGradient>
+#include <QtConcurrent>
+
+namespace {
+
+const int kDefaultTotal = 5; // Scans the library asks for per enrollment
+
+} // namespace
+
+EnrollmentPreview::EnrollmentPreview(QObject* parent)
+    : QObject(parent)
+    , m_pendingTotal(0)
+    , m_total(0)
+{
+    connect(&m_watcher, &QFutureWatcher<Frames>::finished, this, [this]() {
+        if (m_total != m_pendingTotal) {
+            install(m_watcher.result());
+        }
+    });
+    prepare(kDefaultTotal);
+}
+
+EnrollmentPreview::~EnrollmentPreview()
+{
+    m_watcher.waitForFinished();
+}
+
+void EnrollmentPreview::prepare(int total)
+{
+    if (total <= 0 || total == m_total || (m_watcher.isRunning() && total == m_pendingTotal)) {
+        return;
+    }
+    m_watcher.waitForFinished(); // At most one render in flight
+    m_pendingTotal = total;
+    m_watcher.setFuture(QtConcurrent::run(&EnrollmentPreview::render, total));
+}
+
+QPixmap EnrollmentPreview::readyFrame()
+{
+    ensureFrames(0);
+    return m_ready;
+}
+
+QPixmap EnrollmentPreview::emptyFrame()
+{
+    ensureFrames(0);
+    return m_empty;
+}
+
+QPixmap EnrollmentPreview::progressFrame(int current, int total)
+{
+    if (total <= 0) {
+        return emptyFrame();
+    }
+    ensureFrames(total);
+    return m_progress.value(qBound(0, current, total));
+}
+
+void EnrollmentPreview::ensureFrames(int total)
+{
+    if (total <= 0 ? m_total > 0 : m_total == total) {
+        return;
+    }
+
+    if (m_watcher.future().isValid() && (total <= 0 || total == m_pendingTotal)) {
+        m_watcher.waitForFinished();
+        if (m_total != m_pendingTotal) {
+            install(m_watcher.result());
+        }
+        return;
+    }
+
+    // A scan count nobody prepared for: paint it here, once
+    install(render(total <= 0 ? kDefaultTotal : total));
+}
+
+void EnrollmentPreview::install(const Frames& frames)
+{
+    TRACE_SCOPE("ui", "installPreviewFrames");
+    // QPixmap is GUI-thread only, so the conversion happens here
+    m_ready = QPixmap::fromImage(frames.ready);
+    m_empty = QPixmap::fromImage(frames.empty);
+    m_progress.clear();
+    m_progress.reserve(frames.progress.size());
+    for (const QImage& image : frames.progress) {
+        m_progress.append(QPixmap::fromImage(image));
+    }
+    m_total = frames.total;
+}
+
+EnrollmentPreview::Frames EnrollmentPreview::render(int total)
+{
+    TRACE_SCOPE("ui", "renderPreviewFrames");
+    Frames frames;
+    frames.total = total;
+    frames.ready = renderReady();
+    frames.empty = renderEmpty();
+    for (int current = 0; current <= total; ++current) {
+        frames.progress.append(renderProgress(current, total));
+    }
+    return frames;
+}
+
+QImage EnrollmentPreview::renderReady()
+{
+    QImage readyImage(Size, Size, QImage::Format_RGB888);
+    readyImage.fill(QColor(250, 250, 250));
+    QPainter painter(&readyImage);
+    painter.setRenderHint(QPainter::Antialiasing);
+
+    // Draw background
+    QRadialGradient gradient(90, 90, 80);
+    gradient.setColorAt(0, QColor(245, 245, 250));
+    gradient.setColorAt(1, QColor(230, 230, 240));
+    painter.fillRect(readyImage.rect(), gradient);
+
+    // Draw ready indicator
+    painter.setPen(QPen(QColor(150, 150, 150), 2));
+    painter.drawEllipse(QPoint(90, 90), 60, 60);
+    painter.drawEllipse(QPoint(90, 90), 40, 40);
+
+    painter.setPen(QColor(100, 100, 100));
+    painter.setFont(QFont("Arial", 12, QFont::Bold));
+    painter.drawText(readyImage.rect(), Qt::AlignCenter, "Ready\nto Scan");
+    return readyImage;
+}
+
+QImage EnrollmentPreview::renderEmpty()
+{
+    QImage emptyImage(Size, Size, QImage::Format_RGB888);
+    emptyImage.fill(QColor(250, 250, 250));
+    QPainter painter(&emptyImage);
+    painter.setRenderHint(QPainter::Antialiasing);
+
+    QRadialGradient gradient(90, 90, 80);
+    gradient.setColorAt(0, QColor(245, 245, 250));
+    gradient.setColorAt(1, QColor(230, 230, 240));
+    painter.fillRect(emptyImage.rect(), gradient);
+
+    painter.setPen(QColor(150, 150, 150));
+    painter.setFont(QFont("Arial", 11));
+    painter.drawText(emptyImage.rect(), Qt::AlignCenter, "No scan yet");
+    return emptyImage;
+}
+
+QImage EnrollmentPreview::renderProgress(int current, int total)
+{
+    QImage previewImage(Size, Size, QImage::Format_RGB888);
+    previewImage.fill(QColor(250, 250, 250));
+
+    QPainter painter(&previewImage);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+
+    int centerX = 90;
+    int centerY = 90;
+
+    // Draw background gradient for depth
+    QRadialGradient gradient(centerX, centerY, 80);
+    gradient.setColorAt(0, QColor(240, 245, 250));
+    gradient.setColorAt(1, QColor(220, 230, 240));
+    painter.fillRect(previewImage.rect(), gradient);
+
+    // Draw fingerprint ridges with varying opacity based on progress
+    for (int i = 0; i < current; ++i) {
+        int alpha = 150 + (i * 20);
+        if (alpha > 255) alpha = 255;
+
+        painter.setPen(QPen(QColor(60, 100, 180, alpha), 2.5));
+
+        // Draw multiple curved lines to simulate fingerprint ridges
+        for (int j = 0; j < 8; ++j) {
+            int radius = 15 + (i * 12) + (j * 3);
+            QRect ellipseRect(centerX - radius, centerY - radius, radius * 2, radius * 2);
+
+            // Draw partial arcs for more realistic fingerprint pattern
+            int startAngle = (j * 15 + i * 10) * 16; // Qt uses 1/16th of a degree
+            int spanAngle = (120 + j * 10) * 16;
+            painter.drawArc(ellipseRect, startAngle, spanAngle);
+        }
+    }
+
+    // Draw center point
+    if (current > 0) {
+        painter.setPen(Qt::NoPen);
+        painter.setBrush(QColor(33, 150, 243, 200));
+        painter.drawEllipse(QPoint(centerX, centerY), 5, 5);
+    }
+
+    // Draw scan indicator overlay
+    QColor overlayColor;
+    QString statusText;
+
+    if (current == 0) {
+        overlayColor = QColor(200, 200, 200, 230);
+        statusText = "Ready to Scan";
+    } else if (current < total) {
+        overlayColor = QColor(255, 152, 0, 200);
+        statusText = QString("Scan %1/%2").arg(current).arg(total);
+    } else {
+        overlayColor = QColor(76, 175, 80, 200);
+        statusText = "Complete!";
+    }
+
+    // Draw status badge
+    painter.setPen(Qt::NoPen);
+    painter.setBrush(overlayColor);
+    QRect badgeRect(10, 10, 160, 35);
+    painter.drawRoundedRect(badgeRect, 5, 5);
+
+    // Draw status text
+    painter.setPen(QColor(255, 255, 255));
+    painter.setFont(QFont("Arial", 11, QFont::Bold));
+    painter.drawText(badgeRect, Qt::AlignCenter, statusText);
+
+    // Draw progress indicator at bottom
+    painter.setPen(Qt::NoPen);
+    int progressWidth = (Size * current) / total;
+    QRect progressRect(0, 170, progressWidth, 10);
+    painter.setBrush(QColor(33, 150, 243, 220));
+    painter.drawRect(progressRect);
+    return previewImage;
+}
@@ -0,0 +1,56 @@
+#ifndef ENROLLMENT_PREVIEW_H
+#define ENROLLMENT_PREVIEW_H
+
+#include <QObject>
+#include <QFutureWatcher>
+#include <QImage>
+#include <QPixmap>
+#include <QVector>
+
+// Enrollment preview frames (ready, empty and one per scan count), painted
+// once on a pool thread and handed out as cached pixmaps, so a progress
+// callback during capture only swaps a pixmap.
+//
+// Note: these are simulated ridges; U.are.U gives no raw image via libfprint.
+class EnrollmentPreview : public QObject {
+    Q_OBJECT
+
+public:
+    enum { Size = 180 };
+
+    explicit EnrollmentPreview(QObject* parent = nullptr);
+    ~EnrollmentPreview() override;
+
+    // Starts painting the frames for a total scan count in the background
+    void prepare(int total);
+
+    QPixmap readyFrame();
+    QPixmap emptyFrame();
+    QPixmap progressFrame(int current, int total);
+
+private:
+    struct Frames {
+        int total = 0;
+        QImage ready;
+        QImage empty;
+        QVector<QImage> progress; // Index = scans done, 0..total
+    };
+
+    static Frames render(int total);
+    static QImage renderReady();
+    static QImage renderEmpty();
+    static QImage renderProgress(int current, int total);
+
+    void ensureFrames(int total); // total 0: any; blocks only if asked before prepare() finished
+    void install(const Frames& frames);
+
+    QFutureWatcher<Frames> m_watcher;
+    int m_pendingTotal;
+
+    int m_total; // 0 until the first frames are installed
+    QPixmap m_ready;
+    QPixmap m_empty;
+    QVector<QPixmap> m_progress;
+};
+
+#endif // ENROLLMENT_PREVIEW_H
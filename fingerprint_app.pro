@@ -1,4 +1,4 @@
-QT += core gui widgets sql concurrent
+QT += core gui widgets sql concurrent network
 
 CONFIG += c++17
 
@@ -77,17 +77,47 @@ unix:!macx {
 SOURCES += \
     main_app.cpp \
     mainwindow_app.cpp \
+    enrollment_preview.cpp \
+    startup_orchestrator.cpp \
+    verify_template_cache.cpp \
     database_manager.cpp \
     database_config_dialog.cpp \
     migration_manager.cpp \
-    identification_dialog.cpp
+    identification_dialog.cpp \
+    template_gallery.cpp \
+    fingerprint_template.cpp \
+    trace.cpp \
+    metrics.cpp \
+    metrics_server.cpp \
+    access_log.cpp \
+    match_engine.cpp \
+    device_worker.cpp \
+    gallery_cache.cpp \
+    user_archive.cpp \
+    capture_replay.cpp \
+    user_list_model.cpp
 
 HEADERS += \
     mainwindow_app.h \
+    enrollment_preview.h \
+    startup_orchestrator.h \
+    verify_template_cache.h \
     database_manager.h \
     database_config_dialog.h \
     migration_manager.h \
-    identification_dialog.h
+    identification_dialog.h \
+    template_gallery.h \
+    fingerprint_template.h \
+    trace.h \
+    metrics.h \
+    metrics_server.h \
+    access_log.h \
+    match_engine.h \
+    device_worker.h \
+    gallery_cache.h \
+    user_archive.h \
+    capture_replay.h \
+    user_list_model.h
 
 RESOURCES += migrations.qrc
 
@@ -0,0 +1,281 @@
+// Headless identification daemon: one resident gallery and matcher shared by
+// every local client through IdentificationServer's line-JSON socket, and by
+// every reader the daemon opens.
+
+#include "database_manager.h"
+#include "database_config_dialog.h"
+#include "template_gallery.h"
+#include "match_engine.h"
+#include "device_worker.h"
+#include "capture_replay.h"
+#include "identification_server.h"
+#include "access_log.h"
+#include "trace.h"
+#include "metrics_server.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThreadPool>
+#include <QDebug>
+#include <cstdio>
+#include <glib.h>
+
+#ifdef Q_OS_UNIX
+#include <QSocketNotifier>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// DigitalPersona Library
+#include <digitalpersona.h>
+
+namespace {
+
+// Reads a match_evaluation --library report; true when it shows the in-process
+// matcher at least as accurate as the library's, with threshold its cut-off
+bool readCalibration(const QString& path, int& threshold, QString& error)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        error = QString("Cannot read %1: %2").arg(path, file.errorString());
+        return false;
+    }
+    QJsonParseError parseError;
+    QJsonObject report = QJsonDocument::fromJson(file.readAll(), &parseError).object();
+    if (parseError.error != QJsonParseError::NoError) {
+        error = QString("%1: %2").arg(path, parseError.errorString());
+        return false;
+    }
+    QJsonObject comparison = report.value("comparison").toObject();
+    if (report.value("mode").toString() != "library" || !comparison.contains("threshold")) {
+        error = QString("%1 is not a match_evaluation --library report").arg(path);
+        return false;
+    }
+    if (!comparison.value("at_least_as_accurate").toBool()) {
+        error = QString("%1: the in-process matcher is less accurate than the library's on that corpus").arg(path);
+        return false;
+    }
+    threshold = comparison.value("threshold").toInt();
+    return true;
+}
+
+} // namespace
+
+#ifdef Q_OS_UNIX
+namespace {
+
+// Self-pipe: a signal handler may only make async-signal-safe calls, so it
+// writes the signal number and the event loop does the rest
+int g_signalFds[2] = { -1, -1 };
+
+void onTerminationSignal(int signalNumber)
+{
+    int savedErrno = errno;
+    char byte = char(signalNumber);
+    ssize_t written = ::write(g_signalFds[0], &byte, 1);
+    (void)written; // A full pipe already holds a pending quit
+    errno = savedErrno;
+}
+
+bool installTerminationHandlers(QObject* parent)
+{
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, g_signalFds) != 0) {
+        return false;
+    }
+    // The handler must never block on a full buffer
+    ::fcntl(g_signalFds[0], F_SETFL, ::fcntl(g_signalFds[0], F_GETFL) | O_NONBLOCK);
+
+    auto* notifier = new QSocketNotifier(g_signalFds[1], QSocketNotifier::Read, parent);
+    QObject::connect(notifier, &QSocketNotifier::activated, parent, [notifier]() {
+        notifier->setEnabled(false);
+        char byte;
+        if (::read(g_signalFds[1], &byte, 1) == 1) {
+            qInfo() << "Signal" << int(byte) << "received, shutting down";
+        }
+        QCoreApplication::quit();
+    });
+
+    struct sigaction action = {};
+    action.sa_handler = onTerminationSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    return sigaction(SIGINT, &action, nullptr) == 0 && sigaction(SIGTERM, &action, nullptr) == 0;
+}
+
+} // namespace
+#endif
+
+int main(int argc, char *argv[])
+{
+    g_log_set_always_fatal((GLogLevelFlags)G_LOG_LEVEL_ERROR);
+
+    // Same GLib arrangement as the GUI app, see DeviceWorker
+    qputenv("QT_NO_GLIB", "1");
+    bool replay = CaptureReplay::prepareEnvironment();
+
+    QCoreApplication app(argc, argv);
+    // Shares the database configuration saved by the GUI app
+    app.setOrganizationName("Arkana");
+    app.setOrganizationDomain("arkana.co.id");
+    app.setApplicationName("FingerprintApp");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Fingerprint identification daemon");
+    parser.addHelpOption();
+    parser.addOptions({
+        { "socket", "Local socket name or path.", "name", "fingerprint-identify" },
+        { "threshold", "Minimum identification threshold (0-100); clients may only ask for a higher one.", "score", "40" },
+        { "threads", "Matcher threads (0 = ideal).", "n", "0" },
+        { "batch-window", "Milliseconds a probe waits to share a gallery pass.", "ms", "2" },
+        { "max-batch", "Most probes scored in one gallery pass.", "n", "32" },
+        { "early-stop", "Score that ends a gallery pass early (0 = score the whole gallery).", "score", "0" },
+        { "prefilter", "Share of the gallery ranked by signature that is fully matched (1 = all).", "ratio", "1" },
+        { "prefilter-min", "Fewest candidates the pre-filter keeps.", "n", "500" },
+        { "metrics-port", "Serve Prometheus metrics on 127.0.0.1:<port> (0 = off).", "port", "0" },
+        { "no-reader", "Serve probe templates only, never open a reader." },
+        { "reader", "Open the reader with this id (see --list-readers); repeat for several.", "id" },
+        { "all-readers", "Open every attached reader." },
+        { "list-readers", "Print the attached readers and exit." },
+        { "calibration", "match_evaluation --library report showing the in-process matcher is at least as accurate "
+                         "as the library's; its threshold becomes the minimum.", "file" },
+        { "allow-uncalibrated", "Serve identify requests and reader captures without --calibration." }
+    });
+    parser.process(app);
+
+    if (parser.isSet("list-readers")) {
+        // Nothing owns the GLib context yet, enumeration can run right here
+        const QVector<ReaderInfo> readers = DeviceWorker::availableReaders();
+        for (const ReaderInfo& reader : readers) {
+            std::printf("%s\t%s (%s)\n", qPrintable(reader.id), qPrintable(reader.name), qPrintable(reader.driver));
+        }
+        return readers.isEmpty() ? 1 : 0;
+    }
+
+    qInfo() << "Fingerprint identification daemon, DigitalPersona Library v" << DigitalPersona::version();
+    Trace::configureFromEnvironment();
+    Trace::setThreadName("Main");
+
+    if (!DatabaseConfigDialog::hasConfig()) {
+        qCritical() << "No database configuration; run the GUI app once to configure it";
+        return 1;
+    }
+
+    DatabaseManager dbManager;
+    if (!dbManager.initialize(DatabaseConfigDialog::loadConfig())) {
+        qCritical() << "Database initialization failed:" << dbManager.getLastError();
+        return 1;
+    }
+
+    TemplateGallery gallery(&dbManager);
+    gallery.applyDatabaseDefaults();
+    if (!gallery.load()) {
+        qCritical() << "Gallery load failed:" << dbManager.getLastError();
+        return 1;
+    }
+
+    // The in-process matcher gates nothing until shown at least as accurate as the library's
+    int threshold = parser.value("threshold").toInt();
+    bool calibrated = parser.isSet("allow-uncalibrated");
+    if (parser.isSet("calibration")) {
+        int calibratedThreshold = 0;
+        QString error;
+        if (!readCalibration(parser.value("calibration"), calibratedThreshold, error)) {
+            qCritical().noquote() << error;
+            return 1;
+        }
+        threshold = qMax(threshold, calibratedThreshold);
+        calibrated = true;
+        qInfo() << "In-process matcher calibrated, threshold" << threshold;
+    } else if (calibrated) {
+        qWarning() << "--allow-uncalibrated: identify requests use a matcher not compared with the library's";
+    } else {
+        qWarning() << "No --calibration: identify requests and selected-reader captures are refused";
+    }
+
+    MatchEngine engine(parser.value("threads").toInt());
+    engine.setPrefilter(parser.value("prefilter").toDouble(), parser.value("prefilter-min").toInt());
+    engine.setEarlyStopScore(parser.value("early-stop").toInt());
+
+    DeviceWorker* device = nullptr;
+    CaptureReplay* replayer = nullptr;
+    if (!parser.isSet("no-reader")) {
+        // All readers share this process's gallery and matcher pool
+        QStringList readerIds = parser.values("reader");
+        if (parser.isSet("all-readers")) {
+            // Nothing owns the GLib context before the worker starts
+            for (const ReaderInfo& reader : DeviceWorker::availableReaders()) {
+                readerIds.append(reader.id);
+            }
+            if (readerIds.isEmpty()) {
+                qWarning() << "--all-readers: no reader is attached";
+            }
+        }
+        readerIds.removeDuplicates();
+
+        device = new DeviceWorker(&app);
+        device->setReaderIds(readerIds);
+        QObject::connect(device, &DeviceWorker::readerInitialized, [device](bool ok, const QString& error) {
+            if (ok) {
+                qInfo() << "Reader ready" << device->openReaderIds();
+                if (!error.isEmpty()) qWarning() << "Some readers did not open:" << error;
+            } else {
+                qWarning() << "Reader unavailable, capture requests will fail:" << error;
+            }
+        });
+        if (replay) {
+            replayer = new CaptureReplay(&app);
+            if (!replayer->configureFromEnvironment()) {
+                qWarning() << "Capture replay:" << replayer->getLastError();
+            }
+            QObject::connect(device, &DeviceWorker::captureStarted, replayer, &CaptureReplay::onCaptureStarted);
+            QObject::connect(device, &DeviceWorker::enrollmentProgress, replayer, &CaptureReplay::onEnrollmentProgress);
+        }
+        device->start();
+        device->initializeReader();
+    }
+
+    // Declared after dbManager, so its destructor commits the tail first.
+    // Captures on selected readers are recorded under their reader id.
+    AccessLog accessLog(&dbManager);
+    accessLog.start();
+
+    IdentificationServer server(&dbManager, &gallery, &engine, device);
+    server.setAccessLog(&accessLog);
+    server.setThreshold(threshold);
+    server.setMatcherCalibrated(calibrated);
+    server.setBatching(parser.value("batch-window").toInt(), parser.value("max-batch").toInt());
+    if (!server.listen(parser.value("socket"))) {
+        qCritical() << server.getLastError();
+        if (device) device->shutdown();
+        return 1;
+    }
+
+    MetricsServer metricsServer;
+    quint16 metricsPort = quint16(parser.value("metrics-port").toUInt());
+    if (metricsPort > 0 ? !metricsServer.listen(metricsPort) : !metricsServer.listenFromEnvironment()) {
+        qCritical() << metricsServer.getLastError();
+        if (device) device->shutdown();
+        return 1;
+    }
+
+#ifdef Q_OS_UNIX
+    // Leave the event loop so the reader is closed and the gallery cache flushed
+    if (!installTerminationHandlers(&app)) {
+        qWarning() << "Cannot install SIGINT/SIGTERM handlers:" << qt_error_string(errno);
+    }
+#endif
+
+    int rc = app.exec();
+
+    if (device) device->shutdown();
+    QThreadPool::globalInstance()->waitForDone(); // In-flight probe matches use engine
+    accessLog.stop();
+    gallery.flushCache();
+    Trace::writeAtExit();
+    return rc;
+}
@@ -0,0 +1,74 @@
+# Headless identification daemon (line-JSON over a local socket)
+#   qmake6 fingerprint_daemon.pro && make
+#   ./bin/fingerprint_daemon --socket fingerprint-identify
+
+QT += core widgets sql concurrent network
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = fingerprint_daemon
+TEMPLATE = app
+
+DESTDIR = bin
+
+# Link to digitalpersonalib (Binary)
+INCLUDEPATH += $$PWD/digitalpersonalib/include
+
+LIBS += -L$$PWD/digitalpersonalib/lib -ldigitalpersona
+QMAKE_RPATHDIR += $$PWD/digitalpersonalib/lib
+
+# Libfprint - macOS Only (see fingerprint_app.pro)
+macx {
+    INCLUDEPATH += $$PWD/libfprint_repo/libfprint \
+                   /opt/homebrew/include/glib-2.0 \
+                   /opt/homebrew/lib/glib-2.0/include
+    LIBS += -L$$PWD/libfprint_repo/builddir/libfprint -lfprint-2 \
+            -L/opt/homebrew/lib -lglib-2.0 -lgobject-2.0 -lgio-2.0
+    QMAKE_RPATHDIR += $$PWD/libfprint_repo/builddir/libfprint
+}
+
+unix:!macx {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += libfprint-2 glib-2.0
+
+    QMAKE_LFLAGS += -Wl,-rpath,\'\$$ORIGIN/../digitalpersonalib/lib\'
+    QMAKE_LFLAGS += -Wl,-rpath,\'\$$ORIGIN/lib\'
+}
+
+SOURCES += \
+    fingerprint_daemon.cpp \
+    identification_server.cpp \
+    database_manager.cpp \
+    database_config_dialog.cpp \
+    migration_manager.cpp \
+    template_gallery.cpp \
+    gallery_cache.cpp \
+    fingerprint_template.cpp \
+    trace.cpp \
+    metrics.cpp \
+    metrics_server.cpp \
+    access_log.cpp \
+    match_engine.cpp \
+    device_worker.cpp \
+    capture_replay.cpp \
+    user_archive.cpp
+
+HEADERS += \
+    identification_server.h \
+    database_manager.h \
+    database_config_dialog.h \
+    migration_manager.h \
+    template_gallery.h \
+    gallery_cache.h \
+    fingerprint_template.h \
+    trace.h \
+    metrics.h \
+    metrics_server.h \
+    access_log.h \
+    match_engine.h \
+    device_worker.h \
+    capture_replay.h \
+    user_archive.h
+
+RESOURCES += migrations.qrc
@@ -0,0 +1,511 @@
+#include "fingerprint_template.h"
+#include "trace.h"
+#include <QVarLengthArray>
+#include <QtAlgorithms>
+#include <QtMath>
+#include <glib.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// Alignment search space: small rotations only, the reader has a finger guide
+const int kMinMinutiae = 6;
+const int kRotationStep = 10;   // degrees per bin
+const int kRotationBins = 7;    // -30..+30 degrees
+const int kShiftStep = 16;      // pixels per bin
+const int kShiftBins = 32;      // -256..+255 pixels
+const int kPairDistanceSq = 12 * 12;
+const int kPairAngle = 20;
+
+// Signature features: 4 distance x 16 direction x 16 bearing bins = 1024 bits
+const int kSignatureNeighbours = 3;
+const int kSignatureMinDistanceSq = 8 * 8;
+const int kSignatureDistanceStep = 16; // pixels per bin, last bin open ended
+const int kSignatureAngleBins = 16;
+
+struct RotationTable {
+    float cosv[360];
+    float sinv[360];
+
+    RotationTable()
+    {
+        for (int d = 0; d < 360; ++d) {
+            cosv[d] = float(std::cos(qDegreesToRadians(double(d))));
+            sinv[d] = float(std::sin(qDegreesToRadians(double(d))));
+        }
+    }
+};
+
+const RotationTable& rotationTable()
+{
+    static const RotationTable table;
+    return table;
+}
+
+struct Point {
+    float x;
+    float y;
+    int theta;
+};
+
+int angleDistance(int a, int b)
+{
+    int d = std::abs(a - b) % 360;
+    return d > 180 ? 360 - d : d;
+}
+
+int signedAngle(int d)
+{
+    d %= 360;
+    if (d > 180) d -= 360;
+    if (d <= -180) d += 360;
+    return d;
+}
+
+int shiftBin(float delta)
+{
+    return int(std::floor(delta / kShiftStep)) + kShiftBins / 2;
+}
+
+// Hough accumulator reused by every matchPrints() call on a thread. A cell
+// counts only when stamped with the current call's generation, so a call
+// touches the few cells it votes in instead of clearing the whole table.
+struct VoteTable {
+    struct Cell {
+        quint32 generation;
+        int votes;
+    };
+
+    Cell cells[kRotationBins][kShiftBins][kShiftBins];
+    quint32 generation = 0;
+
+    VoteTable() { std::memset(cells, 0, sizeof(cells)); }
+
+    void reset()
+    {
+        if (++generation == 0) { // Wrapped: stale stamps could collide, clear once
+            std::memset(cells, 0, sizeof(cells));
+            generation = 1;
+        }
+    }
+
+    int vote(int r, int x, int y)
+    {
+        Cell& cell = cells[r][x][y];
+        if (cell.generation != generation) {
+            cell.generation = generation;
+            cell.votes = 0;
+        }
+        return ++cell.votes;
+    }
+};
+
+// Centre a minutiae set so rotation error does not grow with distance from the image origin
+void centre(const QVector<Minutia>& in, QVarLengthArray<Point, 128>& out)
+{
+    float cx = 0.0f, cy = 0.0f;
+    for (const Minutia& m : in) {
+        cx += m.x;
+        cy += m.y;
+    }
+    cx /= in.size();
+    cy /= in.size();
+
+    out.resize(in.size());
+    for (int i = 0; i < in.size(); ++i) {
+        out[i].x = in[i].x - cx;
+        out[i].y = in[i].y - cy;
+        out[i].theta = in[i].theta;
+    }
+}
+
+// NBIS xyt is cartesian (y up) with counter-clockwise theta, so a plain
+// rotation matrix moves positions and directions consistently.
+int matchPrints(const QVector<Minutia>& ma, const QVector<Minutia>& mb)
+{
+    if (ma.size() < kMinMinutiae || mb.size() < kMinMinutiae) {
+        return 0;
+    }
+
+    const RotationTable& rot = rotationTable();
+    const int maxRotation = kRotationStep * (kRotationBins / 2) + kRotationStep / 2;
+
+    QVarLengthArray<Point, 128> a;
+    QVarLengthArray<Point, 128> b;
+    centre(ma, a);
+    centre(mb, b);
+
+    // Hough vote for the dominant (rotation, dx, dy), each pair uses its own exact rotation
+    thread_local VoteTable votes;
+    votes.reset();
+
+    int bestVotes = 0;
+    int bestR = 0, bestX = 0, bestY = 0;
+    for (const Point& pa : a) {
+        for (const Point& pb : b) {
+            int angle = signedAngle(pb.theta - pa.theta);
+            if (std::abs(angle) >= maxRotation) continue;
+
+            int d = (angle + 360) % 360;
+            int r = qRound(angle / double(kRotationStep)) + kRotationBins / 2;
+            float rx = pa.x * rot.cosv[d] - pa.y * rot.sinv[d];
+            float ry = pa.x * rot.sinv[d] + pa.y * rot.cosv[d];
+            int bx = shiftBin(pb.x - rx);
+            int by = shiftBin(pb.y - ry);
+            if (bx < 0 || bx >= kShiftBins || by < 0 || by >= kShiftBins) continue;
+
+            int v = votes.vote(r, bx, by);
+            if (v > bestVotes) {
+                bestVotes = v;
+                bestR = r;
+                bestX = bx;
+                bestY = by;
+            }
+        }
+    }
+
+    if (bestVotes < 3) {
+        return 0;
+    }
+
+    // Refine with the mean rotation/shift of the pairs supporting the winning cell
+    double sumAngle = 0.0, sumX = 0.0, sumY = 0.0;
+    int support = 0;
+    for (const Point& pa : a) {
+        for (const Point& pb : b) {
+            int angle = signedAngle(pb.theta - pa.theta);
+            if (std::abs(angle) >= maxRotation) continue;
+            if (std::abs(qRound(angle / double(kRotationStep)) + kRotationBins / 2 - bestR) > 1) continue;
+
+            int d = (angle + 360) % 360;
+            float dx = pb.x - (pa.x * rot.cosv[d] - pa.y * rot.sinv[d]);
+            float dy = pb.y - (pa.x * rot.sinv[d] + pa.y * rot.cosv[d]);
+            if (std::abs(shiftBin(dx) - bestX) > 1 || std::abs(shiftBin(dy) - bestY) > 1) continue;
+
+            sumAngle += angle;
+            sumX += dx;
+            sumY += dy;
+            ++support;
+        }
+    }
+
+    int rotation = qRound(sumAngle / support);
+    int d = (rotation + 360) % 360;
+    float c = rot.cosv[d];
+    float s = rot.sinv[d];
+    float tx = float(sumX / support);
+    float ty = float(sumY / support);
+
+    // Greedy nearest pairing under the refined transform
+    QVarLengthArray<bool, 128> used(b.size());
+    std::fill(used.begin(), used.end(), false);
+
+    int paired = 0;
+    for (const Point& pa : a) {
+        float x = pa.x * c - pa.y * s + tx;
+        float y = pa.x * s + pa.y * c + ty;
+        int theta = pa.theta + rotation;
+
+        int bestIndex = -1;
+        float bestDist = kPairDistanceSq + 1;
+        for (int j = 0; j < b.size(); ++j) {
+            if (used[j]) continue;
+            float dx = b[j].x - x;
+            float dy = b[j].y - y;
+            float d2 = dx * dx + dy * dy;
+            if (d2 < bestDist && angleDistance(theta, b[j].theta) <= kPairAngle) {
+                bestDist = d2;
+                bestIndex = j;
+            }
+        }
+
+        if (bestIndex >= 0) {
+            used[bestIndex] = true;
+            ++paired;
+        }
+    }
+
+    return qMin(100, (100 * paired * paired) / (a.size() * b.size()));
+}
+
+} // namespace
+
+bool TemplateSignature::isNull() const
+{
+    for (quint64 word : bits) {
+        if (word) return false;
+    }
+    return true;
+}
+
+int TemplateSignature::bitCount() const
+{
+    int count = 0;
+    for (quint64 word : bits) {
+        count += qPopulationCount(word);
+    }
+    return count;
+}
+
+QByteArray TemplateSignature::toBytes() const
+{
+    return QByteArray(reinterpret_cast<const char*>(bits), Bytes);
+}
+
+TemplateSignature TemplateSignature::fromBytes(const QByteArray& data)
+{
+    TemplateSignature result;
+    if (data.size() == Bytes) {
+        std::memcpy(result.bits, data.constData(), Bytes);
+    }
+    return result;
+}
+
+int TemplateSignature::similarity(const TemplateSignature& a, const TemplateSignature& b)
+{
+    int common = 0, countA = 0, countB = 0;
+    for (int i = 0; i < Words; ++i) {
+        common += qPopulationCount(a.bits[i] & b.bits[i]);
+        countA += qPopulationCount(a.bits[i]);
+        countB += qPopulationCount(b.bits[i]);
+    }
+    if (countA == 0 || countB == 0) return 0;
+    return int(100.0 * common / std::sqrt(double(countA) * countB));
+}
+
+FingerprintTemplate FingerprintTemplate::fromSerialized(const QByteArray& data)
+{
+    TRACE_SCOPE("template", "deserialize");
+    FingerprintTemplate result;
+
+    // Same envelope as fp_print_serialize(): "FP1" magic followed by a GVariant
+    if (data.size() <= 3 || !data.startsWith("FP1")) {
+        return result;
+    }
+
+    // g_bytes_new copies into suitably aligned memory for GVariant
+    GBytes* bytes = g_bytes_new(data.constData() + 3, data.size() - 3);
+    GVariant* raw = g_variant_new_from_bytes(G_VARIANT_TYPE("(issbymsmsia{sv}v)"), bytes, FALSE);
+    g_bytes_unref(bytes);
+    g_variant_ref_sink(raw);
+
+    GVariant* value = (G_BYTE_ORDER == G_BIG_ENDIAN) ? g_variant_byteswap(raw) : g_variant_get_normal_form(raw);
+    g_variant_unref(raw);
+
+    GVariant* boxed = g_variant_get_child_value(value, 9);
+    GVariant* wrapped = g_variant_get_variant(boxed);
+
+    // Only NBIS (image device) prints carry minutiae, as (a(aiaiai)): the
+    // array is child 0, as in fp_print_deserialize(). Others stay invalid.
+    GVariant* printData = g_variant_is_of_type(wrapped, G_VARIANT_TYPE("(a(aiaiai))"))
+        ? g_variant_get_child_value(wrapped, 0) : nullptr;
+    if (printData) {
+        gsize count = g_variant_n_children(printData);
+        result.m_prints.reserve(int(count));
+
+        for (gsize i = 0; i < count; ++i) {
+            GVariant* xs = nullptr;
+            GVariant* ys = nullptr;
+            GVariant* ts = nullptr;
+            g_variant_get_child(printData, i, "(@ai@ai@ai)", &xs, &ys, &ts);
+
+            gsize nx = 0, ny = 0, nt = 0;
+            const gint32* px = static_cast<const gint32*>(g_variant_get_fixed_array(xs, &nx, sizeof(gint32)));
+            const gint32* py = static_cast<const gint32*>(g_variant_get_fixed_array(ys, &ny, sizeof(gint32)));
+            const gint32* pt = static_cast<const gint32*>(g_variant_get_fixed_array(ts, &nt, sizeof(gint32)));
+
+            gsize n = qMin(nx, qMin(ny, nt));
+            QVector<Minutia> minutiae;
+            minutiae.reserve(int(n));
+            for (gsize m = 0; m < n; ++m) {
+                Minutia minutia = { px[m], py[m], ((pt[m] % 360) + 360) % 360 };
+                minutiae.append(minutia);
+            }
+            if (!minutiae.isEmpty()) {
+                result.m_prints.append(minutiae);
+            }
+
+            g_variant_unref(xs);
+            g_variant_unref(ys);
+            g_variant_unref(ts);
+        }
+    }
+
+    if (printData) g_variant_unref(printData);
+    g_variant_unref(wrapped);
+    g_variant_unref(boxed);
+    g_variant_unref(value);
+
+    return result;
+}
+
+FingerprintTemplate FingerprintTemplate::fromPrints(const QVector<QVector<Minutia>>& prints)
+{
+    FingerprintTemplate result;
+    for (const QVector<Minutia>& print : prints) {
+        if (!print.isEmpty()) {
+            result.m_prints.append(print);
+        }
+    }
+    return result;
+}
+
+QByteArray FingerprintTemplate::toSerialized() const
+{
+    GVariantBuilder printsBuilder;
+    g_variant_builder_init(&printsBuilder, G_VARIANT_TYPE("a(aiaiai)"));
+    for (const QVector<Minutia>& print : m_prints) {
+        QVector<gint32> xs, ys, ts;
+        for (const Minutia& m : print) {
+            xs.append(m.x);
+            ys.append(m.y);
+            ts.append(m.theta);
+        }
+        g_variant_builder_add(&printsBuilder, "(@ai@ai@ai)",
+                              g_variant_new_fixed_array(G_VARIANT_TYPE_INT32, xs.constData(), xs.size(), sizeof(gint32)),
+                              g_variant_new_fixed_array(G_VARIANT_TYPE_INT32, ys.constData(), ys.size(), sizeof(gint32)),
+                              g_variant_new_fixed_array(G_VARIANT_TYPE_INT32, ts.constData(), ts.size(), sizeof(gint32)));
+    }
+    // fp_print_serialize() boxes the array in a one-element tuple
+    GVariant* printData = g_variant_new("(@a(aiaiai))", g_variant_builder_end(&printsBuilder));
+
+    GVariantBuilder extra;
+    g_variant_builder_init(&extra, G_VARIANT_TYPE_VARDICT);
+
+    // type 2 = FPI_PRINT_NBIS, finger 0 = unknown, G_MININT32 = no enroll date
+    GVariant* root = g_variant_new("(issbymsmsi@a{sv}v)", 2, "synthetic", "", FALSE, guchar(0),
+                                   nullptr, nullptr, G_MININT32, g_variant_builder_end(&extra), printData);
+    g_variant_ref_sink(root);
+    if (G_BYTE_ORDER == G_BIG_ENDIAN) {
+        GVariant* swapped = g_variant_byteswap(root);
+        g_variant_unref(root);
+        root = swapped;
+    }
+
+    QByteArray out("FP1");
+    out.resize(3 + int(g_variant_get_size(root)));
+    g_variant_store(root, out.data() + 3);
+    g_variant_unref(root);
+    return out;
+}
+
+QByteArray FingerprintTemplate::pack() const
+{
+    // quint16 printCount, then per print: quint16 n, n x (qint16 x, y, theta)
+    QByteArray out;
+    out.reserve(2 + m_prints.size() * 2 + minutiaeCount() * 6);
+
+    auto put16 = [&out](qint16 v) { out.append(reinterpret_cast<const char*>(&v), sizeof(v)); };
+    put16(qint16(m_prints.size()));
+    for (const QVector<Minutia>& print : m_prints) {
+        put16(qint16(print.size()));
+        for (const Minutia& m : print) {
+            put16(qint16(m.x));
+            put16(qint16(m.y));
+            put16(qint16(m.theta));
+        }
+    }
+    return out;
+}
+
+FingerprintTemplate FingerprintTemplate::unpack(const char* data, int size)
+{
+    FingerprintTemplate result;
+    int pos = 0;
+    auto get16 = [&](qint16& v) -> bool {
+        if (pos + int(sizeof(v)) > size) return false;
+        std::memcpy(&v, data + pos, sizeof(v));
+        pos += sizeof(v);
+        return true;
+    };
+
+    qint16 printCount = 0;
+    if (!get16(printCount)) return result;
+    result.m_prints.reserve(printCount);
+
+    for (int p = 0; p < printCount; ++p) {
+        qint16 n = 0;
+        if (!get16(n)) return FingerprintTemplate();
+        QVector<Minutia> minutiae;
+        minutiae.reserve(n);
+        for (int i = 0; i < n; ++i) {
+            qint16 x, y, theta;
+            if (!get16(x) || !get16(y) || !get16(theta)) return FingerprintTemplate();
+            Minutia minutia = { x, y, theta };
+            minutiae.append(minutia);
+        }
+        result.m_prints.append(minutiae);
+    }
+    return result;
+}
+
+int FingerprintTemplate::minutiaeCount() const
+{
+    int count = 0;
+    for (const QVector<Minutia>& print : m_prints) {
+        count += print.size();
+    }
+    return count;
+}
+
+TemplateSignature FingerprintTemplate::signature() const
+{
+    TRACE_SCOPE("template", "signature");
+    TemplateSignature result;
+    const int angleStep = 360 / kSignatureAngleBins;
+
+    for (const QVector<Minutia>& print : m_prints) {
+        if (print.size() < kMinMinutiae) continue;
+
+        for (int i = 0; i < print.size(); ++i) {
+            const Minutia& a = print[i];
+
+            // k nearest neighbours by insertion into a tiny sorted list
+            int nearest[kSignatureNeighbours];
+            int nearestDist[kSignatureNeighbours];
+            int found = 0;
+            for (int j = 0; j < print.size(); ++j) {
+                int dx = print[j].x - a.x;
+                int dy = print[j].y - a.y;
+                int d2 = dx * dx + dy * dy;
+                if (j == i || d2 < kSignatureMinDistanceSq) continue;
+                if (found == kSignatureNeighbours && d2 >= nearestDist[found - 1]) continue;
+
+                int pos = found < kSignatureNeighbours ? found++ : found - 1;
+                while (pos > 0 && nearestDist[pos - 1] > d2) {
+                    nearest[pos] = nearest[pos - 1];
+                    nearestDist[pos] = nearestDist[pos - 1];
+                    --pos;
+                }
+                nearest[pos] = j;
+                nearestDist[pos] = d2;
+            }
+
+            for (int n = 0; n < found; ++n) {
+                const Minutia& b = print[nearest[n]];
+                int distance = qMin(3, int(std::sqrt(double(nearestDist[n]))) / kSignatureDistanceStep);
+                int direction = ((b.theta - a.theta) % 360 + 360) % 360 / angleStep;
+                int heading = qRound(qRadiansToDegrees(std::atan2(double(b.y - a.y), double(b.x - a.x))));
+                int bearing = ((heading - a.theta) % 360 + 360) % 360 / angleStep;
+
+                int bit = (distance * kSignatureAngleBins + direction) * kSignatureAngleBins + bearing;
+                result.bits[bit / 64] |= quint64(1) << (bit % 64);
+            }
+        }
+    }
+    return result;
+}
+
+int FingerprintTemplate::match(const FingerprintTemplate& probe, const FingerprintTemplate& candidate)
+{
+    int best = 0;
+    for (const QVector<Minutia>& a : probe.m_prints) {
+        for (const QVector<Minutia>& b : candidate.m_prints) {
+            best = qMax(best, matchPrints(a, b));
+            if (best >= 100) return best;
+        }
+    }
+    return best;
+}
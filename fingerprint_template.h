@@ -0,0 +1,63 @@
+#ifndef FINGERPRINT_TEMPLATE_H
+#define FINGERPRINT_TEMPLATE_H
+
+#include <QByteArray>
+#include <QVector>
+
+struct Minutia {
+    int x;
+    int y;
+    int theta; // Degrees, 0-359
+};
+
+// Coarse rotation and translation invariant summary of a template: one bit
+// per quantized (distance, relative direction, relative bearing) feature of
+// each minutia and its nearest neighbours. Comparing two signatures costs a
+// few popcounts, cheap enough to rank a whole gallery before match().
+struct TemplateSignature {
+    enum { Words = 16, Bytes = Words * 8 };
+
+    quint64 bits[Words] = {};
+
+    bool isNull() const;
+    int bitCount() const;
+
+    QByteArray toBytes() const;
+    static TemplateSignature fromBytes(const QByteArray& data); // Null on size mismatch
+
+    // Overlap 0-100, normalized by both bit counts
+    static int similarity(const TemplateSignature& a, const TemplateSignature& b);
+};
+
+// Decoded form of a serialized libfprint print ("FP1" + GVariant).
+// Image-based readers (U.are.U 4500) store one NBIS minutiae set per
+// enrollment stage; decoding once lets the app score templates against
+// each other without going back through the device.
+class FingerprintTemplate {
+public:
+    FingerprintTemplate() = default;
+
+    static FingerprintTemplate fromSerialized(const QByteArray& data);
+    static FingerprintTemplate fromPrints(const QVector<QVector<Minutia>>& prints);
+
+    // NBIS print in fp_print_serialize()'s layout, for synthetic galleries and tests
+    QByteArray toSerialized() const;
+
+    bool isValid() const { return !m_prints.isEmpty(); }
+    const QVector<QVector<Minutia>>& prints() const { return m_prints; }
+    int minutiaeCount() const;
+
+    TemplateSignature signature() const; // Union over all stored prints
+
+    // Compact native-endian minutiae block for on-disk caches
+    QByteArray pack() const;
+    static FingerprintTemplate unpack(const char* data, int size);
+
+    // Similarity 0-100, best over all stored print pairs
+    static int match(const FingerprintTemplate& probe, const FingerprintTemplate& candidate);
+
+private:
+    QVector<QVector<Minutia>> m_prints;
+};
+
+#endif // FINGERPRINT_TEMPLATE_H
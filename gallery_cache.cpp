@@ -0,0 +1,229 @@
+#include "gallery_cache.h"
+#include <QSaveFile>
+#include <QDebug>
+#include <cstring>
+
+namespace {
+
+const char kMagic[8] = { 'F', 'P', 'G', 'A', 'L', 'L', 'R', 'Y' };
+const quint32 kVersion = 3; // 2: signatures, 3: change_seq watermark
+const quint32 kByteOrderMark = 0x01020304;
+
+struct CacheHeader {
+    char magic[8];
+    quint32 version;
+    quint32 byteOrder;
+    quint32 count;
+    qint32 templateCount;   // Watermark
+    qint32 maxUserId;       // Watermark
+    quint32 reserved;
+    qint64 lastChangeSeq;   // Watermark
+    quint64 indexOffset;
+    quint64 dataEnd;
+};
+
+struct CacheIndexEntry {
+    qint32 userId;
+    quint32 templateSize;
+    quint64 offset;     // From file start
+    quint32 packedSize; // Minutiae block directly after the template
+    quint32 signatureSize; // Signature directly after the minutiae, 0 or TemplateSignature::Bytes
+};
+
+} // namespace
+
+GalleryCache::GalleryCache()
+    : m_data(nullptr)
+    , m_size(0)
+{
+}
+
+GalleryCache::~GalleryCache()
+{
+    close();
+}
+
+bool GalleryCache::open(const QString& path)
+{
+    close();
+
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        m_lastError = QString("Failed to open gallery cache: %1").arg(m_file.errorString());
+        return false;
+    }
+
+    m_size = m_file.size();
+    if (m_size < qint64(sizeof(CacheHeader))) {
+        m_lastError = "Gallery cache is truncated";
+        close();
+        return false;
+    }
+
+    m_data = m_file.map(0, m_size);
+    if (!m_data) {
+        m_lastError = QString("Failed to map gallery cache: %1").arg(m_file.errorString());
+        close();
+        return false;
+    }
+
+    CacheHeader header;
+    std::memcpy(&header, m_data, sizeof(header));
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion
+        || header.byteOrder != kByteOrderMark) {
+        m_lastError = "Gallery cache has an unknown format";
+        close();
+        return false;
+    }
+
+    quint64 indexEnd = header.indexOffset + quint64(header.count) * sizeof(CacheIndexEntry);
+    if (header.indexOffset < sizeof(CacheHeader) || indexEnd > quint64(m_size) || header.dataEnd > quint64(m_size)) {
+        m_lastError = "Gallery cache is truncated";
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void GalleryCache::close()
+{
+    if (m_data) {
+        m_file.unmap(const_cast<uchar*>(m_data));
+        m_data = nullptr;
+    }
+    m_size = 0;
+    if (m_file.isOpen()) {
+        m_file.close();
+    }
+}
+
+int GalleryCache::count() const
+{
+    if (!m_data) return 0;
+    CacheHeader header;
+    std::memcpy(&header, m_data, sizeof(header));
+    return int(header.count);
+}
+
+GalleryWatermark GalleryCache::watermark() const
+{
+    GalleryWatermark watermark;
+    if (!m_data) return watermark;
+
+    CacheHeader header;
+    std::memcpy(&header, m_data, sizeof(header));
+    watermark.templateCount = header.templateCount;
+    watermark.maxUserId = header.maxUserId;
+    watermark.lastChangeSeq = header.lastChangeSeq;
+    return watermark;
+}
+
+bool GalleryCache::read(QMap<int, QByteArray>& templates, QMap<int, FingerprintTemplate>& decoded,
+                        QMap<int, TemplateSignature>& signatures) const
+{
+    templates.clear();
+    decoded.clear();
+    signatures.clear();
+    if (!m_data) return false;
+
+    CacheHeader header;
+    std::memcpy(&header, m_data, sizeof(header));
+
+    const uchar* index = m_data + header.indexOffset;
+    for (quint32 i = 0; i < header.count; ++i) {
+        CacheIndexEntry entry;
+        std::memcpy(&entry, index + i * sizeof(CacheIndexEntry), sizeof(entry));
+        if (entry.offset + entry.templateSize + entry.packedSize + entry.signatureSize > quint64(m_size)) {
+            templates.clear();
+            decoded.clear();
+            signatures.clear();
+            return false;
+        }
+
+        const char* payload = reinterpret_cast<const char*>(m_data + entry.offset);
+        // Keys arrive sorted, so QMap inserts stay cheap
+        templates.insert(templates.constEnd(), entry.userId, QByteArray::fromRawData(payload, int(entry.templateSize)));
+        if (entry.packedSize > 0) {
+            FingerprintTemplate fp = FingerprintTemplate::unpack(payload + entry.templateSize, int(entry.packedSize));
+            if (fp.isValid()) {
+                decoded.insert(decoded.constEnd(), entry.userId, fp);
+            }
+        }
+        if (entry.signatureSize == TemplateSignature::Bytes) {
+            const char* bits = payload + entry.templateSize + entry.packedSize;
+            signatures.insert(signatures.constEnd(), entry.userId,
+                              TemplateSignature::fromBytes(QByteArray::fromRawData(bits, TemplateSignature::Bytes)));
+        }
+    }
+    return true;
+}
+
+bool GalleryCache::write(const QString& path, const GalleryWatermark& watermark,
+                         const QMap<int, QByteArray>& templates,
+                         const QMap<int, FingerprintTemplate>& decoded,
+                         const QMap<int, TemplateSignature>& signatures,
+                         QString* error)
+{
+    CacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.byteOrder = kByteOrderMark;
+    header.count = quint32(templates.size());
+    header.templateCount = watermark.templateCount;
+    header.maxUserId = watermark.maxUserId;
+    header.lastChangeSeq = watermark.lastChangeSeq;
+    header.indexOffset = sizeof(CacheHeader);
+
+    // Packed minutiae are computed up front so the index can be written first
+    QVector<QByteArray> packed;
+    packed.reserve(templates.size());
+    QVector<QByteArray> signatureBytes;
+    signatureBytes.reserve(templates.size());
+    QVector<CacheIndexEntry> index;
+    index.reserve(templates.size());
+
+    quint64 offset = header.indexOffset + quint64(templates.size()) * sizeof(CacheIndexEntry);
+    for (auto it = templates.constBegin(); it != templates.constEnd(); ++it) {
+        auto fp = decoded.constFind(it.key());
+        packed.append(fp != decoded.constEnd() ? fp.value().pack() : QByteArray());
+        auto sig = signatures.constFind(it.key());
+        signatureBytes.append(sig != signatures.constEnd() ? sig.value().toBytes() : QByteArray());
+
+        CacheIndexEntry entry;
+        std::memset(&entry, 0, sizeof(entry));
+        entry.userId = it.key();
+        entry.templateSize = quint32(it.value().size());
+        entry.offset = offset;
+        entry.packedSize = quint32(packed.last().size());
+        entry.signatureSize = quint32(signatureBytes.last().size());
+        index.append(entry);
+
+        offset += entry.templateSize + entry.packedSize + entry.signatureSize;
+    }
+    header.dataEnd = offset;
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        if (error) *error = QString("Failed to write gallery cache: %1").arg(file.errorString());
+        return false;
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(index.constData()), qint64(index.size()) * sizeof(CacheIndexEntry));
+    int i = 0;
+    for (auto it = templates.constBegin(); it != templates.constEnd(); ++it, ++i) {
+        file.write(it.value());
+        file.write(packed[i]);
+        file.write(signatureBytes[i]);
+    }
+
+    if (!file.commit()) {
+        if (error) *error = QString("Failed to write gallery cache: %1").arg(file.errorString());
+        return false;
+    }
+
+    qDebug() << "Gallery cache written:" << templates.size() << "templates," << offset << "bytes to" << path;
+    return true;
+}
@@ -0,0 +1,54 @@
+#ifndef GALLERY_CACHE_H
+#define GALLERY_CACHE_H
+
+#include <QFile>
+#include <QMap>
+#include <QByteArray>
+#include <QString>
+
+#include "database_manager.h"
+#include "fingerprint_template.h"
+
+// Memory-mapped gallery file kept next to the SQLite database.
+//
+// Layout (native endian, written and read on the same machine):
+//   header   magic, version, entry count, database watermark
+//   index    one record per user, sorted by user id
+//   payload  serialized template, its packed minutiae block, its signature
+//
+// Templates handed out by read() are zero-copy views into the mapping and
+// stay valid until close() or destruction.
+class GalleryCache {
+public:
+    GalleryCache();
+    ~GalleryCache();
+
+    bool open(const QString& path);
+    void close();
+    bool isOpen() const { return m_data != nullptr; }
+
+    int count() const;
+    GalleryWatermark watermark() const;
+
+    bool read(QMap<int, QByteArray>& templates, QMap<int, FingerprintTemplate>& decoded,
+              QMap<int, TemplateSignature>& signatures) const;
+
+    // Atomically replaces the file at path (temp file + rename)
+    static bool write(const QString& path, const GalleryWatermark& watermark,
+                      const QMap<int, QByteArray>& templates,
+                      const QMap<int, FingerprintTemplate>& decoded,
+                      const QMap<int, TemplateSignature>& signatures,
+                      QString* error = nullptr);
+
+    QString getLastError() const { return m_lastError; }
+
+private:
+    QFile m_file;
+    const uchar* m_data;
+    qint64 m_size;
+    QString m_lastError;
+
+    Q_DISABLE_COPY(GalleryCache)
+};
+
+#endif // GALLERY_CACHE_H
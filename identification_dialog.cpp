@@ -1,27 +1,46 @@
 #include "identification_dialog.h"
+#include "metrics.h"
+#include "access_log.h"
 #include <QApplication>
 #include <QMessageBox>
 #include <QDebug>
-#include <QtConcurrent>
-#include <QFutureWatcher>
 #include <QPainter>
 #include <QRadialGradient>
 
-IdentificationDialog::IdentificationDialog(FingerprintManager* fpManager, DatabaseManager* dbManager, QWidget *parent)
+namespace {
+
+// result: match, no_match, cancelled or error
+void recordIdentification(const char* result)
+{
+    Metrics::counter("fp_identifications_total", "Identification attempts from the dialog by outcome.",
+                     QString("result=\"%1\"").arg(result))->increment();
+}
+
+} // namespace
+
+IdentificationDialog::IdentificationDialog(DeviceWorker* device, DatabaseManager* dbManager, TemplateGallery* gallery,
+                                           AccessLog* accessLog, QWidget *parent)
     : QDialog(parent)
-    , m_fpManager(fpManager)
+    , m_device(device)
     , m_dbManager(dbManager)
+    , m_gallery(gallery)
+    , m_accessLog(accessLog)
     , m_isScanning(false)
-    , m_cancelRequested(false)
+    , m_requestId(0)
 {
     setupUI();
+    
+    connect(m_device, &DeviceWorker::identifyProgress, this, &IdentificationDialog::onIdentifyProgress);
+    connect(m_device, &DeviceWorker::identifyFinished, this, &IdentificationDialog::onIdentifyFinished);
     setWindowTitle("Identify User");
     setFixedSize(500, 500);
 }
 
 IdentificationDialog::~IdentificationDialog()
 {
-    m_cancelRequested = true; // Ensure background threads stop
+    if (m_isScanning) {
+        m_device->requestCancel(m_requestId); // Ensure the device thread stops matching
+    }
 }
 
 void IdentificationDialog::showEvent(QShowEvent *event)
@@ -34,9 +53,8 @@ void IdentificationDialog::showEvent(QShowEvent *event)
 void IdentificationDialog::closeEvent(QCloseEvent *event)
 {
     if (m_isScanning) {
-        // Ideally cancel the scan, but libfprint sync calls are hard to cancel without thread termination
-        // For now we just let the dialog close, but the background thread might still be running.
-        // In a production app, we'd handle cancellation better.
+        // The capture itself cannot be interrupted, but matching stops at the next cancel poll
+        m_device->requestCancel(m_requestId);
     }
     QDialog::closeEvent(event);
 }
@@ -187,7 +205,7 @@ void IdentificationDialog::clearUserInfo()
 
 void IdentificationDialog::onCancelClicked()
 {
-    m_cancelRequested = true;
+    m_device->requestCancel(m_requestId);
     m_btnCancel->setEnabled(false);
     m_btnCancel->setText("Stopping...");
 }
@@ -203,87 +221,82 @@ void IdentificationDialog::onScanClicked()
     m_btnCancel->setVisible(true);
     m_btnCancel->setEnabled(true);
     m_btnCancel->setText("Cancel");
-    m_cancelRequested = false;
 
     clearUserInfo();
+    m_scanTimer.start();
     updateStatus("Preparing...", "#2196F3");
     m_instructionLabel->setText("Loading user templates...");
     
     m_progressBar->setVisible(true);
     m_progressBar->setValue(0);
 
-    // Fetch all templates from DB
-    QVector<User> users = m_dbManager->getAllUsers();
-    if (users.isEmpty()) {
-        updateStatus("No Users", "red");
-        m_instructionLabel->setText("No users found in database to match against.");
-        m_btnScan->setEnabled(true);
-        m_btnScan->setVisible(true);
-        m_btnCancel->setVisible(false);
-        m_btnClose->setEnabled(true);
-        m_progressBar->setVisible(false);
+    // Templates come from the resident gallery; only the first scan pays for a DB load
+    if (!m_gallery->isLoaded() && !m_gallery->load()) {
+        updateStatus("Database Error", "red");
+        m_instructionLabel->setText(QString("Failed to load templates: %1").arg(m_dbManager->getLastError()));
+        recordIdentification("error");
+        if (m_accessLog) m_accessLog->record("identify", "error", -1, 0, m_scanTimer.nsecsElapsed());
+        resetControls();
         return;
     }
 
-    QMap<int, QByteArray> templates;
-    for (const User& u : users) {
-        if (!u.fingerprintTemplate.isEmpty()) {
-            templates.insert(u.id, u.fingerprintTemplate);
-        }
-    }
+    QMap<int, QByteArray> templates = m_gallery->templates();
 
     if (templates.isEmpty()) {
         updateStatus("No Templates", "red");
-        m_instructionLabel->setText("Users found but no fingerprint data available.");
-        m_btnScan->setEnabled(true);
-        m_btnScan->setVisible(true);
-        m_btnCancel->setVisible(false);
-        m_btnClose->setEnabled(true);
-        m_progressBar->setVisible(false);
+        m_instructionLabel->setText("No enrolled fingerprints found to match against.");
+        resetControls();
         return;
     }
 
-    // Run identification
+    // Run identification on the device thread, results come back as signals
     m_isScanning = true;
-    m_progressBar->setVisible(true); // Force visible immediately
+    m_progressBar->setVisible(true);
     m_progressBar->setValue(0);
     updateStatus("Scanning...", "#2196F3");
     m_instructionLabel->setText("Place your finger on the reader now...");
 
-    // Force UI update before heavy task
-    QApplication::processEvents();
-
-    auto progressCb = [this](int current, int total) {
-        QMetaObject::invokeMethod(this, [this, current, total]() {
-            m_progressBar->setVisible(true); // Ensure visible
-            m_progressBar->setMaximum(total);
-            m_progressBar->setValue(current);
-            if (current < total) {
-                m_statusLabel->setText(QString("Loading Gallery: %1/%2").arg(current).arg(total));
-            } else {
-                m_statusLabel->setText("Identifying...");
-            }
-        }, Qt::QueuedConnection);
-    };
-
-    auto cancelCb = [this]() -> bool {
-        return m_cancelRequested.load();
-    };
-    
-    // Linux: Run synchronously on main thread to avoid threading issues with libfprint
-    // macOS: Run in background thread to keep UI responsive
-#ifdef Q_OS_LINUX
-    QApplication::processEvents(); // Process any pending events before blocking
-    
-    int score = 0;
-    // identifyUser handles processEvents internally now for gallery loading
-    int userId = m_fpManager->identifyUser(templates, score, progressCb, cancelCb);
-    
-    // Handle result immediately
-    if (m_cancelRequested) {
+    m_requestId = m_device->identify(templates);
+}
+
+void IdentificationDialog::onIdentifyProgress(int current, int total)
+{
+    if (!m_isScanning) return;
+
+    m_progressBar->setVisible(true);
+    m_progressBar->setMaximum(total);
+    m_progressBar->setValue(current);
+    if (current < total) {
+        m_statusLabel->setText(QString("Loading Gallery: %1/%2").arg(current).arg(total));
+    } else {
+        m_statusLabel->setText("Identifying...");
+    }
+}
+
+void IdentificationDialog::onIdentifyFinished(int userId, int score, bool cancelled, quint64 requestId)
+{
+    if (!m_isScanning || requestId != m_requestId) return;
+
+    if (cancelled) {
+        recordIdentification("cancelled");
+        if (m_accessLog) m_accessLog->record("identify", "cancelled", -1, 0, m_scanTimer.nsecsElapsed());
         updateStatus("Cancelled", "#FF9800");
         m_instructionLabel->setText("Identification cancelled by user.");
-    } else if (userId != -1) {
+        m_isScanning = false;
+        resetControls();
+        return;
+    }
+
+    // Scan click to result, gallery load and finger wait included
+    static Metrics::Histogram* const latency = Metrics::histogram(
+        "fp_identification_seconds", "Identification time from scan to result in the dialog.");
+    qint64 elapsed = m_scanTimer.nsecsElapsed();
+    latency->observeNanoseconds(elapsed);
+    const char* result = userId != -1 ? "match" : "no_match";
+    recordIdentification(result);
+    if (m_accessLog) m_accessLog->record("identify", result, userId, score, elapsed);
+
+    if (userId != -1) {
         // Match found!
         User user;
         if (m_dbManager->getUserById(userId, user)) {
@@ -301,54 +314,14 @@ void IdentificationDialog::onScanClicked()
     }
 
     m_isScanning = false;
+    resetControls();
+}
+
+void IdentificationDialog::resetControls()
+{
     m_btnScan->setEnabled(true);
     m_btnScan->setVisible(true);
     m_btnCancel->setVisible(false);
     m_btnClose->setEnabled(true);
     m_progressBar->setVisible(false);
-#else
-    QFutureWatcher<QPair<int, int>>* watcher = new QFutureWatcher<QPair<int, int>>(this);
-    connect(watcher, &QFutureWatcher<QPair<int, int>>::finished, this, [this, watcher]() {
-        QPair<int, int> result = watcher->result();
-        int userId = result.first;
-        int score = result.second;
-        
-        if (m_cancelRequested) {
-            updateStatus("Cancelled", "#FF9800");
-            m_instructionLabel->setText("Identification cancelled by user.");
-        } else if (userId != -1) {
-            // Match found!
-            User user;
-            if (m_dbManager->getUserById(userId, user)) {
-                updateStatus("Match Found!", "#4CAF50");
-                m_instructionLabel->setText("User identified successfully.");
-                showUserInfo(user, score);
-            } else {
-                updateStatus("User Error", "#F44336");
-                m_instructionLabel->setText("Match found but failed to load user details.");
-            }
-        } else {
-            // No match
-            updateStatus("No Match", "#F44336");
-            m_instructionLabel->setText("Fingerprint scan successful, but no matching user found.");
-        }
-
-        m_isScanning = false;
-        m_btnScan->setEnabled(true);
-        m_btnScan->setVisible(true);
-        m_btnCancel->setVisible(false);
-        m_btnClose->setEnabled(true);
-        m_progressBar->setVisible(false);
-        watcher->deleteLater();
-    });
-
-    QFuture<QPair<int, int>> future = QtConcurrent::run([this, templates, progressCb, cancelCb]() {
-        int score = 0;
-        int userId = m_fpManager->identifyUser(templates, score, progressCb, cancelCb);
-        return QPair<int, int>(userId, score);
-    });
-
-    watcher->setFuture(future);
-#endif
 }
-
@@ -7,19 +7,24 @@
 #include <QGroupBox>
 #include <QVBoxLayout>
 #include <QTimer>
+#include <QElapsedTimer>
 
 #include <QProgressBar>
-#include <atomic>
 
 #include "database_manager.h"
-#include "digitalpersonalib/include/fingerprint_manager.h"
+#include "template_gallery.h"
+#include "device_worker.h"
+
+class AccessLog;
 
 class IdentificationDialog : public QDialog
 {
     Q_OBJECT
 
 public:
-    explicit IdentificationDialog(FingerprintManager* fpManager, DatabaseManager* dbManager, QWidget *parent = nullptr);
+    // accessLog may be null
+    IdentificationDialog(DeviceWorker* device, DatabaseManager* dbManager, TemplateGallery* gallery,
+                         AccessLog* accessLog, QWidget *parent = nullptr);
     ~IdentificationDialog();
 
 protected:
@@ -29,15 +34,20 @@ protected:
 private slots:
     void onScanClicked();
     void onCancelClicked();
+    void onIdentifyProgress(int current, int total);
+    void onIdentifyFinished(int userId, int score, bool cancelled, quint64 requestId);
 
 private:
     void setupUI();
     void updateStatus(const QString& text, const QString& color = "black");
     void showUserInfo(const User& user, int score);
     void clearUserInfo();
+    void resetControls();
 
-    FingerprintManager* m_fpManager;
+    DeviceWorker* m_device;
     DatabaseManager* m_dbManager;
+    TemplateGallery* m_gallery;
+    AccessLog* m_accessLog;
 
     // UI Elements
     QLabel* m_statusLabel;
@@ -56,7 +66,8 @@ private:
     QLabel* m_avatarLabel;
 
     bool m_isScanning;
-    std::atomic<bool> m_cancelRequested;
+    quint64 m_requestId; // Our identify on the shared DeviceWorker
+    QElapsedTimer m_scanTimer;
 };
 
 #endif // IDENTIFICATION_DIALOG_H
@@ -0,0 +1,435 @@
+#include "identification_server.h"
+#include "database_manager.h"
+#include "template_gallery.h"
+#include "match_engine.h"
+#include "device_worker.h"
+#include "trace.h"
+#include "metrics.h"
+#include "access_log.h"
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonParseError>
+#include <QFutureWatcher>
+#include <QtConcurrent>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QStandardPaths>
+#include <QDebug>
+
+namespace {
+
+const qint64 kMaxLineLength = 1024 * 1024; // Generous for a base64 template
+const char* const kUncalibrated = "In-process matcher not calibrated against the library; "
+                                  "start the daemon with --calibration";
+
+Metrics::Gauge* queuedProbesGauge()
+{
+    static Metrics::Gauge* const gauge = Metrics::gauge("fp_server_queued_probes", "Probes waiting for the next gallery pass.");
+    return gauge;
+}
+
+// Dumps go to the daemon's own data directory; clients never name the file
+QString traceDirectory()
+{
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)).filePath("traces");
+}
+
+} // namespace
+
+IdentificationServer::IdentificationServer(DatabaseManager* dbManager, TemplateGallery* gallery, MatchEngine* engine,
+                                           DeviceWorker* device, QObject* parent)
+    : QObject(parent)
+    , m_dbManager(dbManager)
+    , m_gallery(gallery)
+    , m_engine(engine)
+    , m_device(device)
+    , m_accessLog(nullptr)
+    , m_server(new QLocalServer(this))
+    , m_batchRunning(false)
+    , m_maxBatch(32)
+    , m_threshold(40)
+    , m_matcherCalibrated(false)
+    , m_requests(0)
+    , m_probeMatches(0)
+    , m_captureMatches(0)
+    , m_batches(0)
+    , m_clients(0)
+{
+    connect(m_server, &QLocalServer::newConnection, this, &IdentificationServer::onNewConnection);
+
+    m_batchTimer.setSingleShot(true);
+    m_batchTimer.setInterval(2);
+    connect(&m_batchTimer, &QTimer::timeout, this, &IdentificationServer::startBatch);
+    if (m_device) {
+        connect(m_device, &DeviceWorker::identifyFinished, this, &IdentificationServer::onIdentifyFinished);
+        connect(m_device, &DeviceWorker::probeCaptured, this, &IdentificationServer::onProbeCaptured);
+    }
+}
+
+IdentificationServer::~IdentificationServer()
+{
+    m_server->close();
+}
+
+void IdentificationServer::setBatching(int windowMsec, int maxBatch)
+{
+    m_batchTimer.setInterval(qMax(0, windowMsec));
+    m_maxBatch = qMax(1, maxBatch);
+}
+
+bool IdentificationServer::listen(const QString& name)
+{
+    // A previous instance that crashed leaves its socket file behind; only
+    // remove it when nothing answers, never from under a live daemon
+    QLocalSocket probe;
+    probe.connectToServer(name);
+    if (probe.waitForConnected(500)) {
+        probe.disconnectFromServer();
+        m_lastError = QString("Another server is already listening on %1").arg(name);
+        return false;
+    }
+    QLocalServer::removeServer(name);
+    m_server->setSocketOptions(QLocalServer::UserAccessOption | QLocalServer::GroupAccessOption);
+
+    if (!m_server->listen(name)) {
+        m_lastError = QString("Failed to listen on %1: %2").arg(name).arg(m_server->errorString());
+        return false;
+    }
+
+    qInfo() << "Identification server listening on" << m_server->fullServerName();
+    return true;
+}
+
+void IdentificationServer::onNewConnection()
+{
+    while (QLocalSocket* client = m_server->nextPendingConnection()) {
+        ++m_clients;
+        connect(client, &QLocalSocket::readyRead, this, &IdentificationServer::onReadyRead);
+        connect(client, &QLocalSocket::disconnected, this, [this, client]() {
+            --m_clients;
+            client->deleteLater();
+        });
+    }
+}
+
+void IdentificationServer::onReadyRead()
+{
+    QLocalSocket* client = qobject_cast<QLocalSocket*>(sender());
+    if (!client) return;
+
+    while (client->canReadLine()) {
+        QByteArray line = client->readLine().trimmed();
+        if (line.isEmpty()) continue;
+
+        ++m_requests;
+        static Metrics::Counter* const requests = Metrics::counter("fp_server_requests_total", "Requests received on the local socket.");
+        requests->increment();
+        QJsonParseError parseError;
+        QJsonDocument doc = QJsonDocument::fromJson(line, &parseError);
+        if (!doc.isObject()) {
+            replyError(client, QJsonValue(), QString("Invalid JSON: %1").arg(parseError.errorString()));
+            continue;
+        }
+        handleRequest(client, doc.object());
+    }
+
+    // No newline within the limit: the peer is not speaking this protocol
+    if (client->bytesAvailable() > kMaxLineLength) {
+        replyError(client, QJsonValue(), "Request too long");
+        client->disconnectFromServer();
+    }
+}
+
+void IdentificationServer::handleRequest(QLocalSocket* client, const QJsonObject& request)
+{
+    TRACE_SCOPE("server", "request");
+    QJsonValue id = request.value("id");
+    QString op = request.value("op").toString();
+
+    if (op == "identify") {
+        if (!m_matcherCalibrated) {
+            replyError(client, id, kUncalibrated);
+            return;
+        }
+        QByteArray probe = QByteArray::fromBase64(request.value("template").toString().toLatin1());
+        if (probe.isEmpty()) {
+            replyError(client, id, "Missing template");
+            return;
+        }
+        // A client may ask for a stricter threshold, never a looser one
+        int threshold = qMax(m_threshold, request.value("threshold").toInt(m_threshold));
+        matchProbe(client, id, probe, threshold, request.value("reader").toString("socket"));
+    } else if (op == "capture") {
+        if (!m_device || !m_device->isReaderOpen()) {
+            replyError(client, id, "No reader available");
+            return;
+        }
+        PendingCapture pending = { client, id, QElapsedTimer() };
+        pending.received.start();
+        // Queued signals are delivered on this thread, so the id is recorded before any answer
+        quint64 requestId;
+        if (m_device->capturesProbes()) {
+            if (!m_matcherCalibrated) {
+                replyError(client, id, kUncalibrated);
+                return;
+            }
+            QStringList readers = m_device->openReaderIds();
+            QString reader = request.value("reader").toString();
+            if (reader.isEmpty() && readers.size() == 1) {
+                reader = readers.first();
+            }
+            if (reader.isEmpty()) {
+                replyError(client, id, "Several readers are open; name one in \"reader\"");
+                return;
+            }
+            if (!readers.contains(reader)) {
+                replyError(client, id, QString("Reader '%1' is not open").arg(reader));
+                return;
+            }
+            requestId = m_device->captureProbe(reader); // Scored against the shared gallery, see onProbeCaptured
+        } else {
+            requestId = m_device->identify(m_gallery->templates());
+        }
+        m_captures.insert(requestId, pending);
+    } else if (op == "stats") {
+        reply(client, id, stats());
+    } else if (op == "reload") {
+        if (!m_gallery->load()) {
+            replyError(client, id, m_dbManager->getLastError());
+            return;
+        }
+        reply(client, id, stats());
+    } else if (op == "trace") {
+        handleTrace(client, id, request);
+    } else if (op == "ping") {
+        reply(client, id, QJsonObject());
+    } else {
+        replyError(client, id, QString("Unknown op '%1'").arg(op));
+    }
+}
+
+void IdentificationServer::matchProbe(QLocalSocket* client, const QJsonValue& id, const QByteArray& probe, int threshold, const QString& reader)
+{
+    // Decoding is cheap and gives the client an immediate error for junk input
+    FingerprintTemplate decoded = FingerprintTemplate::fromSerialized(probe);
+    if (!decoded.isValid()) {
+        replyError(client, id, "Template has no minutiae (not an image-reader print?)");
+        return;
+    }
+
+    PendingProbe pending = { client, id, decoded, threshold, reader, QElapsedTimer() };
+    pending.received.start();
+    m_probes.append(pending);
+    queuedProbesGauge()->set(m_probes.size());
+
+    if (m_batchRunning) {
+        return; // Picked up as soon as the running batch finishes
+    }
+    if (m_probes.size() >= m_maxBatch) {
+        startBatch();
+    } else if (!m_batchTimer.isActive()) {
+        m_batchTimer.start();
+    }
+}
+
+void IdentificationServer::startBatch()
+{
+    m_batchTimer.stop();
+    if (m_batchRunning || m_probes.isEmpty()) {
+        return;
+    }
+
+    int count = qMin(int(m_probes.size()), m_maxBatch);
+    QVector<PendingProbe> batch = m_probes.mid(0, count);
+    m_probes.remove(0, count);
+    queuedProbesGauge()->set(m_probes.size());
+
+    QVector<FingerprintTemplate> probes;
+    QVector<int> thresholds;
+    probes.reserve(count);
+    thresholds.reserve(count);
+    for (const PendingProbe& pending : batch) {
+        probes.append(pending.probe);
+        thresholds.append(pending.threshold); // Each probe's own acceptance threshold
+    }
+
+    GallerySnapshot snapshot = m_gallery->snapshot();
+    MatchEngine* engine = m_engine;
+    m_batchRunning = true;
+    ++m_batches;
+
+    QFutureWatcher<QVector<MatchResult>>* watcher = new QFutureWatcher<QVector<MatchResult>>(this);
+    connect(watcher, &QFutureWatcher<QVector<MatchResult>>::finished, this, [this, watcher, batch]() {
+        QVector<MatchResult> results = watcher->result();
+        watcher->deleteLater();
+        m_batchRunning = false;
+
+        // Receipt to reply, batch wait included
+        static Metrics::Histogram* const latency = Metrics::histogram(
+            "fp_server_identify_seconds", "Probe identification time from receipt to reply.");
+        for (int i = 0; i < batch.size(); ++i) {
+            const PendingProbe& pending = batch[i];
+            ++m_probeMatches;
+            qint64 elapsed = pending.received.nsecsElapsed();
+            latency->observeNanoseconds(elapsed);
+
+            MatchResult result = i < results.size() ? results[i] : MatchResult();
+            bool matched = result.userId >= 0 && result.score >= pending.threshold;
+            if (m_accessLog) {
+                m_accessLog->record("identify", matched ? "match" : "no_match", matched ? result.userId : -1,
+                                    result.score, elapsed, pending.reader);
+            }
+            if (!pending.client) continue; // Client went away meanwhile
+
+            QJsonObject response;
+            response["matched"] = matched;
+            response["userId"] = matched ? result.userId : -1;
+            response["score"] = result.score;
+            response["threshold"] = pending.threshold;
+            reply(pending.client, pending.id, response);
+        }
+
+        // Everything that queued up during this pass goes out as the next batch
+        if (!m_probes.isEmpty()) {
+            startBatch();
+        }
+    });
+
+    watcher->setFuture(QtConcurrent::run([engine, snapshot, probes, thresholds]() {
+        return engine->identifyBatch(probes, snapshot, thresholds);
+    }));
+}
+
+void IdentificationServer::onIdentifyFinished(int userId, int score, bool cancelled, quint64 requestId)
+{
+    auto it = m_captures.find(requestId);
+    if (it == m_captures.end()) return; // Started by someone else sharing the worker
+
+    PendingCapture pending = it.value();
+    m_captures.erase(it);
+    ++m_captureMatches;
+    if (m_accessLog) {
+        m_accessLog->record("identify", cancelled ? "cancelled" : userId >= 0 ? "match" : "no_match",
+                            userId, score, pending.received.nsecsElapsed());
+    }
+    if (!pending.client) return;
+
+    if (cancelled) {
+        replyError(pending.client, pending.id, "Capture cancelled");
+        return;
+    }
+
+    QJsonObject response;
+    response["matched"] = userId >= 0;
+    response["userId"] = userId;
+    response["score"] = score;
+    reply(pending.client, pending.id, response);
+}
+
+void IdentificationServer::onProbeCaptured(const QString& readerId, const QByteArray& probeTemplate, const QString& error,
+                                           quint64 requestId)
+{
+    auto it = m_captures.find(requestId);
+    if (it == m_captures.end()) return; // Started by someone else sharing the worker
+
+    PendingCapture pending = it.value();
+    m_captures.erase(it);
+    ++m_captureMatches;
+    if (!error.isEmpty()) {
+        if (m_accessLog) {
+            m_accessLog->record("identify", error == "Capture cancelled" ? "cancelled" : "error",
+                                -1, 0, pending.received.nsecsElapsed(), readerId);
+        }
+        if (pending.client) replyError(pending.client, pending.id, error);
+        return;
+    }
+    if (!pending.client) return; // Nobody left to answer
+
+    // Same batched path as a template sent by a client
+    matchProbe(pending.client, pending.id, probeTemplate, m_threshold, readerId);
+}
+
+void IdentificationServer::handleTrace(QLocalSocket* client, const QJsonValue& id, const QJsonObject& request)
+{
+    QString action = request.value("action").toString();
+    QJsonObject response;
+
+    if (action == "start") {
+        Trace::clear();
+        Trace::setEnabled(true);
+    } else if (action == "stop") {
+        Trace::setEnabled(false);
+    } else if (action == "dump") {
+        if (request.contains("path")) {
+            replyError(client, id, "The daemon chooses the trace file; omit \"path\"");
+            return;
+        }
+        QDir dir(traceDirectory());
+        if (!dir.mkpath(".")) {
+            replyError(client, id, QString("Cannot create trace directory %1").arg(dir.path()));
+            return;
+        }
+        QString path = dir.filePath(QString("trace-%1-%2.json")
+            .arg(QDateTime::currentDateTime().toString("yyyyMMdd-HHmmss-zzz"))
+            .arg(QCoreApplication::applicationPid()));
+        QString error;
+        if (!Trace::writeChromeTrace(path, &error)) {
+            replyError(client, id, error);
+            return;
+        }
+        response["path"] = path;
+    } else {
+        replyError(client, id, QString("Unknown trace action '%1'").arg(action));
+        return;
+    }
+
+    response["tracing"] = Trace::isEnabled();
+    reply(client, id, response);
+}
+
+QJsonObject IdentificationServer::stats() const
+{
+    QJsonObject result;
+    result["gallerySize"] = m_gallery->size();
+    result["threshold"] = m_threshold;
+    result["matcherCalibrated"] = m_matcherCalibrated;
+    result["matcherThreads"] = m_engine->threadCount();
+    result["reader"] = m_device && m_device->isReaderOpen();
+    result["readers"] = QJsonArray::fromStringList(m_device ? m_device->openReaderIds() : QStringList());
+    result["clients"] = m_clients;
+    result["requests"] = double(m_requests);
+    result["probeMatches"] = double(m_probeMatches);
+    result["captureMatches"] = double(m_captureMatches);
+    result["batches"] = double(m_batches);
+    result["averageBatchSize"] = m_batches ? double(m_probeMatches) / m_batches : 0.0;
+    result["queuedProbes"] = m_probes.size();
+    result["pendingCaptures"] = m_captures.size();
+
+    MatchEngine::PrefilterStats prefilter = m_engine->prefilterStats();
+    result["prefilterRatio"] = m_engine->prefilterRatio();
+    result["prefilterPrunedFraction"] = prefilter.gallery ? 1.0 - double(prefilter.candidates) / prefilter.gallery : 0.0;
+    return result;
+}
+
+void IdentificationServer::reply(QLocalSocket* client, const QJsonValue& id, QJsonObject response)
+{
+    if (!id.isUndefined()) {
+        response["id"] = id;
+    }
+    if (!response.contains("ok")) {
+        response["ok"] = true;
+    }
+    client->write(QJsonDocument(response).toJson(QJsonDocument::Compact) + '\n');
+}
+
+void IdentificationServer::replyError(QLocalSocket* client, const QJsonValue& id, const QString& error)
+{
+    static Metrics::Counter* const errors = Metrics::counter("fp_server_errors_total", "Requests answered with an error.");
+    errors->increment();
+
+    QJsonObject response;
+    response["ok"] = false;
+    response["error"] = error;
+    reply(client, id, response);
+}
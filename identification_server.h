@@ -0,0 +1,127 @@
+#ifndef IDENTIFICATION_SERVER_H
+#define IDENTIFICATION_SERVER_H
+
+#include <QObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QPointer>
+#include <QHash>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QVector>
+
+#include "fingerprint_template.h"
+
+class DatabaseManager;
+class TemplateGallery;
+class MatchEngine;
+class DeviceWorker;
+class AccessLog;
+
+// Local socket front end over one warm gallery and matcher.
+//
+// Protocol: one JSON object per line in each direction. Every request may
+// carry an "id" that is echoed in its response; responses to probe matches
+// can arrive out of order, capture responses arrive in request order.
+// Probes arriving within the batch window (or while a batch is running) are
+// coalesced and scored in one MatchEngine::identifyBatch pass.
+// Identify and capture outcomes go to the access log when one is set; a
+// probe's optional "reader" names the client terminal in that record. A
+// probe's "threshold" can only raise the server's threshold. Until the
+// in-process matcher is marked calibrated (see match_evaluation --library),
+// identify requests and captures on selected readers are refused; library
+// captures are matched by the library and always served.
+//
+//   {"op":"identify","template":"<base64 FP1 print>","threshold":40,"reader":"gate-2"}
+//   {"op":"capture","reader":"<id>"}  capture on a reader selected by id and match the scan
+//                                     like a probe; "reader" may be left out when one reader
+//                                     is open. Without selected readers: the library's reader,
+//                                     1:N via library
+//   {"op":"stats"} {"op":"reload"} {"op":"ping"}
+//   {"op":"trace","action":"start|stop|dump"}  dump replies with the file it wrote
+//                                                under the daemon's data directory
+//
+//   -> {"id":..,"ok":true,"matched":true,"userId":12,"score":57}
+//   -> {"id":..,"ok":false,"error":"..."}
+class IdentificationServer : public QObject {
+    Q_OBJECT
+
+public:
+    // device may be null when the box has no reader
+    IdentificationServer(DatabaseManager* dbManager, TemplateGallery* gallery, MatchEngine* engine,
+                         DeviceWorker* device, QObject* parent = nullptr);
+    ~IdentificationServer() override;
+
+    bool listen(const QString& name);
+    QString serverName() const { return m_server->fullServerName(); }
+
+    void setThreshold(int threshold) { m_threshold = threshold; }
+    int threshold() const { return m_threshold; }
+
+    // True once the in-process matcher is shown at least as accurate as the library's
+    void setMatcherCalibrated(bool calibrated) { m_matcherCalibrated = calibrated; }
+
+    // windowMsec: how long the first probe waits for company; 0 = next event loop turn
+    void setBatching(int windowMsec, int maxBatch);
+
+    void setAccessLog(AccessLog* accessLog) { m_accessLog = accessLog; } // May be null
+
+    QString getLastError() const { return m_lastError; }
+
+private slots:
+    void onNewConnection();
+    void onReadyRead();
+    void onIdentifyFinished(int userId, int score, bool cancelled, quint64 requestId);
+    void onProbeCaptured(const QString& readerId, const QByteArray& probeTemplate, const QString& error, quint64 requestId);
+    void startBatch();
+
+private:
+    struct PendingCapture {
+        QPointer<QLocalSocket> client;
+        QJsonValue id;
+        QElapsedTimer received;
+    };
+
+    struct PendingProbe {
+        QPointer<QLocalSocket> client;
+        QJsonValue id;
+        FingerprintTemplate probe;
+        int threshold;
+        QString reader;
+        QElapsedTimer received; // For fp_server_identify_seconds
+    };
+
+    void handleRequest(QLocalSocket* client, const QJsonObject& request);
+    void matchProbe(QLocalSocket* client, const QJsonValue& id, const QByteArray& probe, int threshold, const QString& reader);
+    void handleTrace(QLocalSocket* client, const QJsonValue& id, const QJsonObject& request);
+    void reply(QLocalSocket* client, const QJsonValue& id, QJsonObject response);
+    void replyError(QLocalSocket* client, const QJsonValue& id, const QString& error);
+    QJsonObject stats() const;
+
+    DatabaseManager* m_dbManager;
+    TemplateGallery* m_gallery;
+    MatchEngine* m_engine;
+    DeviceWorker* m_device;
+    AccessLog* m_accessLog;
+    QLocalServer* m_server;
+
+    QHash<quint64, PendingCapture> m_captures; // By DeviceWorker request id
+
+    QVector<PendingProbe> m_probes; // Waiting for the next batch
+    QTimer m_batchTimer;
+    bool m_batchRunning;
+    int m_maxBatch;
+    int m_threshold;
+    bool m_matcherCalibrated;
+    QString m_lastError;
+
+    qint64 m_requests;
+    qint64 m_probeMatches;
+    qint64 m_captureMatches;
+    qint64 m_batches;
+    int m_clients;
+};
+
+#endif // IDENTIFICATION_SERVER_H
@@ -0,0 +1,417 @@
+// Headless 1:N identification benchmark.
+//
+// Builds synthetic galleries through the real storage path (archive import
+// into SQLite or PostgreSQL), then measures gallery load, template decode,
+// cache warm start and per-probe MatchEngine latency. Results go to stdout
+// (or --output) as JSON so CI can diff them between builds.
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QTemporaryFile>
+#include <QFile>
+#include <QSqlError>
+#include <QSqlQuery>
+#include <QtMath>
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+#include "database_manager.h"
+#include "fingerprint_template.h"
+#include "template_gallery.h"
+#include "match_engine.h"
+#include "user_archive.h"
+#include "trace.h"
+
+namespace {
+
+const int kImageWidth = 400;
+const int kImageHeight = 500;
+const int kStagesPerTemplate = 5;
+
+struct Options {
+    QList<int> sizes;
+    int probes = 200;
+    int threads = 0;
+    int threshold = 20;
+    int earlyStop = 0;
+    QList<double> prefilter; // Keep ratios, 1.0 = exhaustive
+    int prefilterMinimum = 100;
+    quint32 seed = 1;
+    QString output;
+    DatabaseConfigDialog::Config db;
+    bool wipe = false;
+};
+
+int randomInt(std::mt19937& rng, int low, int high)
+{
+    return std::uniform_int_distribution<int>(low, high)(rng);
+}
+
+// Finger identity is a pure function of (seed, index), so probes can be
+// regenerated without keeping a million base prints in memory
+QVector<Minutia> baseFinger(quint32 seed, int index)
+{
+    std::mt19937 rng(seed * 2654435761u ^ quint32(index));
+    int count = randomInt(rng, 30, 50);
+    QVector<Minutia> minutiae;
+    minutiae.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        Minutia minutia = { randomInt(rng, 20, kImageWidth - 20), randomInt(rng, 20, kImageHeight - 20), randomInt(rng, 0, 359) };
+        minutiae.append(minutia);
+    }
+    return minutiae;
+}
+
+// Another impression of the same finger: rigid motion, jitter, missed and spurious minutiae
+QVector<Minutia> impression(const QVector<Minutia>& base, std::mt19937& rng, int maxRotation, int maxShift, double dropRate, int spurious)
+{
+    double angle = randomInt(rng, -maxRotation, maxRotation);
+    double rad = qDegreesToRadians(angle);
+    double c = std::cos(rad), s = std::sin(rad);
+    int dx = randomInt(rng, -maxShift, maxShift);
+    int dy = randomInt(rng, -maxShift, maxShift);
+    double cx = kImageWidth / 2.0, cy = kImageHeight / 2.0;
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    QVector<Minutia> out;
+    out.reserve(base.size() + spurious);
+    for (const Minutia& m : base) {
+        if (unit(rng) < dropRate) continue;
+        double x = cx + (m.x - cx) * c - (m.y - cy) * s + dx + randomInt(rng, -3, 3);
+        double y = cy + (m.x - cx) * s + (m.y - cy) * c + dy + randomInt(rng, -3, 3);
+        int theta = ((m.theta + int(angle) + randomInt(rng, -5, 5)) % 360 + 360) % 360;
+        Minutia minutia = { int(std::lround(x)), int(std::lround(y)), theta };
+        out.append(minutia);
+    }
+    for (int i = 0; i < spurious; ++i) {
+        Minutia minutia = { randomInt(rng, 0, kImageWidth), randomInt(rng, 0, kImageHeight), randomInt(rng, 0, 359) };
+        out.append(minutia);
+    }
+    return out;
+}
+
+// Written by the same code as the libfprint round trip in test_template_decode
+QByteArray serializeSynthetic(const QVector<QVector<Minutia>>& prints)
+{
+    return FingerprintTemplate::fromPrints(prints).toSerialized();
+}
+
+QByteArray syntheticTemplate(quint32 seed, int index)
+{
+    QVector<Minutia> base = baseFinger(seed, index);
+    std::mt19937 rng(seed ^ quint32(index) * 40503u);
+    QVector<QVector<Minutia>> prints;
+    for (int stage = 0; stage < kStagesPerTemplate; ++stage) {
+        prints.append(impression(base, rng, 5, 10, 0.1, 2));
+    }
+    return serializeSynthetic(prints);
+}
+
+double percentile(QVector<double> values, double p)
+{
+    if (values.isEmpty()) return 0.0;
+    std::sort(values.begin(), values.end());
+    int rank = qBound(0, int(std::ceil(p / 100.0 * values.size())) - 1, int(values.size()) - 1);
+    return values[rank];
+}
+
+double msSince(const QElapsedTimer& timer)
+{
+    return timer.nsecsElapsed() / 1e6;
+}
+
+bool populate(DatabaseManager& db, const Options& options, int size, QJsonObject& result)
+{
+    QTemporaryFile archive;
+    if (!archive.open()) {
+        qCritical() << "Cannot create temporary archive:" << archive.errorString();
+        return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    UserArchiveWriter writer(&archive);
+    writer.writeHeader();
+    for (int i = 0; i < size; ++i) {
+        User user;
+        user.id = 0;
+        user.name = QString("synthetic-%1").arg(i, 7, 10, QChar('0'));
+        user.fingerprintTemplate = syntheticTemplate(options.seed, i);
+        if (!writer.writeUser(user)) {
+            qCritical() << writer.getLastError();
+            return false;
+        }
+    }
+    writer.finish();
+    result["generate_ms"] = msSince(timer);
+    result["archive_bytes"] = double(archive.size());
+
+    archive.seek(0);
+    timer.restart();
+    int imported = 0;
+    if (!db.importUsers(&archive, imported)) {
+        qCritical() << "Import failed:" << db.getLastError();
+        return false;
+    }
+    result["import_ms"] = msSince(timer);
+    return true;
+}
+
+bool wipeUsers(DatabaseManager& db)
+{
+    QSqlQuery query = db.preparedQuery("DELETE FROM users");
+    if (!query.exec()) {
+        qCritical() << "Failed to empty users:" << query.lastError().text();
+        return false;
+    }
+    QSqlQuery tombstones = db.preparedQuery("DELETE FROM deleted_users");
+    tombstones.exec();
+    return true;
+}
+
+// Probes alternate genuine (new impression of an enrolled finger) and impostor
+QJsonObject runProbes(const Options& options, int size, DatabaseManager& db, MatchEngine& engine, const GallerySnapshot& snapshot)
+{
+    std::mt19937 rng(options.seed + quint32(size));
+    QVector<double> latencies;
+    latencies.reserve(options.probes);
+    int genuine = 0, genuineHits = 0, impostors = 0, falseAccepts = 0;
+    engine.resetPrefilterStats();
+
+    QElapsedTimer timer;
+    QElapsedTimer total;
+    total.start();
+    for (int p = 0; p < options.probes; ++p) {
+        bool isGenuine = (p % 2) == 0;
+        int index = randomInt(rng, 0, size - 1);
+        QVector<Minutia> base = isGenuine ? baseFinger(options.seed, index) : baseFinger(options.seed ^ 0x5bd1e995u, p);
+        QVector<QVector<Minutia>> prints;
+        prints.append(impression(base, rng, 15, 30, 0.2, 5));
+        FingerprintTemplate probe = FingerprintTemplate::fromSerialized(serializeSynthetic(prints));
+
+        timer.restart();
+        MatchResult match = engine.identify(probe, snapshot, options.threshold);
+        latencies.append(msSince(timer));
+
+        if (isGenuine) {
+            ++genuine;
+            User expected;
+            if (match.userId >= 0 && db.getUserById(match.userId, expected)
+                && expected.name == QString("synthetic-%1").arg(index, 7, 10, QChar('0'))) {
+                ++genuineHits;
+            }
+        } else {
+            ++impostors;
+            if (match.userId >= 0) ++falseAccepts;
+        }
+    }
+    double totalMs = msSince(total);
+
+    double sum = 0.0;
+    for (double v : latencies) sum += v;
+    MatchEngine::PrefilterStats stats = engine.prefilterStats();
+
+    QJsonObject match;
+    match["prefilter_ratio"] = engine.prefilterRatio();
+    match["probes"] = options.probes;
+    match["mean_candidates"] = stats.searches ? double(stats.candidates) / stats.searches : 0.0;
+    match["pruned_fraction"] = stats.gallery ? 1.0 - double(stats.candidates) / stats.gallery : 0.0;
+    match["mean_ms"] = latencies.isEmpty() ? 0.0 : sum / latencies.size();
+    match["p50_ms"] = percentile(latencies, 50);
+    match["p99_ms"] = percentile(latencies, 99);
+    match["max_ms"] = percentile(latencies, 100);
+    match["probes_per_sec"] = totalMs > 0 ? options.probes * 1000.0 / totalMs : 0.0;
+    match["comparisons_per_sec"] = sum > 0 ? double(stats.candidates) * 1000.0 / sum : 0.0;
+    match["genuine_hit_rate"] = genuine ? double(genuineHits) / genuine : 0.0;
+    match["impostor_accept_rate"] = impostors ? double(falseAccepts) / impostors : 0.0;
+    return match;
+}
+
+bool runSize(const Options& options, int size, const QString& workDir, QJsonObject& result)
+{
+    result["gallery_size"] = size;
+
+    DatabaseConfigDialog::Config config = options.db;
+    if (config.type == "SQLITE") {
+        config.name = QString("%1/bench_%2.db").arg(workDir).arg(size);
+    }
+
+    DatabaseManager db;
+    if (!db.initialize(config)) {
+        qCritical() << "Database init failed:" << db.getLastError();
+        return false;
+    }
+    if (config.type != "SQLITE" && !wipeUsers(db)) {
+        return false;
+    }
+
+    if (!populate(db, options, size, result)) {
+        return false;
+    }
+
+    // Raw row fetch
+    QElapsedTimer timer;
+    timer.start();
+    QMap<int, QByteArray> templates;
+    if (!db.getAllTemplates(templates)) {
+        qCritical() << "Load failed:" << db.getLastError();
+        return false;
+    }
+    result["load_ms"] = msSince(timer);
+
+    // GVariant decode, single thread
+    timer.restart();
+    int decoded = 0;
+    for (auto it = templates.constBegin(); it != templates.constEnd(); ++it) {
+        if (FingerprintTemplate::fromSerialized(it.value()).isValid()) ++decoded;
+    }
+    result["decode_ms"] = msSince(timer);
+    result["decoded"] = decoded;
+    templates.clear();
+
+    // Full gallery cold load (DB + decode + cache write), then warm start from the mapped cache
+    TemplateGallery gallery(&db);
+    QString cachePath = db.databaseFilePath();
+    if (!cachePath.isEmpty()) {
+        gallery.setCacheFile(cachePath + ".gallery");
+        QFile::remove(cachePath + ".gallery");
+    }
+    timer.restart();
+    if (!gallery.load()) {
+        qCritical() << "Gallery load failed:" << db.getLastError();
+        return false;
+    }
+    result["gallery_cold_ms"] = msSince(timer);
+    if (!cachePath.isEmpty()) {
+        TemplateGallery warm(&db);
+        warm.setCacheFile(cachePath + ".gallery");
+        timer.restart();
+        warm.load();
+        result["gallery_warm_ms"] = msSince(timer);
+    }
+
+    timer.restart();
+    GallerySnapshot snapshot = gallery.snapshot();
+    result["snapshot_ms"] = msSince(timer);
+
+    // Same probe sequence for every pre-filter ratio, so hit rates compare directly
+    MatchEngine engine(options.threads);
+    engine.setEarlyStopScore(options.earlyStop);
+    result["threads"] = engine.threadCount();
+    result["early_stop"] = options.earlyStop;
+
+    QJsonArray matches;
+    for (double ratio : options.prefilter) {
+        engine.setPrefilter(ratio, options.prefilterMinimum);
+        matches.append(runProbes(options, size, db, engine, snapshot));
+    }
+    result["match"] = matches;
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("identify_benchmark");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Synthetic 1:N identification benchmark");
+    parser.addHelpOption();
+    parser.addOptions({
+        { "sizes", "Comma separated gallery sizes.", "list", "1000,10000,100000" },
+        { "probes", "Probes per gallery size.", "n", "200" },
+        { "threads", "Matcher threads (0 = ideal).", "n", "0" },
+        { "threshold", "Identification score threshold.", "score", "20" },
+        { "early-stop", "Score that ends a gallery pass early (0 = score the whole gallery).", "score", "0" },
+        { "prefilter", "Comma separated pre-filter keep ratios to compare.", "list", "1,0.25,0.1" },
+        { "prefilter-min", "Fewest candidates the pre-filter keeps.", "n", "100" },
+        { "seed", "Random seed.", "n", "1" },
+        { "output", "Write JSON here instead of stdout.", "file" },
+        { "driver", "sqlite or postgresql.", "driver", "sqlite" },
+        { "host", "PostgreSQL host.", "host", "localhost" },
+        { "port", "PostgreSQL port.", "port", "5432" },
+        { "database", "PostgreSQL database.", "name", "fingerprint_bench" },
+        { "user", "PostgreSQL user.", "user", "postgres" },
+        { "password", "PostgreSQL password.", "password" },
+        { "wipe", "Allow emptying the PostgreSQL users table." }
+    });
+    parser.process(app);
+    Trace::configureFromEnvironment();
+
+    Options options;
+    for (const QString& size : parser.value("sizes").split(',', Qt::SkipEmptyParts)) {
+        int n = size.trimmed().toInt();
+        if (n > 0) options.sizes.append(n);
+    }
+    options.probes = qMax(1, parser.value("probes").toInt());
+    options.threads = parser.value("threads").toInt();
+    options.threshold = parser.value("threshold").toInt();
+    options.earlyStop = parser.value("early-stop").toInt();
+    for (const QString& ratio : parser.value("prefilter").split(',', Qt::SkipEmptyParts)) {
+        double r = ratio.trimmed().toDouble();
+        if (r > 0.0) options.prefilter.append(qMin(1.0, r));
+    }
+    if (options.prefilter.isEmpty()) options.prefilter.append(1.0);
+    options.prefilterMinimum = parser.value("prefilter-min").toInt();
+    options.seed = parser.value("seed").toUInt();
+    options.output = parser.value("output");
+    options.wipe = parser.isSet("wipe");
+
+    bool postgres = parser.value("driver").compare("postgresql", Qt::CaseInsensitive) == 0;
+    options.db.type = postgres ? "POSTGRESQL" : "SQLITE";
+    options.db.host = parser.value("host");
+    options.db.port = parser.value("port").toInt();
+    options.db.name = parser.value("database");
+    options.db.user = parser.value("user");
+    options.db.password = parser.value("password");
+
+    if (postgres && !options.wipe) {
+        qCritical() << "The PostgreSQL run empties the users table of" << options.db.name << "- pass --wipe to confirm";
+        return 2;
+    }
+
+    QTemporaryDir workDir;
+    if (!workDir.isValid()) {
+        qCritical() << "Cannot create working directory";
+        return 1;
+    }
+
+    QJsonArray runs;
+    for (int size : options.sizes) {
+        qInfo() << "Benchmarking gallery of" << size;
+        QJsonObject result;
+        if (!runSize(options, size, workDir.path(), result)) {
+            return 1;
+        }
+        runs.append(result);
+    }
+
+    QJsonObject report;
+    report["driver"] = options.db.type;
+    report["seed"] = double(options.seed);
+    report["qt_version"] = QString(qVersion());
+    report["runs"] = runs;
+
+    QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+    if (options.output.isEmpty()) {
+        fputs(json.constData(), stdout);
+    } else {
+        QFile file(options.output);
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            qCritical() << "Cannot write" << options.output << file.errorString();
+            return 1;
+        }
+        file.write(json);
+    }
+    Trace::writeAtExit();
+    return 0;
+}
@@ -0,0 +1,49 @@
+# Headless identification benchmark (no reader needed)
+#   qmake identify_benchmark.pro && make
+#   ./bin/identify_benchmark --sizes 1000,10000,100000 --output results.json
+
+QT += core sql widgets concurrent
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = identify_benchmark
+TEMPLATE = app
+
+DESTDIR = bin
+
+macx {
+    INCLUDEPATH += /opt/homebrew/include/glib-2.0 \
+                   /opt/homebrew/lib/glib-2.0/include
+    LIBS += -L/opt/homebrew/lib -lglib-2.0
+}
+
+unix:!macx {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += glib-2.0
+}
+
+SOURCES += \
+    identify_benchmark.cpp \
+    database_manager.cpp \
+    migration_manager.cpp \
+    template_gallery.cpp \
+    gallery_cache.cpp \
+    fingerprint_template.cpp \
+    trace.cpp \
+    metrics.cpp \
+    match_engine.cpp \
+    user_archive.cpp
+
+HEADERS += \
+    database_manager.h \
+    migration_manager.h \
+    template_gallery.h \
+    gallery_cache.h \
+    fingerprint_template.h \
+    trace.h \
+    metrics.h \
+    match_engine.h \
+    user_archive.h
+
+RESOURCES += migrations.qrc
@@ -0,0 +1,213 @@
+#include "library_scorer.h"
+#include "device_worker.h"
+#include "capture_replay.h"
+#include "trace.h"
+#include <QDebug>
+
+namespace {
+
+// A capture on the virtual reader takes well under a second; enrollment runs several
+const int kStallMsec = 60000;
+
+} // namespace
+
+LibraryScorer::LibraryScorer(DeviceWorker* device, CaptureReplay* replay, QObject* parent)
+    : QObject(parent)
+    , m_device(device)
+    , m_replay(replay)
+    , m_enrolling(0)
+    , m_probe(0)
+    , m_subject(-1)
+    , m_verifyTotal(0)
+    , m_verifyDone(0)
+    , m_skippedFrames(0)
+    , m_running(false)
+    , m_nudged(false)
+{
+    m_watchdog.setSingleShot(true);
+    m_watchdog.setInterval(kStallMsec);
+    connect(&m_watchdog, &QTimer::timeout, this, &LibraryScorer::onStalled);
+
+    connect(m_device, &DeviceWorker::readerInitialized, this, &LibraryScorer::onReaderInitialized);
+    connect(m_device, &DeviceWorker::enrollmentStarted, this, &LibraryScorer::onEnrollmentStarted);
+    connect(m_device, &DeviceWorker::enrollmentSampleFinished, this, &LibraryScorer::onEnrollmentSampleFinished);
+    connect(m_device, &DeviceWorker::verifyFinished, this, &LibraryScorer::onVerifyFinished);
+}
+
+int LibraryScorer::enrolledSubjects() const
+{
+    int enrolled = 0;
+    for (const QByteArray& fingerprint : m_templates) {
+        if (!fingerprint.isEmpty()) ++enrolled;
+    }
+    return enrolled;
+}
+
+void LibraryScorer::start()
+{
+    m_running = true;
+    m_device->initializeReader();
+}
+
+void LibraryScorer::onReaderInitialized(bool ok, const QString& error)
+{
+    if (!m_running) return;
+    if (!ok) {
+        finish(false, QString("Virtual reader unavailable: %1").arg(error));
+        return;
+    }
+
+    m_probes.clear();
+    for (int s = 0; s < m_subjects.size(); ++s) {
+        for (const QString& frame : m_subjects[s].probeFrames) {
+            Probe probe = { s, frame, FingerprintTemplate() };
+            m_probes.append(probe);
+        }
+    }
+    m_templates = QVector<QByteArray>(m_subjects.size());
+    m_decoded = QVector<FingerprintTemplate>(m_subjects.size());
+    m_enrolling = 0;
+    enrollNext();
+}
+
+// Subjects first, then every probe frame on its own
+void LibraryScorer::enrollNext()
+{
+    while (m_enrolling < m_subjects.size() + m_probes.size()) {
+        bool subject = m_enrolling < m_subjects.size();
+        QStringList frames = subject ? m_subjects[m_enrolling].enrollFrames
+                                     : QStringList(m_probes[m_enrolling - m_subjects.size()].frame);
+        if (m_replay->loadImageFiles(frames)) {
+            m_nudged = false;
+            m_watchdog.start();
+            m_device->startEnrollment();
+            return;
+        }
+        qWarning() << "Cannot read" << frames.join(", ");
+        ++m_skippedFrames;
+        ++m_enrolling;
+    }
+
+    m_verifyTotal = 0;
+    for (const Probe& probe : m_probes) {
+        if (probe.fingerprint.isValid()) m_verifyTotal += enrolledSubjects();
+    }
+    qInfo() << "Enrolled" << enrolledSubjects() << "of" << m_subjects.size() << "subjects;"
+            << m_verifyTotal << "library verify calls to go";
+    m_probe = 0;
+    m_subject = -1;
+    verifyNext();
+}
+
+void LibraryScorer::onEnrollmentStarted(bool ok, const QString& error)
+{
+    if (!m_running) return;
+    if (ok) {
+        m_device->captureEnrollmentSample();
+        return;
+    }
+    m_watchdog.stop();
+    qWarning() << "Enrollment did not start:" << error;
+    ++m_skippedFrames;
+    ++m_enrolling;
+    enrollNext();
+}
+
+void LibraryScorer::onEnrollmentSampleFinished(int result, const QString& message, const QByteArray& templateData,
+                                               const QString& error)
+{
+    Q_UNUSED(message);
+    if (!m_running) return;
+    if (result == 0) {
+        m_nudged = false;
+        m_watchdog.start();
+        m_device->captureEnrollmentSample();
+        return;
+    }
+    m_watchdog.stop();
+
+    if (result < 0 || templateData.isEmpty()) {
+        qWarning() << "Enrollment failed:" << error;
+        ++m_skippedFrames;
+    } else if (m_enrolling < m_subjects.size()) {
+        m_templates[m_enrolling] = templateData;
+        m_decoded[m_enrolling] = FingerprintTemplate::fromSerialized(templateData);
+    } else {
+        m_probes[m_enrolling - m_subjects.size()].fingerprint = FingerprintTemplate::fromSerialized(templateData);
+    }
+
+    m_device->cancelEnrollment(); // Ends the session, as the main window does after saving
+    ++m_enrolling;
+    enrollNext();
+}
+
+// Probe-major, so each probe frame is loaded once
+void LibraryScorer::verifyNext()
+{
+    for (;;) {
+        if (++m_subject >= m_subjects.size()) {
+            m_subject = 0;
+            ++m_probe;
+        }
+        if (m_probe >= m_probes.size()) {
+            finish(true);
+            return;
+        }
+        if (!m_probes[m_probe].fingerprint.isValid() || m_templates[m_subject].isEmpty()) continue;
+
+        if (!m_replay->loadImageFiles(QStringList(m_probes[m_probe].frame))) {
+            ++m_skippedFrames;
+            m_subject = m_subjects.size() - 1; // Next probe
+            continue;
+        }
+        m_nudged = false;
+        m_watchdog.start();
+        m_device->verify(m_templates[m_subject]);
+        return;
+    }
+}
+
+void LibraryScorer::onVerifyFinished(bool matched, int score, const QString& error)
+{
+    if (!m_running) return;
+    m_watchdog.stop();
+    emit progress(++m_verifyDone, m_verifyTotal);
+
+    if (!error.isEmpty()) {
+        // The scan itself failed; the pair has no score from either matcher
+        qWarning() << "Verify of" << m_probes[m_probe].frame << "failed:" << error;
+        ++m_skippedFrames;
+    } else {
+        TRACE_SCOPE("evaluate", "libraryPair");
+        const Probe& probe = m_probes[m_probe];
+        PairScore pair;
+        pair.genuine = probe.subject == m_subject;
+        pair.matched = matched;
+        pair.libraryScore = score;
+        pair.templateScore = FingerprintTemplate::match(probe.fingerprint, m_decoded[m_subject]);
+        m_scores.append(pair);
+    }
+    verifyNext();
+}
+
+void LibraryScorer::onStalled()
+{
+    if (!m_running) return;
+    // A rejected scan (too little finger, say) waits for another frame; offer one
+    if (!m_nudged) {
+        m_nudged = true;
+        m_replay->onCaptureStarted();
+        m_watchdog.start();
+        return;
+    }
+    finish(false, QString("The virtual reader answered no capture within %1 s").arg(kStallMsec / 1000));
+}
+
+void LibraryScorer::finish(bool ok, const QString& error)
+{
+    if (!m_running) return;
+    m_running = false;
+    m_watchdog.stop();
+    m_lastError = error;
+    emit finished(ok);
+}
@@ -0,0 +1,98 @@
+#ifndef LIBRARY_SCORER_H
+#define LIBRARY_SCORER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QVector>
+#include <QStringList>
+#include <QByteArray>
+
+#include "fingerprint_template.h"
+
+class DeviceWorker;
+class CaptureReplay;
+
+// Scores recorded image pairs with the library's own matcher.
+//
+// Nothing in FingerprintManager compares two stored templates, so pairs go
+// through the same calls the main window makes, on libfprint's virtual_image
+// reader (see CaptureReplay):
+//   1. Every subject is enrolled from its first frames, as an operator would.
+//   2. Every probe frame is verified against every enrolled subject; the
+//      library scans the frame, matches it and reports its score.
+//   3. For the in-process matcher the probe frame is also enrolled on its own
+//      (every stage from that one frame), so FingerprintTemplate::match sees
+//      minutiae the library extracted from exactly the same image.
+// The reader handles one capture at a time, so this runs sequentially.
+class LibraryScorer : public QObject {
+    Q_OBJECT
+
+public:
+    struct Subject {
+        QString name;
+        QStringList enrollFrames; // Image paths, cycled over the library's stages
+        QStringList probeFrames;
+    };
+
+    // One probe frame against one enrolled subject
+    struct PairScore {
+        bool genuine = false;
+        bool matched = false;  // The library's own verify decision
+        int libraryScore = 0;  // Score verifyFingerprint() reported
+        int templateScore = 0; // FingerprintTemplate::match(probe, enrolled)
+    };
+
+    // device must be started in library mode (no reader ids); replay plays into its reader
+    LibraryScorer(DeviceWorker* device, CaptureReplay* replay, QObject* parent = nullptr);
+
+    void setSubjects(const QVector<Subject>& subjects) { m_subjects = subjects; }
+    void start(); // Opens the reader, then finished()
+
+    const QVector<PairScore>& scores() const { return m_scores; }
+    int enrolledSubjects() const;
+    int skippedFrames() const { return m_skippedFrames; } // Unreadable or failed to enroll/scan
+    QString getLastError() const { return m_lastError; }
+
+signals:
+    void progress(int done, int total); // Verify calls
+    void finished(bool ok);
+
+private slots:
+    void onReaderInitialized(bool ok, const QString& error);
+    void onEnrollmentStarted(bool ok, const QString& error);
+    void onEnrollmentSampleFinished(int result, const QString& message, const QByteArray& templateData, const QString& error);
+    void onVerifyFinished(bool matched, int score, const QString& error);
+    void onStalled();
+
+private:
+    struct Probe {
+        int subject;
+        QString frame;
+        FingerprintTemplate fingerprint; // Enrolled from this frame alone, invalid when that failed
+    };
+
+    void enrollNext();
+    void verifyNext();
+    void finish(bool ok, const QString& error = QString());
+
+    DeviceWorker* m_device;
+    CaptureReplay* m_replay;
+    QVector<Subject> m_subjects;
+    QVector<QByteArray> m_templates; // Per subject, empty when enrollment failed
+    QVector<FingerprintTemplate> m_decoded; // m_templates for the in-process matcher
+    QVector<Probe> m_probes;
+    QVector<PairScore> m_scores;
+    QTimer m_watchdog; // A capture the virtual reader never answers ends the run
+
+    int m_enrolling;   // Index into subjects, then subjects + probes
+    int m_probe;       // Verify position: probe and subject
+    int m_subject;
+    int m_verifyTotal;
+    int m_verifyDone;
+    int m_skippedFrames;
+    bool m_running;
+    bool m_nudged; // One extra frame was already sent for the stalled capture
+    QString m_lastError;
+};
+
+#endif // LIBRARY_SCORER_H
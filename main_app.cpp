@@ -1,4 +1,7 @@
 #include "mainwindow_app.h"
+#include "capture_replay.h"
+#include "trace.h"
+#include "metrics_server.h"
 #include <QApplication>
 #include <QDebug>
 #include <glib.h>
@@ -8,6 +11,14 @@ int main(int argc, char *argv[])
     // Disable fatal warnings from GLib/libfprint to prevent crashes on non-critical warnings
     g_log_set_always_fatal((GLogLevelFlags)G_LOG_LEVEL_ERROR);
 
+    // Keep Qt off the GLib event dispatcher: the device thread owns the default
+    // GMainContext that libfprint's synchronous calls iterate (see DeviceWorker)
+    qputenv("QT_NO_GLIB", "1");
+
+    // FP_REPLAY_DIR swaps the reader for libfprint's virtual_image driver;
+    // must happen before libfprint reads its environment
+    bool replay = CaptureReplay::prepareEnvironment();
+
     QApplication app(argc, argv);
     app.setOrganizationName("Arkana");
     app.setOrganizationDomain("arkana.co.id");
@@ -16,12 +27,26 @@ int main(int argc, char *argv[])
     qInfo() << "=================================================";
     qInfo() << "U.are.U 4500 Fingerprint Application";
     qInfo() << "Using DigitalPersona Library v" << DigitalPersona::version();
+    if (replay) {
+        qInfo() << "Capture replay from" << qEnvironmentVariable("FP_REPLAY_DIR");
+    }
     qInfo() << "=================================================";
     qInfo() << "";
     
+    Trace::configureFromEnvironment();
+    Trace::setThreadName("Main");
+
+    // FP_METRICS_PORT=9464 serves Prometheus metrics on localhost
+    MetricsServer metricsServer;
+    if (!metricsServer.listenFromEnvironment()) {
+        qWarning() << metricsServer.getLastError();
+    }
+
     MainWindowApp window;
     window.show();
     
-    return app.exec();
+    int rc = app.exec();
+    Trace::writeAtExit();
+    return rc;
 }
 
@@ -1,43 +1,94 @@
 #include "mainwindow_app.h"
 #include "database_config_dialog.h"
 #include "identification_dialog.h"
+#include "enrollment_preview.h"
+#include "verify_template_cache.h"
+#include "access_log.h"
+#include "trace.h"
+#include "metrics.h"
 #include <QApplication>
 #include <QMessageBox>
 #include <QDateTime>
 #include <QDebug>
 #include <QScrollBar>
-#include <QPainter>
 #include <QPixmap>
 #include <QMetaObject>
 #include <QGridLayout>
-#include <QRadialGradient>
+#include <QFileDialog>
+#include <QFile>
+#include <QSaveFile>
+#include <QFutureWatcher>
+#include <QElapsedTimer>
 #include <QtConcurrent>
+#include <QShortcut>
+
+namespace {
+
+// result: saved or failed
+void recordEnrollment(const char* result)
+{
+    Metrics::counter("fp_enrollments_total", "Enrollment sessions by outcome.",
+                     QString("result=\"%1\"").arg(result))->increment();
+}
+
+// result: match, no_match or error
+void recordVerification(const char* result)
+{
+    Metrics::counter("fp_verifications_total", "1:1 verifications by outcome.",
+                     QString("result=\"%1\"").arg(result))->increment();
+}
+
+} // namespace
 
 MainWindowApp::MainWindowApp(QWidget *parent)
     : QMainWindow(parent)
-    , m_fpManager(new FingerprintManager())
+    , m_device(new DeviceWorker(this))
+    , m_replay(nullptr)
     , m_dbManager(new DatabaseManager(this))
+    , m_gallery(new TemplateGallery(m_dbManager, this))
+    , m_userModel(new UserListModel(m_dbManager, this))
+    , m_preview(new EnrollmentPreview(this))
+    , m_startup(nullptr)
+    , m_accessLog(new AccessLog(m_dbManager, 4096, this))
     , m_enrollmentInProgress(false)
     , m_enrollmentSampleCount(0)
+    , m_verifyCache(new VerifyTemplateCache(m_dbManager, 32, this))
 {
     setupUI();
     setWindowTitle("U.are.U 4500 Fingerprint Application - DigitalPersona");
     resize(1200, 750);
 
-    // Setup enrollment progress callback
-    m_fpManager->setProgressCallback([this](int current, int total, QString message) {
-        // Use AutoConnection to ensure immediate UI updates on both Mac and Linux
-        // since we are running synchronously on the main thread.
-        // QueuedConnection would wait until the blocking call finishes, freezing the UI on Mac.
-        QMetaObject::invokeMethod(this, [this, current, total, message]() {
-            onEnrollmentProgress(current, total, message);
-        }, Qt::AutoConnection);
-    });
+    // All libfprint work runs on the device thread; results arrive as queued signals
+    connect(m_device, &DeviceWorker::readerInitialized, this, &MainWindowApp::onReaderInitialized);
+    connect(m_device, &DeviceWorker::enrollmentStarted, this, &MainWindowApp::onEnrollmentStarted);
+    connect(m_device, &DeviceWorker::enrollmentProgress, this, &MainWindowApp::onEnrollmentProgress);
+    connect(m_device, &DeviceWorker::enrollmentSampleFinished, this, &MainWindowApp::onEnrollmentSampleFinished);
+    connect(m_device, &DeviceWorker::verifyFinished, this, &MainWindowApp::onVerifyFinished);
+    m_device->start();
+    m_accessLog->start();
+
+    // Hardware-free mode: recorded frames are played into the virtual reader per capture
+    if (CaptureReplay::isEnabled()) {
+        m_replay = new CaptureReplay(this);
+        if (!m_replay->configureFromEnvironment()) {
+            log(QString("❌ Capture replay: %1").arg(m_replay->getLastError()));
+        } else {
+            log(QString("Capture replay active: %1 frames").arg(m_replay->imageCount()));
+        }
+        connect(m_device, &DeviceWorker::captureStarted, m_replay, &CaptureReplay::onCaptureStarted);
+        connect(m_device, &DeviceWorker::enrollmentProgress, m_replay, &CaptureReplay::onEnrollmentProgress);
+        connect(m_replay, &CaptureReplay::replayError, this, [this](const QString& error) {
+            qWarning() << "Capture replay:" << error;
+        });
+    }
 
-    // Connect watcher - restored for macOS async handling
-    connect(&m_enrollWatcher, &QFutureWatcher<int>::finished, this, &MainWindowApp::onCaptureEnrollFinished);
+    // Enrollments and deletions made by other clients of a shared database
+    connect(m_gallery, &TemplateGallery::changesSynced, this, [this](int changed) {
+        log(QString("Synced %1 change(s) from the database").arg(changed));
+        updateUserList();
+    });
 
-    // Initialize database with configuration dialog
+    // Database configuration is needed before anything can start
     if (!DatabaseConfigDialog::hasConfig()) {
         DatabaseConfigDialog dlg(this);
         if (dlg.exec() != QDialog::Accepted) {
@@ -49,55 +100,46 @@ MainWindowApp::MainWindowApp(QWidget *parent)
             return;
         }
     }
-    
-    DatabaseConfigDialog::Config dbConfig = DatabaseConfigDialog::loadConfig();
-    if (!m_dbManager->initialize(dbConfig)) {
-        QMessageBox::critical(this, "Database Error", 
-            QString("Failed to initialize database: %1").arg(m_dbManager->getLastError()));
-        
-        // Offer to reconfigure
-        if (QMessageBox::question(this, "Retry?", "Would you like to reconfigure database?") == QMessageBox::Yes) {
-             DatabaseConfigDialog dlg(this);
-             if (dlg.exec() == QDialog::Accepted) {
-                 dbConfig = DatabaseConfigDialog::loadConfig();
-                 if (m_dbManager->initialize(dbConfig)) {
-                     goto db_success;
-                 }
-             }
-        }
-        updateStatus("Database initialization failed", true);
-    } else {
-db_success:
-        log("Database initialized successfully");
-        qDebug() << "Calling updateUserList()...";
-        updateUserList();
-        qDebug() << "updateUserList() returned.";
-    }
+
+    // The window shows right away; database, gallery and reader come up behind it
+    m_startup = new StartupOrchestrator(m_dbManager, m_gallery, m_device, this);
+    connect(m_startup, &StartupOrchestrator::subsystemReady, this, &MainWindowApp::onSubsystemReady);
+    connect(m_startup, &StartupOrchestrator::terminalReady, this, [this](qint64 elapsedMs) {
+        log(QString("Terminal ready in %1 ms").arg(elapsedMs));
+        updateStatus("Ready", false);
+    });
+
+    updateStatus("Starting...", false);
+    m_btnConfig->setEnabled(false); // Until the database settles, see onSubsystemReady
+    m_btnInitialize->setEnabled(false);
+    m_readerStatusLabel->setText("Reader: Opening...");
+    m_startup->start(DatabaseConfigDialog::loadConfig());
 }
 
 MainWindowApp::~MainWindowApp()
 {
     // Explicit cleanup in closeEvent is preferred, but just in case
-    if (m_fpManager) {
-        m_fpManager->cleanup();
-        delete m_fpManager;
-        m_fpManager = nullptr;
-    }
+    m_device->shutdown();
+    m_accessLog->stop();
+    if (m_startup) m_startup->waitForFinished();
+    m_verifyCache->waitForPrefetch();
+    m_transfer.waitForFinished();
+    m_userModel->waitForSearch();
+    m_gallery->waitForLoad();
+    m_gallery->flushCache();
 }
 
 void MainWindowApp::closeEvent(QCloseEvent *event)
 {
-    // Ensure thread is done
-    /* 
-    if (m_enrollWatcher.isRunning()) {
-        m_enrollWatcher.waitForFinished();
-    }
-    */
-    
-    if (m_fpManager) {
-        log("Application closing, cleaning up...");
-        m_fpManager->cleanup();
-    }
+    log("Application closing, cleaning up...");
+    m_device->shutdown();
+    m_accessLog->stop(); // After the device, whose last result may still record
+    if (m_startup) m_startup->waitForFinished();
+    m_verifyCache->waitForPrefetch();
+    m_transfer.waitForFinished();
+    m_userModel->waitForSearch();
+    m_gallery->waitForLoad();
+    m_gallery->flushCache();
     
     QMainWindow::closeEvent(event);
 }
@@ -306,10 +348,22 @@ void MainWindowApp::setupUI()
     m_userCountLabel = new QLabel("Total users: 0");
     m_userCountLabel->setStyleSheet("QLabel { font-weight: bold; font-size: 12px; color: #2196F3; padding: 5px; }");
     userListLayout->addWidget(m_userCountLabel);
-    
-    m_userList = new QListWidget();
-    m_userList->setStyleSheet("QListWidget { border: 2px solid #ccc; border-radius: 5px; padding: 5px; } QListWidget::item { padding: 8px; border-bottom: 1px solid #eee; } QListWidget::item:selected { background-color: #e3f2fd; color: black; }");
+
+    m_searchEdit = new QLineEdit();
+    m_searchEdit->setPlaceholderText("Search name or email...");
+    m_searchEdit->setClearButtonEnabled(true);
+    m_searchEdit->setStyleSheet("QLineEdit { padding: 6px; font-size: 12px; }");
+    userListLayout->addWidget(m_searchEdit);
+    m_searchTimer.setSingleShot(true);
+    m_searchTimer.setInterval(150);
+    
+    m_userList = new QListView();
+    m_userList->setStyleSheet("QListView { border: 2px solid #ccc; border-radius: 5px; padding: 5px; } QListView::item { padding: 8px; border-bottom: 1px solid #eee; } QListView::item:selected { background-color: #e3f2fd; color: black; }");
     m_userList->setMinimumHeight(250);
+    m_userList->setModel(m_userModel);
+    m_userList->setSelectionMode(QAbstractItemView::SingleSelection);
+    m_userList->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    m_userList->setUniformItemSizes(true); // Lets the view skip measuring every row
     userListLayout->addWidget(m_userList);
     
     QHBoxLayout* userButtonsLayout = new QHBoxLayout();
@@ -328,6 +382,21 @@ void MainWindowApp::setupUI()
     
     userListLayout->addLayout(userButtonsLayout);
     
+    QHBoxLayout* transferButtonsLayout = new QHBoxLayout();
+    transferButtonsLayout->setSpacing(8);
+    
+    m_btnImportUsers = new QPushButton("Import...");
+    m_btnImportUsers->setStyleSheet("QPushButton { padding: 6px; font-size: 11px; background-color: #607d8b; color: white; } QPushButton:hover { background-color: #546e7a; } QPushButton:disabled { background-color: #ccc; }");
+    m_btnImportUsers->setToolTip("Import users and templates from an archive");
+    transferButtonsLayout->addWidget(m_btnImportUsers);
+    
+    m_btnExportUsers = new QPushButton("Export...");
+    m_btnExportUsers->setStyleSheet("QPushButton { padding: 6px; font-size: 11px; background-color: #607d8b; color: white; } QPushButton:hover { background-color: #546e7a; } QPushButton:disabled { background-color: #ccc; }");
+    m_btnExportUsers->setToolTip("Export all users and templates to an archive");
+    transferButtonsLayout->addWidget(m_btnExportUsers);
+    
+    userListLayout->addLayout(transferButtonsLayout);
+    
     rightLayout->addWidget(m_userListGroup);
 
     // Log section
@@ -368,9 +437,25 @@ void MainWindowApp::setupUI()
     connect(m_btnCaptureVerify, &QPushButton::clicked, this, &MainWindowApp::onCaptureVerifySample);
     connect(m_btnRefreshList, &QPushButton::clicked, this, &MainWindowApp::onRefreshUserList);
     connect(m_btnDeleteUser, &QPushButton::clicked, this, &MainWindowApp::onDeleteUserClicked);
+    connect(m_btnImportUsers, &QPushButton::clicked, this, &MainWindowApp::onImportUsersClicked);
+    connect(m_btnExportUsers, &QPushButton::clicked, this, &MainWindowApp::onExportUsersClicked);
     connect(m_btnClearLog, &QPushButton::clicked, this, &MainWindowApp::onClearLog);
     connect(m_btnConfig, &QPushButton::clicked, this, &MainWindowApp::onConfigClicked);
-    connect(m_userList, &QListWidget::itemClicked, this, &MainWindowApp::onUserSelected);
+    connect(m_userList->selectionModel(), &QItemSelectionModel::selectionChanged, this, &MainWindowApp::onUserSelectionChanged);
+    connect(m_userModel, &UserListModel::totalCountChanged, this, &MainWindowApp::updateUserCountLabel);
+
+    // Start tracing, then press again to save what was recorded
+    QShortcut* traceShortcut = new QShortcut(QKeySequence("Ctrl+Shift+T"), this);
+    connect(traceShortcut, &QShortcut::activated, this, &MainWindowApp::onToggleTrace);
+    connect(m_searchEdit, &QLineEdit::textChanged, &m_searchTimer, qOverload<>(&QTimer::start));
+    connect(&m_searchTimer, &QTimer::timeout, this, [this]() {
+        m_userModel->setSearchTerm(m_searchEdit->text());
+    });
+    connect(m_userModel, &UserListModel::searchFinished, this, [this](const QString& term, int rows, qint64 elapsedMs) {
+        qDebug() << "User search" << term << "->" << rows << "rows in" << elapsedMs << "ms";
+        m_btnDeleteUser->setEnabled(false);
+        updateUserCountLabel();
+    });
 }
 
 void MainWindowApp::onConfigClicked()
@@ -393,6 +478,7 @@ void MainWindowApp::onRunMigration()
         log("✓ Migrations completed successfully.");
         QMessageBox::information(this, "Migrations", "Database migrations completed successfully.");
         updateUserList();
+        loadGallery();
     } else {
         log(QString("❌ Migration failed: %1").arg(m_dbManager->getLastError()));
         QMessageBox::critical(this, "Migration Error", m_dbManager->getLastError());
@@ -403,34 +489,78 @@ void MainWindowApp::reinitDatabase()
 {
     log("Re-initializing database connection...");
     DatabaseConfigDialog::Config config = DatabaseConfigDialog::loadConfig();
+    m_gallery->waitForLoad(); // Background reads use the connection being replaced
+    m_verifyCache->waitForPrefetch();
+    m_verifyCache->clear();
     
     if (m_dbManager->initialize(config)) {
         log("✓ Database re-initialized successfully.");
         updateUserList();
+        loadGallery();
         updateStatus("Database Connected", false);
     } else {
+        m_gallery->clear();
         log(QString("❌ Database init failed: %1").arg(m_dbManager->getLastError()));
         updateStatus("Database Connection Failed", true);
         QMessageBox::critical(this, "Database Error", "Failed to re-initialize database.\n" + m_dbManager->getLastError());
     }
 }
 
+void MainWindowApp::onSubsystemReady(StartupOrchestrator::Subsystem subsystem, bool ok, const QString& error, qint64 elapsedMs)
+{
+    switch (subsystem) {
+    case StartupOrchestrator::Database:
+        m_btnConfig->setEnabled(true);
+        if (!ok) {
+            log(QString("❌ Database init failed: %1").arg(error));
+            updateStatus("Database initialization failed", true);
+            QMessageBox::critical(this, "Database Error", QString("Failed to initialize database: %1").arg(error));
+            // Offer to reconfigure
+            if (QMessageBox::question(this, "Retry?", "Would you like to reconfigure database?") == QMessageBox::Yes) {
+                onConfigClicked();
+            }
+            return;
+        }
+        log(QString("Database initialized successfully (%1 ms)").arg(elapsedMs));
+        updateUserList();
+        break;
+    case StartupOrchestrator::Gallery:
+        if (ok) {
+            log(QString("Template gallery loaded: %1 templates (%2 ms)").arg(m_gallery->size()).arg(elapsedMs));
+        } else {
+            log(QString("❌ Failed to load template gallery: %1").arg(error));
+        }
+        break;
+    case StartupOrchestrator::Reader:
+        if (ok) log(QString("Reader opened at startup (%1 ms)").arg(elapsedMs));
+        break;
+    default:
+        break;
+    }
+}
+
 void MainWindowApp::onInitializeClicked()
 {
     log("Initializing fingerprint reader using DigitalPersona Library...");
     log(QString("Library version: %1").arg(DigitalPersona::version()));
     
-    if (!m_fpManager->initialize()) {
-        updateStatus("Initialization failed", true);
-        log(QString("Error: %1").arg(m_fpManager->getLastError()));
-        QMessageBox::critical(this, "Error", m_fpManager->getLastError());
-        return;
-    }
-    
-    if (!m_fpManager->openReader()) {
+    m_btnInitialize->setEnabled(false);
+    m_readerStatusLabel->setText("Reader: Opening...");
+    m_device->initializeReader();
+}
+
+void MainWindowApp::onReaderInitialized(bool ok, const QString& error)
+{
+    if (!ok) {
         updateStatus("Failed to open reader", true);
-        log(QString("Error: %1").arg(m_fpManager->getLastError()));
-        QMessageBox::critical(this, "Error", m_fpManager->getLastError());
+        log(QString("Error: %1").arg(error));
+        m_readerStatusLabel->setText("Reader: Not connected");
+        m_btnInitialize->setEnabled(true);
+        // No dialog for the automatic open at startup, the reader may simply be unplugged
+        // (this slot is connected before the orchestrator's, which is still pending here)
+        if (!m_startup || !m_startup->isPending(StartupOrchestrator::Reader)) {
+            QMessageBox::critical(this, "Error", error);
+        }
         return;
     }
     
@@ -460,45 +590,32 @@ void MainWindowApp::onEnrollClicked()
         return;
     }
     
-    if (!m_fpManager->startEnrollment()) {
-        QMessageBox::critical(this, "Error", m_fpManager->getLastError());
+    m_enrollmentUserName = name;
+    m_enrollmentUserEmail = email;
+    m_btnStartEnroll->setEnabled(false);
+    m_device->startEnrollment();
+}
+
+void MainWindowApp::onEnrollmentStarted(bool ok, const QString& error)
+{
+    if (!ok) {
+        m_btnStartEnroll->setEnabled(m_device->isReaderOpen());
+        QMessageBox::critical(this, "Error", error);
         return;
     }
     
     m_enrollmentInProgress = true;
     m_enrollmentSampleCount = 0;
-    m_enrollmentUserName = name;
-    m_enrollmentUserEmail = email;
     
     // Reset progress bar and preview
     m_enrollProgress->setValue(0);
     m_enrollProgress->setFormat("0/5 scans (0%)");
     m_enrollStatusLabel->setText("Enrollment started. Click 'Capture Fingerprint' to begin scanning.");
     
-    // Create initial "Ready to scan" preview
-    QImage readyImage(180, 180, QImage::Format_RGB888);
-    readyImage.fill(QColor(250, 250, 250));
-    QPainter painter(&readyImage);
-    painter.setRenderHint(QPainter::Antialiasing);
-    
-    // Draw background
-    QRadialGradient gradient(90, 90, 80);
-    gradient.setColorAt(0, QColor(245, 245, 250));
-    gradient.setColorAt(1, QColor(230, 230, 240));
-    painter.fillRect(readyImage.rect(), gradient);
-    
-    // Draw ready indicator
-    painter.setPen(QPen(QColor(150, 150, 150), 2));
-    painter.drawEllipse(QPoint(90, 90), 60, 60);
-    painter.drawEllipse(QPoint(90, 90), 40, 40);
+    m_enrollImagePreview->setPixmap(m_preview->readyFrame());
     
-    painter.setPen(QColor(100, 100, 100));
-    painter.setFont(QFont("Arial", 12, QFont::Bold));
-    painter.drawText(readyImage.rect(), Qt::AlignCenter, "Ready\nto Scan");
-    
-    m_enrollImagePreview->setPixmap(QPixmap::fromImage(readyImage));
-    
-    log(QString("Starting enrollment for: %1 %2").arg(name).arg(email.isEmpty() ? "" : "(" + email + ")"));
+    log(QString("Starting enrollment for: %1 %2").arg(m_enrollmentUserName)
+        .arg(m_enrollmentUserEmail.isEmpty() ? "" : "(" + m_enrollmentUserEmail + ")"));
     
     enableEnrollmentControls(false);
     m_btnCaptureEnroll->setEnabled(true);
@@ -514,42 +631,32 @@ void MainWindowApp::onCaptureEnrollSample()
     m_enrollStatusLabel->setText("Place your finger on the reader. You will scan 5 times...");
     log("=== ENROLLMENT: Starting capture sequence ===");
     
-#ifdef Q_OS_MACOS
-    // On macOS, running synchronously blocks the UI too much despite processEvents.
-    // We run in a background thread to keep UI responsive.
-    QFuture<int> future = QtConcurrent::run([this]() {
-        int quality;
-        // We write to members here, which is safe because we read them only after future finishes
-        return m_fpManager->addEnrollmentSample(m_tempEnrollMessage, quality, &m_tempEnrollImage);
-    });
-    m_enrollWatcher.setFuture(future);
-#else
-    // Linux implementation (Main Thread Synchronous)
-    // This prevents "scan hang" issues seen on Linux with threading.
-    QApplication::processEvents();
-    
-    int quality;
-    int result = m_fpManager->addEnrollmentSample(m_tempEnrollMessage, quality, &m_tempEnrollImage);
-    
-    // Handle result immediately
-    processEnrollmentResult(result);
-#endif
+    m_device->captureEnrollmentSample();
+}
+
+void MainWindowApp::resetEnrollment(const QString& statusText)
+{
+    m_device->cancelEnrollment();
+    m_enrollmentInProgress = false;
+    m_enrollProgress->setValue(0);
+    m_enrollProgress->setFormat("0/5 scans (0%)");
+    m_enrollStatusLabel->setText(statusText);
+    m_enrollImagePreview->clear();
+    m_enrollImagePreview->setText("No scan yet");
+    enableEnrollmentControls(true);
 }
 
-void MainWindowApp::processEnrollmentResult(int result)
+void MainWindowApp::onEnrollmentSampleFinished(int result, const QString& message, const QByteArray& templateData, const QString& error)
 {
-    QString message = m_tempEnrollMessage;
+    if (!m_enrollmentInProgress) {
+        return;
+    }
     
     if (result < 0) {
-        log(QString("ERROR: %1").arg(m_fpManager->getLastError()));
-        m_enrollStatusLabel->setText("Capture failed");
-        m_enrollmentInProgress = false;
-        m_enrollProgress->setValue(0);
-        m_enrollProgress->setFormat("0/5 scans (0%)");
-        m_enrollImagePreview->clear();
-        m_enrollImagePreview->setText("No scan yet");
-        enableEnrollmentControls(true);
-        QMessageBox::critical(this, "Enrollment Error", m_fpManager->getLastError());
+        log(QString("ERROR: %1").arg(error));
+        recordEnrollment("failed");
+        resetEnrollment("Capture failed");
+        QMessageBox::critical(this, "Enrollment Error", error);
         return;
     }
     
@@ -560,91 +667,71 @@ void MainWindowApp::processEnrollmentResult(int result)
     if (result == 1) {
         log("All scans completed! Saving fingerprint template to database...");
         
-        QByteArray templateData;
-        if (!m_fpManager->createEnrollmentTemplate(templateData)) {
-            QMessageBox::critical(this, "Error", "Failed to create fingerprint template");
+        if (templateData.isEmpty()) {
+            QMessageBox::critical(this, "Error", error.isEmpty() ? QString("Failed to create fingerprint template") : error);
             log("Error creating template");
-            m_fpManager->cancelEnrollment();
-            m_enrollmentInProgress = false;
-            m_enrollProgress->setValue(0);
-            m_enrollProgress->setFormat("0/5 scans (0%)");
-            m_enrollImagePreview->clear();
-            m_enrollImagePreview->setText("No scan yet");
-            enableEnrollmentControls(true);
+            recordEnrollment("failed");
+            resetEnrollment("Ready to enroll");
             return;
         }
         
         log(QString("Template created, size: %1 bytes").arg(templateData.size()));
         
-        int userId;
-        if (!m_dbManager->addUser(m_enrollmentUserName, m_enrollmentUserEmail, templateData, userId)) {
-            QMessageBox::critical(this, "Database Error", 
-                QString("Failed to save user:\n%1").arg(m_dbManager->getLastError()));
-            log(QString("❌ Database error: %1").arg(m_dbManager->getLastError()));
-        } else {
-            log(QString("User enrolled successfully: %1 (ID: %2)").arg(m_enrollmentUserName).arg(userId));
-            QMessageBox::information(this, "Enrollment Complete", 
-                QString("User '%1' enrolled successfully!\n\nUser ID: %2\nTemplate size: %3 bytes\nScans completed: 5")
-                    .arg(m_enrollmentUserName)
-                    .arg(userId)
-                    .arg(templateData.size()));
-            updateUserList();
-            
-            m_editEnrollName->clear();
-            m_editEnrollEmail->clear();
-        }
-        
-        log("Cleaning up enrollment session...");
-        m_fpManager->cancelEnrollment();
-        m_enrollmentInProgress = false;
-        m_enrollProgress->setValue(0);
-        m_enrollProgress->setFormat("0/5 scans (0%)");
-        m_enrollStatusLabel->setText("Ready to enroll next user");
-        
-        // Reset preview to empty state
-        QImage emptyImage(180, 180, QImage::Format_RGB888);
-        emptyImage.fill(QColor(250, 250, 250));
-        QPainter painter(&emptyImage);
-        painter.setRenderHint(QPainter::Antialiasing);
-        
-        QRadialGradient gradient(90, 90, 80);
-        gradient.setColorAt(0, QColor(245, 245, 250));
-        gradient.setColorAt(1, QColor(230, 230, 240));
-        painter.fillRect(emptyImage.rect(), gradient);
-        
-        painter.setPen(QColor(150, 150, 150));
-        painter.setFont(QFont("Arial", 11));
-        painter.drawText(emptyImage.rect(), Qt::AlignCenter, "No scan yet");
-        
-        m_enrollImagePreview->setPixmap(QPixmap::fromImage(emptyImage));
-        
-        enableEnrollmentControls(true);
-        log("=== ENROLLMENT SESSION COMPLETED ===");
+        saveEnrollment(templateData);
     } else {
         // If result is 0 (more scans needed), re-enable the capture button
          m_btnCaptureEnroll->setEnabled(true);
     }
 }
 
-void MainWindowApp::onCaptureEnrollFinished()
+void MainWindowApp::saveEnrollment(const QByteArray& templateData)
 {
-    processEnrollmentResult(m_enrollWatcher.result());
+    int userId;
+    if (!m_dbManager->addUser(m_enrollmentUserName, m_enrollmentUserEmail, templateData, userId)) {
+        QMessageBox::critical(this, "Database Error", 
+            QString("Failed to save user:\n%1").arg(m_dbManager->getLastError()));
+        log(QString("❌ Database error: %1").arg(m_dbManager->getLastError()));
+        recordEnrollment("failed");
+    } else {
+        recordEnrollment("saved");
+        log(QString("User enrolled successfully: %1 (ID: %2)").arg(m_enrollmentUserName).arg(userId));
+        QMessageBox::information(this, "Enrollment Complete", 
+            QString("User '%1' enrolled successfully!\n\nUser ID: %2\nTemplate size: %3 bytes\nScans completed: 5")
+                .arg(m_enrollmentUserName)
+                .arg(userId)
+                .arg(templateData.size()));
+        
+        m_editEnrollName->clear();
+        m_editEnrollEmail->clear();
+    }
+    
+    log("Cleaning up enrollment session...");
+    m_device->cancelEnrollment();
+    m_enrollmentInProgress = false;
+    m_enrollProgress->setValue(0);
+    m_enrollProgress->setFormat("0/5 scans (0%)");
+    m_enrollStatusLabel->setText("Ready to enroll next user");
+    
+    m_enrollImagePreview->setPixmap(m_preview->emptyFrame());
+    
+    enableEnrollmentControls(true);
+    log("=== ENROLLMENT SESSION COMPLETED ===");
 }
 
 void MainWindowApp::onIdentifyClicked()
 {
-    if (!m_fpManager->isReaderOpen()) {
+    if (!m_device->isReaderOpen()) {
         QMessageBox::warning(this, "Reader Not Ready", "Please initialize the reader first.");
         return;
     }
     
-    IdentificationDialog dlg(m_fpManager, m_dbManager, this);
+    IdentificationDialog dlg(m_device, m_dbManager, m_gallery, m_accessLog, this);
     dlg.exec();
 }
 
 void MainWindowApp::onVerifyClicked()
 {
-    if (m_userList->selectedItems().isEmpty()) {
+    if (selectedUserId() < 0) {
         QMessageBox::warning(this, "Selection Required", "Please select a user from the list");
         return;
     }
@@ -658,7 +745,8 @@ void MainWindowApp::onVerifyClicked()
 
 void MainWindowApp::onCaptureVerifySample()
 {
-    if (m_userList->selectedItems().isEmpty()) {
+    int userId = selectedUserId();
+    if (userId < 0) {
         return;
     }
     
@@ -667,26 +755,31 @@ void MainWindowApp::onCaptureVerifySample()
     m_verifyResultLabel->setText("Capturing...");
     m_verifyScoreLabel->setText("Please wait...");
     
-    QApplication::processEvents();
-    
-    QListWidgetItem* item = m_userList->selectedItems().first();
-    int userId = item->data(Qt::UserRole).toInt();
-    
-    User user;
-    if (!m_dbManager->getUserById(userId, user)) {
+    if (!m_verifyCache->get(userId, m_verifyUser)) {
         QMessageBox::critical(this, "Error", "Failed to load user data");
         log("❌ Failed to load user data");
         m_btnStartVerify->setEnabled(true);
         return;
     }
     
-    log(QString("Verifying against: %1").arg(user.name));
-    
-    int score = 0;
-    bool matched = m_fpManager->verifyFingerprint(user.fingerprintTemplate, score);
+    log(QString("Verifying against: %1").arg(m_verifyUser.name));
+    m_verifyTimer.start();
+    m_device->verify(m_verifyUser.fingerprintTemplate);
+}
+
+void MainWindowApp::onVerifyFinished(bool matched, int score, const QString& error)
+{
+    const User& user = m_verifyUser;
+
+    // Capture click to result, finger wait included
+    static Metrics::Histogram* const latency = Metrics::histogram(
+        "fp_verification_seconds", "Verification time from capture to result in the main window.");
+    qint64 elapsed = m_verifyTimer.nsecsElapsed();
+    latency->observeNanoseconds(elapsed);
     
     if (!matched && score == 0) {
-        QString error = m_fpManager->getLastError();
+        recordVerification("error");
+        m_accessLog->record("verify", "error", user.id, score, elapsed);
         log(QString("Verification error: %1").arg(error));
         m_verifyResultLabel->setText("Result: ERROR");
         m_verifyResultLabel->setStyleSheet("QLabel { background-color: #ffcccc; color: red; padding: 5px; font-weight: bold; }");
@@ -695,6 +788,9 @@ void MainWindowApp::onCaptureVerifySample()
     } else {
         m_verifyScoreLabel->setText(QString("Match Score: %1%").arg(score));
         
+        const char* result = score >= 60 ? "match" : "no_match";
+        recordVerification(result);
+        m_accessLog->record("verify", result, user.id, score, elapsed);
         if (score >= 60) {
             m_verifyResultLabel->setText(QString("MATCH: %1").arg(user.name));
             m_verifyResultLabel->setStyleSheet("QLabel { background-color: #c8e6c9; color: green; padding: 10px; font-weight: bold; font-size: 14px; }");
@@ -712,6 +808,7 @@ void MainWindowApp::onCaptureVerifySample()
     }
     
     m_btnStartVerify->setEnabled(true);
+    m_verifyCache->prefetch(user.id); // Revalidate for a repeat attempt
     log("=== VERIFICATION COMPLETED ===");
 }
 
@@ -720,20 +817,32 @@ void MainWindowApp::onRefreshUserList()
     updateUserList();
 }
 
-void MainWindowApp::onUserSelected(QListWidgetItem* item)
+void MainWindowApp::onUserSelectionChanged()
 {
-    m_btnDeleteUser->setEnabled(item != nullptr);
+    int userId = selectedUserId();
+    m_btnDeleteUser->setEnabled(userId >= 0);
+    // Template is read while the operator reaches for the reader
+    m_verifyCache->prefetch(userId);
+}
+
+int MainWindowApp::selectedUserId() const
+{
+    QModelIndexList selected = m_userList->selectionModel()->selectedIndexes();
+    if (selected.isEmpty()) {
+        return -1;
+    }
+    return selected.first().data(UserListModel::UserIdRole).toInt();
 }
 
 void MainWindowApp::onDeleteUserClicked()
 {
-    if (m_userList->selectedItems().isEmpty()) {
+    QModelIndexList selected = m_userList->selectionModel()->selectedIndexes();
+    if (selected.isEmpty()) {
         return;
     }
     
-    QListWidgetItem* item = m_userList->selectedItems().first();
-    int userId = item->data(Qt::UserRole).toInt();
-    QString userName = item->text().section(" - ", 0, 0);
+    int userId = selected.first().data(UserListModel::UserIdRole).toInt();
+    QString userName = selected.first().data(UserListModel::NameRole).toString();
     
     auto reply = QMessageBox::question(this, "Confirm Delete", 
         QString("Are you sure you want to delete user '%1'?").arg(userName),
@@ -742,7 +851,6 @@ void MainWindowApp::onDeleteUserClicked()
     if (reply == QMessageBox::Yes) {
         if (m_dbManager->deleteUser(userId)) {
             log(QString("User deleted: %1").arg(userName));
-            updateUserList();
         } else {
             QMessageBox::critical(this, "Error", 
                 QString("Failed to delete user: %1").arg(m_dbManager->getLastError()));
@@ -750,6 +858,119 @@ void MainWindowApp::onDeleteUserClicked()
     }
 }
 
+void MainWindowApp::onImportUsersClicked()
+{
+    QString fileName = QFileDialog::getOpenFileName(this, "Import Users", QString(), "User archives (*.fpusers);;All files (*)");
+    if (fileName.isEmpty()) return;
+
+    DatabaseManager* dbManager = m_dbManager;
+    runUserTransfer("Import", [this, dbManager, fileName]() {
+        UserTransferResult result;
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly)) {
+            result.error = file.errorString();
+            return result;
+        }
+        result.ok = dbManager->importUsers(&file, result.count, [this](int count) {
+            QMetaObject::invokeMethod(this, [this, count]() {
+                updateStatus(QString("Importing... %1 users").arg(count));
+            }, Qt::QueuedConnection);
+        });
+        if (!result.ok) result.error = dbManager->getLastError(); // Error is per thread
+        return result;
+    });
+}
+
+void MainWindowApp::onExportUsersClicked()
+{
+    QString fileName = QFileDialog::getSaveFileName(this, "Export Users", "users.fpusers", "User archives (*.fpusers)");
+    if (fileName.isEmpty()) return;
+
+    DatabaseManager* dbManager = m_dbManager;
+    runUserTransfer("Export", [this, dbManager, fileName]() {
+        UserTransferResult result;
+        QSaveFile file(fileName);
+        if (!file.open(QIODevice::WriteOnly)) {
+            result.error = file.errorString();
+            return result;
+        }
+        result.ok = dbManager->exportUsers(&file, result.count, [this](int count) {
+            QMetaObject::invokeMethod(this, [this, count]() {
+                updateStatus(QString("Exporting... %1 users").arg(count));
+            }, Qt::QueuedConnection);
+        });
+        if (!result.ok) {
+            result.error = dbManager->getLastError();
+        } else if (!file.commit()) {
+            result.ok = false;
+            result.error = file.errorString();
+        }
+        return result;
+    });
+}
+
+void MainWindowApp::runUserTransfer(const QString& action, std::function<UserTransferResult()> job)
+{
+    if (m_transfer.isRunning()) {
+        QMessageBox::information(this, action, "An import or export is already running.");
+        return;
+    }
+
+    // Runs on a pool thread with its own database connection
+    m_btnImportUsers->setEnabled(false);
+    m_btnExportUsers->setEnabled(false);
+    log(QString("%1 started...").arg(action));
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QFutureWatcher<UserTransferResult>* watcher = new QFutureWatcher<UserTransferResult>(this);
+    connect(watcher, &QFutureWatcher<UserTransferResult>::finished, this, [this, watcher, timer, action]() {
+        UserTransferResult result = watcher->result();
+        qint64 elapsed = timer.elapsed();
+        watcher->deleteLater();
+
+        m_btnImportUsers->setEnabled(true);
+        m_btnExportUsers->setEnabled(true);
+
+        if (result.ok) {
+            log(QString("✓ %1 finished: %2 users in %3 ms").arg(action).arg(result.count).arg(elapsed));
+            updateStatus(QString("%1 complete: %2 users").arg(action).arg(result.count));
+        } else {
+            log(QString("❌ %1 failed: %2").arg(action).arg(result.error));
+            updateStatus(QString("%1 failed").arg(action), true);
+            QMessageBox::critical(this, QString("%1 Error").arg(action), result.error);
+        }
+    });
+
+    m_transfer = QtConcurrent::run(job);
+    watcher->setFuture(m_transfer);
+}
+
+void MainWindowApp::onToggleTrace()
+{
+    if (!Trace::isEnabled()) {
+        Trace::clear();
+        Trace::setEnabled(true);
+        log("Tracing started, press Ctrl+Shift+T again to save the trace");
+        return;
+    }
+
+    Trace::setEnabled(false);
+    QString fileName = QFileDialog::getSaveFileName(this, "Save Trace", "fingerprint-trace.json", "Chrome trace (*.json)");
+    if (fileName.isEmpty()) {
+        log("Tracing stopped");
+        return;
+    }
+
+    QString error;
+    if (Trace::writeChromeTrace(fileName, &error)) {
+        log(QString("✓ Trace saved to %1 (open in ui.perfetto.dev or chrome://tracing)").arg(fileName));
+    } else {
+        log(QString("❌ %1").arg(error));
+    }
+}
+
 void MainWindowApp::onClearLog()
 {
     m_logText->clear();
@@ -775,40 +996,56 @@ void MainWindowApp::log(const QString& message)
 
 void MainWindowApp::updateUserList()
 {
-    m_userList->clear();
-    
-    QVector<User> users = m_dbManager->getAllUsers();
-    
-    for (const User& user : users) {
-        QString displayText = QString("%1 - %2").arg(user.name).arg(user.email.isEmpty() ? "No email" : user.email);
-        QListWidgetItem* item = new QListWidgetItem(displayText);
-        item->setData(Qt::UserRole, user.id);
-        m_userList->addItem(item);
+    TRACE_SCOPE("ui", "updateUserList");
+    // Only the first page is queried, the view pulls more as it scrolls
+    m_userModel->reload();
+    m_btnDeleteUser->setEnabled(false);
+    updateUserCountLabel();
+    log(QString("User list updated: %1 users").arg(m_userModel->totalCount()));
+}
+
+void MainWindowApp::updateUserCountLabel()
+{
+    if (m_userModel->searchTerm().isEmpty()) {
+        m_userCountLabel->setText(QString("Total users: %1").arg(m_userModel->totalCount()));
+    } else {
+        // Matches are paged too, so only say "more" when another page exists
+        int shown = m_userModel->rowCount();
+        m_userCountLabel->setText(QString("Total users: %1 (matches: %2%3)")
+            .arg(m_userModel->totalCount()).arg(shown)
+            .arg(m_userModel->canFetchMore(QModelIndex()) ? "+" : ""));
+    }
+}
+
+void MainWindowApp::loadGallery()
+{
+    m_gallery->applyDatabaseDefaults();
+
+    if (m_gallery->load()) {
+        log(QString("Template gallery loaded: %1 templates").arg(m_gallery->size()));
+    } else {
+        log(QString("❌ Failed to load template gallery: %1").arg(m_dbManager->getLastError()));
     }
-    
-    m_userCountLabel->setText(QString("Total users: %1").arg(users.size()));
-    qDebug() << "Updating user count label done.";
-    log(QString("User list updated: %1 users").arg(users.size()));
-    qDebug() << "Log called.";
 }
 
 void MainWindowApp::enableEnrollmentControls(bool enable)
 {
     m_editEnrollName->setEnabled(enable);
     m_editEnrollEmail->setEnabled(enable);
-    m_btnStartEnroll->setEnabled(enable && m_fpManager->isReaderOpen());
+    m_btnStartEnroll->setEnabled(enable && m_device->isReaderOpen());
     m_btnCaptureEnroll->setEnabled(!enable);
 }
 
 void MainWindowApp::enableVerificationControls(bool enable)
 {
-    m_btnStartVerify->setEnabled(enable && m_fpManager->isReaderOpen());
-    m_btnIdentify->setEnabled(enable && m_fpManager->isReaderOpen());
+    m_btnStartVerify->setEnabled(enable && m_device->isReaderOpen());
+    m_btnIdentify->setEnabled(enable && m_device->isReaderOpen());
     m_btnCaptureVerify->setEnabled(!enable);
 }
 
-void MainWindowApp::onEnrollmentProgress(int current, int total, QString message)
+void MainWindowApp::onEnrollmentProgress(int current, int total, const QString& message)
 {
+    TRACE_SCOPE("ui", "enrollmentProgress");
     // Update progress bar
     m_enrollProgress->setValue(current);
     m_enrollProgress->setFormat(QString("%1/%2 scans (%p%)").arg(current).arg(total));
@@ -819,92 +1056,7 @@ void MainWindowApp::onEnrollmentProgress(int current, int total, QString message
     // Log progress
     log(QString("Enrollment: %1/%2 - %3").arg(current).arg(total).arg(message));
     
-    // Create a more realistic fingerprint visualization
-    // Note: This is a simulation since U.are.U doesn't provide raw images via libfprint
-    QImage previewImage(180, 180, QImage::Format_RGB888);
-    previewImage.fill(QColor(250, 250, 250));
-    
-    QPainter painter(&previewImage);
-    painter.setRenderHint(QPainter::Antialiasing);
-    painter.setRenderHint(QPainter::SmoothPixmapTransform);
-    
-    int centerX = 90;
-    int centerY = 90;
-    
-    // Draw background gradient for depth
-    QRadialGradient gradient(centerX, centerY, 80);
-    gradient.setColorAt(0, QColor(240, 245, 250));
-    gradient.setColorAt(1, QColor(220, 230, 240));
-    painter.fillRect(previewImage.rect(), gradient);
-    
-    // Draw fingerprint ridges with varying opacity based on progress
-    for (int i = 0; i < current; ++i) {
-        int alpha = 150 + (i * 20);
-        if (alpha > 255) alpha = 255;
-        
-        painter.setPen(QPen(QColor(60, 100, 180, alpha), 2.5));
-        
-        // Draw multiple curved lines to simulate fingerprint ridges
-        for (int j = 0; j < 8; ++j) {
-            int radius = 15 + (i * 12) + (j * 3);
-            QRect ellipseRect(centerX - radius, centerY - radius, radius * 2, radius * 2);
-            
-            // Draw partial arcs for more realistic fingerprint pattern
-            int startAngle = (j * 15 + i * 10) * 16; // Qt uses 1/16th of a degree
-            int spanAngle = (120 + j * 10) * 16;
-            painter.drawArc(ellipseRect, startAngle, spanAngle);
-        }
-    }
-    
-    // Draw center point
-    if (current > 0) {
-        painter.setPen(Qt::NoPen);
-        painter.setBrush(QColor(33, 150, 243, 200));
-        painter.drawEllipse(QPoint(centerX, centerY), 5, 5);
-    }
-    
-    // Draw scan indicator overlay
-    QColor overlayColor;
-    QString statusText;
-    
-    if (current == 0) {
-        overlayColor = QColor(200, 200, 200, 230);
-        statusText = "Ready to Scan";
-    } else if (current < total) {
-        overlayColor = QColor(255, 152, 0, 200);
-        statusText = QString("Scan %1/%2").arg(current).arg(total);
-    } else {
-        overlayColor = QColor(76, 175, 80, 200);
-        statusText = "Complete!";
-    }
-    
-    // Draw status badge
-    painter.setPen(Qt::NoPen);
-    painter.setBrush(overlayColor);
-    QRect badgeRect(10, 10, 160, 35);
-    painter.drawRoundedRect(badgeRect, 5, 5);
-    
-    // Draw status text
-    painter.setPen(QColor(255, 255, 255));
-    painter.setFont(QFont("Arial", 11, QFont::Bold));
-    painter.drawText(badgeRect, Qt::AlignCenter, statusText);
-    
-    // Draw progress indicator at bottom
-    painter.setPen(Qt::NoPen);
-    int progressWidth = (180 * current) / total;
-    QRect progressRect(0, 170, progressWidth, 10);
-    painter.setBrush(QColor(33, 150, 243, 220));
-    painter.drawRect(progressRect);
-    
-    // Show in preview label (center the image)
-    m_enrollImagePreview->setPixmap(QPixmap::fromImage(previewImage));
-    
-    // Force immediate repaint of widgets to ensure visual responsiveness on macOS
-    m_enrollProgress->repaint();
-    m_enrollStatusLabel->repaint();
-    m_enrollImagePreview->repaint();
-
-    // Process events to update UI
-    QApplication::processEvents();
+    // Frames are painted ahead of time; this runs while the reader is capturing
+    m_enrollImagePreview->setPixmap(m_preview->progressFrame(current, total));
 }
 
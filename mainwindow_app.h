@@ -6,7 +6,7 @@
 #include <QPushButton>
 #include <QLineEdit>
 #include <QTextEdit>
-#include <QListWidget>
+#include <QListView>
 #include <QGroupBox>
 #include <QProgressBar>
 #include <QVBoxLayout>
@@ -17,8 +17,26 @@
 
 // Local database manager
 #include "database_manager.h"
-#include <QFutureWatcher>
+#include "template_gallery.h"
+#include "device_worker.h"
+#include "capture_replay.h"
+#include "user_list_model.h"
+#include "startup_orchestrator.h"
 #include <QCloseEvent>
+#include <QFuture>
+#include <QTimer>
+#include <QElapsedTimer>
+
+class EnrollmentPreview;
+class AccessLog;
+class VerifyTemplateCache;
+
+// Outcome of a background import/export, produced on a pool thread
+struct UserTransferResult {
+    bool ok = false;
+    int count = 0;
+    QString error;
+};
 
 class MainWindowApp : public QMainWindow {
     Q_OBJECT
@@ -34,13 +52,21 @@ private slots:
     void onInitializeClicked();
     void onEnrollClicked();
     void onCaptureEnrollSample();
-    void onCaptureEnrollFinished(); // New slot
+    void onReaderInitialized(bool ok, const QString& error);
+    void onSubsystemReady(StartupOrchestrator::Subsystem subsystem, bool ok, const QString& error, qint64 elapsedMs);
+    void onEnrollmentStarted(bool ok, const QString& error);
+    void onEnrollmentProgress(int current, int total, const QString& message);
+    void onEnrollmentSampleFinished(int result, const QString& message, const QByteArray& templateData, const QString& error);
+    void onVerifyFinished(bool matched, int score, const QString& error);
     void onVerifyClicked();
     void onIdentifyClicked(); // New slot for identification
     void onCaptureVerifySample();
     void onRefreshUserList();
-    void onUserSelected(QListWidgetItem* item);
+    void onUserSelectionChanged();
     void onDeleteUserClicked();
+    void onImportUsersClicked();
+    void onExportUsersClicked();
+    void onToggleTrace();
     void onClearLog();
     void onConfigClicked(); // Show database configuration
     void onRunMigration(); // Handle manual migration request
@@ -50,30 +76,53 @@ private:
     void updateStatus(const QString& status, bool isError = false);
     void log(const QString& message);
     void updateUserList();
+    int selectedUserId() const; // -1 when nothing is selected
+    void updateUserCountLabel();
+    void loadGallery();
     void enableEnrollmentControls(bool enable);
     void enableVerificationControls(bool enable);
-    void onEnrollmentProgress(int current, int total, QString message);
-    void processEnrollmentResult(int result);
+    void resetEnrollment(const QString& statusText);
+    void saveEnrollment(const QByteArray& templateData);
     void reinitDatabase(); // Helper to re-initialize database
+    void runUserTransfer(const QString& action, std::function<UserTransferResult()> job);
 
-    // DigitalPersona Library instance
-    FingerprintManager* m_fpManager;
+    // Reader-owner thread wrapping the DigitalPersona Library
+    DeviceWorker* m_device;
+    CaptureReplay* m_replay; // Only in replay mode (FP_REPLAY_DIR)
     
     // Local database manager
     DatabaseManager* m_dbManager;
     
+    // Resident 1:N gallery, kept in sync with m_dbManager writes
+    TemplateGallery* m_gallery;
+
+    // Paged user list, patched from m_dbManager change signals
+    UserListModel* m_userModel;
+
+    // Pre-painted enrollment preview frames
+    EnrollmentPreview* m_preview;
+
+    // Background startup of database, gallery and reader; null without a configuration
+    StartupOrchestrator* m_startup;
+
+    // Write-behind audit of verify and identify outcomes
+    AccessLog* m_accessLog;
+    
     // Enrollment state
     bool m_enrollmentInProgress;
     int m_enrollmentSampleCount;
     QString m_enrollmentUserName;
     QString m_enrollmentUserEmail;
     
-    // Threading
-    QFutureWatcher<int> m_enrollWatcher;
-    
-    // Temp storage for worker thread results
-    QString m_tempEnrollMessage;
-    QImage m_tempEnrollImage;
+    // Users prefetched for 1:1 verification on selection
+    VerifyTemplateCache* m_verifyCache;
+
+    // User being verified while the capture runs on the device thread
+    User m_verifyUser;
+    QElapsedTimer m_verifyTimer;
+
+    // Running bulk import/export, joined before shutdown
+    QFuture<UserTransferResult> m_transfer;
 
     // UI components
     QLabel* m_statusLabel;
@@ -99,9 +148,13 @@ private:
     QLabel* m_verifyScoreLabel;
     
     QGroupBox* m_userListGroup;
-    QListWidget* m_userList;
+    QLineEdit* m_searchEdit;
+    QTimer m_searchTimer; // Debounces typing into one search
+    QListView* m_userList;
     QPushButton* m_btnRefreshList;
     QPushButton* m_btnDeleteUser;
+    QPushButton* m_btnImportUsers;
+    QPushButton* m_btnExportUsers;
     QPushButton* m_btnConfig; // Database config button
     QLabel* m_userCountLabel;
     
@@ -0,0 +1,321 @@
+#include "match_engine.h"
+#include "trace.h"
+#include "metrics.h"
+#include <QThreadPool>
+#include <QThread>
+#include <QMutex>
+#include <QSemaphore>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+
+namespace {
+
+// Gallery indices ordered by descending signature similarity, best `keep` only
+QVector<int> rankCandidates(const TemplateSignature& probe, const QVector<GalleryEntry>& entries, int keep)
+{
+    TRACE_SCOPE("match", "prefilter");
+    QVector<QPair<int, int>> ranked; // (-similarity, index) so ascending order is best first
+    ranked.reserve(entries.size());
+    for (int i = 0; i < entries.size(); ++i) {
+        ranked.append(qMakePair(-TemplateSignature::similarity(probe, entries[i].signature), i));
+    }
+    std::nth_element(ranked.begin(), ranked.begin() + keep, ranked.end());
+    std::sort(ranked.begin(), ranked.begin() + keep); // Likely matches first, so early stops come sooner
+
+    QVector<int> order(keep);
+    for (int i = 0; i < keep; ++i) {
+        order[i] = ranked[i].second;
+    }
+    return order;
+}
+
+// Lowest similarity still inside the best `keep`; entries scoring below it are pruned
+int similarityCutoff(const TemplateSignature& probe, const QVector<GalleryEntry>& entries, int keep)
+{
+    TRACE_SCOPE("match", "prefilterCutoff");
+    QVector<int> similarities(entries.size());
+    for (int i = 0; i < entries.size(); ++i) {
+        similarities[i] = TemplateSignature::similarity(probe, entries[i].signature);
+    }
+    std::nth_element(similarities.begin(), similarities.begin() + (keep - 1), similarities.end(), std::greater<int>());
+    return similarities[keep - 1];
+}
+
+} // namespace
+
+MatchEngine::MatchEngine(int threadCount)
+    : m_pool(new QThreadPool())
+    , m_chunkSize(64)
+    , m_earlyStopScore(0)
+    , m_prefilterRatio(1.0)
+    , m_prefilterMinimum(500)
+    , m_searches(0)
+    , m_galleryTotal(0)
+    , m_candidateTotal(0)
+{
+    // Private pool so matching never queues behind unrelated QtConcurrent work
+    m_pool->setMaxThreadCount(threadCount > 0 ? threadCount : QThread::idealThreadCount());
+}
+
+MatchEngine::~MatchEngine()
+{
+    m_pool->waitForDone();
+    delete m_pool;
+}
+
+int MatchEngine::threadCount() const
+{
+    return m_pool->maxThreadCount();
+}
+
+void MatchEngine::setPrefilter(double keepRatio, int minCandidates)
+{
+    m_prefilterRatio = qBound(0.0, keepRatio, 1.0);
+    m_prefilterMinimum = qMax(1, minCandidates);
+}
+
+int MatchEngine::stopScore(int threshold) const
+{
+    if (m_earlyStopScore <= 0) return std::numeric_limits<int>::max();
+    return qMax(m_earlyStopScore, threshold);
+}
+
+int MatchEngine::keepCount(int total) const
+{
+    if (m_prefilterRatio >= 1.0) return total;
+    int keep = int(std::ceil(total * m_prefilterRatio));
+    return qMin(total, qMax(m_prefilterMinimum, keep));
+}
+
+void MatchEngine::recordSearch(int gallery, int candidates) const
+{
+    m_searches.fetch_add(1, std::memory_order_relaxed);
+    m_galleryTotal.fetch_add(gallery, std::memory_order_relaxed);
+    m_candidateTotal.fetch_add(candidates, std::memory_order_relaxed);
+}
+
+MatchEngine::PrefilterStats MatchEngine::prefilterStats() const
+{
+    PrefilterStats stats;
+    stats.searches = m_searches.load();
+    stats.gallery = m_galleryTotal.load();
+    stats.candidates = m_candidateTotal.load();
+    return stats;
+}
+
+void MatchEngine::resetPrefilterStats()
+{
+    m_searches = 0;
+    m_galleryTotal = 0;
+    m_candidateTotal = 0;
+}
+
+MatchResult MatchEngine::identify(const FingerprintTemplate& probe, const GallerySnapshot& gallery, int threshold,
+                                  ProgressCallback progressCb, CancelCallback cancelCb) const
+{
+    TRACE_SCOPE("match", "identify");
+    static Metrics::Histogram* const latency = Metrics::histogram(
+        "fp_match_seconds", "Gallery search time, one probe or one coalesced batch.", "mode=\"single\"");
+    Metrics::ScopedTimer timer(latency);
+    MatchResult best;
+    if (!probe.isValid() || !gallery || gallery->isEmpty()) {
+        return best;
+    }
+
+    const QVector<GalleryEntry>& entries = *gallery;
+
+    // Candidate order: the whole gallery, or its best-ranked slice
+    QVector<int> order;
+    int total = keepCount(entries.size());
+    if (total < entries.size()) {
+        order = rankCandidates(probe.signature(), entries, total);
+    }
+    const int* candidates = order.isEmpty() ? nullptr : order.constData();
+    recordSearch(entries.size(), total);
+
+    const int chunkSize = m_chunkSize;
+    const int chunkCount = (total + chunkSize - 1) / chunkSize;
+    const int workers = qMin(chunkCount, m_pool->maxThreadCount());
+    const int stopAt = stopScore(threshold);
+
+    std::atomic<int> nextChunk(0);
+    std::atomic<int> completed(0);
+    std::atomic<bool> stop(false);
+    QMutex resultMutex;
+    QSemaphore finished;
+
+    auto worker = [&]() {
+        MatchResult local;
+
+        while (!stop.load(std::memory_order_relaxed)) {
+            int chunk = nextChunk.fetch_add(1);
+            if (chunk >= chunkCount) break;
+
+            // Cancellation is honoured at chunk granularity
+            if (cancelCb && cancelCb()) {
+                stop = true;
+                break;
+            }
+            TRACE_SCOPE("match", "chunk");
+
+            int begin = chunk * chunkSize;
+            int end = qMin(begin + chunkSize, total);
+            for (int i = begin; i < end; ++i) {
+                const GalleryEntry& entry = entries[candidates ? candidates[i] : i];
+                int score = FingerprintTemplate::match(probe, entry.fingerprint);
+                if (score > local.score || (score > 0 && score == local.score && entry.userId < local.userId)) {
+                    local.userId = entry.userId;
+                    local.score = score;
+                }
+            }
+            // The rest of this chunk is scored anyway; stopping only ends claiming
+            if (local.score >= stopAt) {
+                stop = true;
+            }
+
+            int done = completed.fetch_add(end - begin) + (end - begin);
+            if (progressCb) {
+                progressCb(done, total); // Called from worker threads
+            }
+        }
+
+        {
+            QMutexLocker locker(&resultMutex);
+            if (local.score > best.score || (local.score > 0 && local.score == best.score && local.userId < best.userId)) {
+                best = local;
+            }
+        }
+        finished.release();
+    };
+
+    for (int i = 0; i < workers; ++i) {
+        m_pool->start(worker);
+    }
+    finished.acquire(workers);
+
+    if (best.score < threshold) {
+        best.userId = -1;
+    }
+    best.candidates = total;
+    return best;
+}
+
+QVector<MatchResult> MatchEngine::identifyBatch(const QVector<FingerprintTemplate>& probes, const GallerySnapshot& gallery,
+                                                const QVector<int>& thresholds, CancelCallback cancelCb) const
+{
+    TRACE_SCOPE("match", "identifyBatch");
+    static Metrics::Histogram* const latency = Metrics::histogram(
+        "fp_match_seconds", "Gallery search time, one probe or one coalesced batch.", "mode=\"batch\"");
+    Metrics::ScopedTimer timer(latency);
+    const int probeCount = probes.size();
+    QVector<MatchResult> best(probeCount);
+    if (probeCount == 0 || !gallery || gallery->isEmpty()) {
+        return best;
+    }
+
+    const QVector<GalleryEntry>& entries = *gallery;
+    const int total = entries.size();
+    const int chunkSize = m_chunkSize;
+    const int chunkCount = (total + chunkSize - 1) / chunkSize;
+    const int workers = qMin(chunkCount, m_pool->maxThreadCount());
+
+    // With early stop, a probe is done once it reaches the stop score and its own threshold
+    QVector<int> stopAt(probeCount);
+    for (int p = 0; p < probeCount; ++p) {
+        stopAt[p] = stopScore(thresholds.value(p));
+    }
+
+    // Invalid probes never match; counting them as done lets the pass end early
+    std::unique_ptr<std::atomic<bool>[]> done(new std::atomic<bool>[probeCount]);
+    std::atomic<int> remaining(0);
+    for (int p = 0; p < probeCount; ++p) {
+        done[p] = !probes[p].isValid();
+        if (!done[p]) ++remaining;
+    }
+    if (remaining == 0) {
+        return best;
+    }
+
+    // Per-probe similarity floor; 0 scores every entry for that probe
+    const int keep = keepCount(total);
+    QVector<TemplateSignature> signatures(probeCount);
+    QVector<int> cutoffs(probeCount, 0);
+    for (int p = 0; p < probeCount; ++p) {
+        if (done[p]) continue;
+        int candidates = total;
+        if (keep < total) {
+            signatures[p] = probes[p].signature();
+            cutoffs[p] = similarityCutoff(signatures[p], entries, keep);
+            candidates = keep; // Ties at the cutoff are scored too, close enough for the stats
+        }
+        best[p].candidates = candidates;
+        recordSearch(total, candidates);
+    }
+
+    std::atomic<int> nextChunk(0);
+    std::atomic<bool> stop(false);
+    QMutex resultMutex;
+    QSemaphore finished;
+
+    auto worker = [&]() {
+        QVector<MatchResult> local(probeCount);
+
+        while (!stop.load(std::memory_order_relaxed)) {
+            int chunk = nextChunk.fetch_add(1);
+            if (chunk >= chunkCount) break;
+
+            if (cancelCb && cancelCb()) {
+                stop = true;
+                break;
+            }
+            TRACE_SCOPE("match", "batchChunk");
+
+            // Candidate-major: one gallery template stays hot while every open probe is scored
+            int begin = chunk * chunkSize;
+            int end = qMin(begin + chunkSize, total);
+            for (int i = begin; i < end; ++i) {
+                const GalleryEntry& entry = entries[i];
+                for (int p = 0; p < probeCount; ++p) {
+                    if (done[p].load(std::memory_order_relaxed)) continue;
+                    if (cutoffs[p] > 0 && TemplateSignature::similarity(signatures[p], entry.signature) < cutoffs[p]) continue;
+
+                    int score = FingerprintTemplate::match(probes[p], entry.fingerprint);
+                    MatchResult& r = local[p];
+                    if (score > r.score || (score > 0 && score == r.score && entry.userId < r.userId)) {
+                        r.userId = entry.userId;
+                        r.score = score;
+                    }
+                    if (score >= stopAt[p] && !done[p].exchange(true)) {
+                        if (--remaining == 0) stop = true;
+                    }
+                }
+            }
+        }
+
+        {
+            QMutexLocker locker(&resultMutex);
+            for (int p = 0; p < probeCount; ++p) {
+                const MatchResult& r = local[p];
+                if (r.score > best[p].score || (r.score > 0 && r.score == best[p].score && r.userId < best[p].userId)) {
+                    best[p].userId = r.userId;
+                    best[p].score = r.score;
+                }
+            }
+        }
+        finished.release();
+    };
+
+    for (int i = 0; i < workers; ++i) {
+        m_pool->start(worker);
+    }
+    finished.acquire(workers);
+
+    for (int p = 0; p < probeCount; ++p) {
+        if (best[p].score < thresholds.value(p)) {
+            best[p].userId = -1;
+        }
+    }
+    return best;
+}
@@ -0,0 +1,104 @@
+#ifndef MATCH_ENGINE_H
+#define MATCH_ENGINE_H
+
+#include <QVector>
+#include <QSharedPointer>
+#include <atomic>
+#include <functional>
+
+#include "fingerprint_template.h"
+
+class QThreadPool;
+
+struct GalleryEntry {
+    int userId;
+    FingerprintTemplate fingerprint;
+    TemplateSignature signature;
+};
+
+// Immutable gallery snapshot shared between the owner and matcher threads
+typedef QSharedPointer<const QVector<GalleryEntry>> GallerySnapshot;
+
+struct MatchResult {
+    int userId = -1;
+    int score = 0;
+    int candidates = 0; // Gallery entries left for the full matcher after the pre-filter
+};
+
+// Parallel 1:N matcher over decoded templates.
+// The gallery is cut into fixed-size chunks; every worker claims the next
+// chunk from a shared cursor until the gallery or a cancel request ends the
+// pass, and the result is the best score over every entry scored (ties go to
+// the lower user id). By default every entry is scored, so the result does
+// not depend on thread timing.
+//
+// setEarlyStopScore() lets a pass end once some entry reaches that score:
+// no new chunks are claimed, but the chunks already claimed are finished and
+// the global best is still taken. Only a score clearly above every impostor
+// score (see match_evaluation's max_impostor_score) is safe here; below that
+// a weaker false match in an early chunk could end the pass before the true
+// match is scored.
+//
+// With the pre-filter enabled the gallery is first ranked by signature
+// similarity and only the best slice reaches FingerprintTemplate::match();
+// genuine matches outside the slice are missed, so the ratio trades recall
+// for speed.
+class MatchEngine {
+public:
+    typedef std::function<void(int current, int total)> ProgressCallback;
+    typedef std::function<bool()> CancelCallback;
+
+    struct PrefilterStats {
+        qint64 searches = 0;   // Probes identified
+        qint64 gallery = 0;    // Sum of gallery sizes seen
+        qint64 candidates = 0; // Sum of entries kept for the full matcher
+    };
+
+    explicit MatchEngine(int threadCount = 0); // 0 = one worker per core
+    ~MatchEngine();
+
+    int threadCount() const;
+
+    void setChunkSize(int size) { m_chunkSize = qMax(1, size); }
+    int chunkSize() const { return m_chunkSize; }
+
+    // 0 (the default) scores the whole gallery; higher thresholds raise it per call
+    void setEarlyStopScore(int score) { m_earlyStopScore = qMax(0, score); }
+    int earlyStopScore() const { return m_earlyStopScore; }
+
+    // keepRatio 1.0 disables the pre-filter; minCandidates keeps small galleries exhaustive
+    void setPrefilter(double keepRatio, int minCandidates = 500);
+    double prefilterRatio() const { return m_prefilterRatio; }
+    int prefilterMinimum() const { return m_prefilterMinimum; }
+
+    PrefilterStats prefilterStats() const;
+    void resetPrefilterStats();
+
+    // Best candidate scoring >= threshold, or userId -1
+    MatchResult identify(const FingerprintTemplate& probe, const GallerySnapshot& gallery, int threshold,
+                         ProgressCallback progressCb = nullptr, CancelCallback cancelCb = nullptr) const;
+
+    // Several probes in one pass: each gallery chunk is scored against every
+    // probe while it is still in cache. Results and thresholds are index-aligned
+    // with probes; with an early-stop score a probe stops being scored once it
+    // reaches that score and its own threshold.
+    QVector<MatchResult> identifyBatch(const QVector<FingerprintTemplate>& probes, const GallerySnapshot& gallery,
+                                       const QVector<int>& thresholds, CancelCallback cancelCb = nullptr) const;
+
+private:
+    int keepCount(int total) const;
+    int stopScore(int threshold) const; // Above any score when early stop is off
+    void recordSearch(int gallery, int candidates) const;
+
+    QThreadPool* m_pool;
+    int m_chunkSize;
+    int m_earlyStopScore;
+    double m_prefilterRatio;
+    int m_prefilterMinimum;
+
+    mutable std::atomic<qint64> m_searches;
+    mutable std::atomic<qint64> m_galleryTotal;
+    mutable std::atomic<qint64> m_candidateTotal;
+};
+
+#endif // MATCH_ENGINE_H
@@ -0,0 +1,597 @@
+// Offline verification accuracy of FingerprintTemplate::match.
+//
+// Scores every pair of a corpus labelled by subject, splits the scores into
+// genuine (same subject) and impostor distributions, and reports FAR/FRR per
+// threshold as JSON: candidate thresholds, the thresholds meeting target
+// FARs, the equal error rate and the full DET/ROC curve (also as CSV).
+//
+// Pairs are scored on all cores and folded into 101-bin histograms as each
+// row finishes, so memory grows with the corpus, not with the pair count.
+//
+// The app's verify decision comes from the library's own matcher, not from
+// FingerprintTemplate::match. With --library the corpus is recorded images
+// instead (one subdirectory per subject), and every probe frame is scored by
+// both matchers on libfprint's virtual reader (see LibraryScorer). The report
+// then puts the library's FAR/FRR at the app's threshold next to the
+// in-process matcher's on the very same pairs, and says whether the in-process
+// matcher is at least as accurate; the daemon's --calibration reads that.
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+#include <QtConcurrent>
+#include <QDebug>
+#include <numeric>
+
+#include "fingerprint_template.h"
+#include "user_archive.h"
+#include "device_worker.h"
+#include "capture_replay.h"
+#include "library_scorer.h"
+#include "trace.h"
+
+namespace {
+
+const int kScoreBins = 101; // FingerprintTemplate::match scores 0-100; the library's are clamped to it
+
+struct Options {
+    QString corpus;
+    QRegularExpression subjectPattern;
+    int threads = 0;
+    QList<int> thresholds;
+    QList<double> farTargets;
+    QString output;
+    QString curve;
+    bool library = false;
+    int enrollFrames = 5;
+    int libraryThreshold = 60; // MainWindowApp accepts a verify at this library score
+};
+
+struct Sample {
+    int subject;
+    FingerprintTemplate fingerprint;
+};
+
+struct Corpus {
+    QVector<Sample> samples;
+    QStringList subjects;
+    int skipped = 0; // Unreadable or without minutiae
+};
+
+// Pair counts per score; all the scoring pass keeps
+struct ScoreCounts {
+    quint64 genuine[kScoreBins] = {};
+    quint64 impostor[kScoreBins] = {};
+
+    void add(const ScoreCounts& other)
+    {
+        for (int s = 0; s < kScoreBins; ++s) {
+            genuine[s] += other.genuine[s];
+            impostor[s] += other.impostor[s];
+        }
+    }
+};
+
+// Accepting scores >= threshold, as the daemon does with this matcher's scores
+struct ErrorRates {
+    double far = 0.0; // Impostor pairs accepted
+    double frr = 0.0; // Genuine pairs rejected
+};
+
+int subjectId(Corpus& corpus, QHash<QString, int>& ids, const QString& subject)
+{
+    auto it = ids.constFind(subject);
+    if (it != ids.constEnd()) return it.value();
+    corpus.subjects.append(subject);
+    return ids.insert(subject, int(corpus.subjects.size()) - 1).value();
+}
+
+void addSample(Corpus& corpus, QHash<QString, int>& ids, const QString& subject, const QByteArray& data)
+{
+    FingerprintTemplate fingerprint = FingerprintTemplate::fromSerialized(data);
+    if (!fingerprint.isValid()) {
+        ++corpus.skipped;
+        return;
+    }
+    Sample sample = { subjectId(corpus, ids, subject), fingerprint };
+    corpus.samples.append(sample);
+}
+
+// One subdirectory per subject, one serialized template per file
+bool loadDirectory(const QString& path, Corpus& corpus)
+{
+    QHash<QString, int> ids;
+    QDir root(path);
+    for (const QString& subject : root.entryList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name)) {
+        QDir dir(root.filePath(subject));
+        for (const QString& fileName : dir.entryList(QDir::Files, QDir::Name)) {
+            QFile file(dir.filePath(fileName));
+            if (!file.open(QIODevice::ReadOnly)) {
+                qWarning() << "Cannot read" << file.fileName() << file.errorString();
+                ++corpus.skipped;
+                continue;
+            }
+            addSample(corpus, ids, subject, file.readAll());
+        }
+    }
+    return true;
+}
+
+// Archive exported by the app; the subject is the first capture of the pattern over the user name
+bool loadArchive(const QString& path, const QRegularExpression& pattern, Corpus& corpus)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qCritical() << "Cannot open" << path << file.errorString();
+        return false;
+    }
+
+    UserArchiveReader reader(&file);
+    if (!reader.readHeader()) {
+        qCritical() << reader.getLastError();
+        return false;
+    }
+
+    QHash<QString, int> ids;
+    User user;
+    while (reader.readNext(user)) {
+        QRegularExpressionMatch match = pattern.match(user.name);
+        QString subject = match.hasMatch() && !match.captured(1).isEmpty() ? match.captured(1) : user.name;
+        addSample(corpus, ids, subject, user.fingerprintTemplate);
+    }
+    if (!reader.atEnd()) {
+        qCritical() << reader.getLastError();
+        return false;
+    }
+    return true;
+}
+
+// Pairs (row, j > row); match() is not symmetric, so each pair is scored once in a fixed order
+ScoreCounts scoreRow(const QVector<Sample>& samples, int row)
+{
+    ScoreCounts counts;
+    const Sample& probe = samples[row];
+    for (int j = row + 1; j < samples.size(); ++j) {
+        const Sample& candidate = samples[j];
+        int score = qBound(0, FingerprintTemplate::match(probe.fingerprint, candidate.fingerprint), kScoreBins - 1);
+        if (candidate.subject == probe.subject) {
+            ++counts.genuine[score];
+        } else {
+            ++counts.impostor[score];
+        }
+    }
+    return counts;
+}
+
+// rates[t] for thresholds 0-100
+QVector<ErrorRates> errorRates(const ScoreCounts& counts, quint64 genuineTotal, quint64 impostorTotal)
+{
+    QVector<ErrorRates> rates(kScoreBins);
+    quint64 genuineBelow = 0;
+    quint64 impostorAtOrAbove = impostorTotal;
+    for (int t = 0; t < kScoreBins; ++t) {
+        rates[t].far = impostorTotal ? double(impostorAtOrAbove) / impostorTotal : 0.0;
+        rates[t].frr = genuineTotal ? double(genuineBelow) / genuineTotal : 0.0;
+        genuineBelow += counts.genuine[t];
+        impostorAtOrAbove -= counts.impostor[t];
+    }
+    return rates;
+}
+
+QJsonObject ratePoint(int threshold, const ErrorRates& rates)
+{
+    QJsonObject point;
+    point["threshold"] = threshold;
+    point["far"] = rates.far;
+    point["frr"] = rates.frr;
+    return point;
+}
+
+bool writeCurve(const QString& path, const QVector<ErrorRates>& rates)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+        qCritical() << "Cannot write" << path << file.errorString();
+        return false;
+    }
+    // DET: frr against far; ROC: tar (1 - frr) against far
+    QTextStream out(&file);
+    out << "threshold,far,frr,tar\n";
+    for (int t = 0; t < rates.size(); ++t) {
+        out << t << ',' << rates[t].far << ',' << rates[t].frr << ',' << 1.0 - rates[t].frr << '\n';
+    }
+    return true;
+}
+
+QJsonObject evaluate(const Options& options, const Corpus& corpus)
+{
+    QThreadPool pool;
+    pool.setMaxThreadCount(options.threads > 0 ? options.threads : QThread::idealThreadCount());
+
+    QVector<int> rows(corpus.samples.size());
+    std::iota(rows.begin(), rows.end(), 0);
+
+    // Rows are reduced as they finish; only the running totals stay in memory
+    const QVector<Sample>& samples = corpus.samples;
+    int rowCount = int(rows.size());
+    int done = 0;
+    int nextReport = rowCount / 10;
+    QElapsedTimer timer;
+    timer.start();
+    ScoreCounts counts = QtConcurrent::blockingMappedReduced<ScoreCounts>(&pool, rows,
+        [&samples](int row) {
+            TRACE_SCOPE("evaluate", "scoreRow");
+            return scoreRow(samples, row);
+        },
+        [&done, &nextReport, rowCount](ScoreCounts& total, const ScoreCounts& row) {
+            total.add(row);
+            if (++done >= nextReport && nextReport > 0) {
+                qInfo().noquote() << QString("Scored %1/%2 rows").arg(done).arg(rowCount);
+                nextReport += rowCount / 10;
+            }
+        },
+        QtConcurrent::UnorderedReduce);
+    double scoreMs = timer.nsecsElapsed() / 1e6;
+
+    quint64 genuineTotal = 0, impostorTotal = 0;
+    QJsonArray genuineHistogram, impostorHistogram;
+    for (int s = 0; s < kScoreBins; ++s) {
+        genuineTotal += counts.genuine[s];
+        impostorTotal += counts.impostor[s];
+        genuineHistogram.append(double(counts.genuine[s]));
+        impostorHistogram.append(double(counts.impostor[s]));
+    }
+    QVector<ErrorRates> rates = errorRates(counts, genuineTotal, impostorTotal);
+
+    QJsonObject report;
+    report["corpus"] = options.corpus;
+    report["subjects"] = int(corpus.subjects.size());
+    report["samples"] = int(corpus.samples.size());
+    report["skipped"] = corpus.skipped;
+    report["threads"] = pool.maxThreadCount();
+    report["genuine_pairs"] = double(genuineTotal);
+    report["impostor_pairs"] = double(impostorTotal);
+    report["score_ms"] = scoreMs;
+    report["pairs_per_sec"] = scoreMs > 0 ? (genuineTotal + impostorTotal) * 1000.0 / scoreMs : 0.0;
+    // Smallest FAR step the impostor set can show; lower targets are not measurable
+    report["far_resolution"] = impostorTotal ? 1.0 / impostorTotal : 1.0;
+
+    int eerThreshold = 0;
+    for (int t = 1; t < kScoreBins; ++t) {
+        if (qAbs(rates[t].far - rates[t].frr) < qAbs(rates[eerThreshold].far - rates[eerThreshold].frr)) {
+            eerThreshold = t;
+        }
+    }
+    // Highest impostor score seen; a matcher early-stop score belongs clearly above it
+    int maxImpostorScore = 0;
+    for (int s = 0; s < kScoreBins; ++s) {
+        if (counts.impostor[s] > 0) maxImpostorScore = s;
+    }
+    report["max_impostor_score"] = maxImpostorScore;
+
+    report["eer"] = (rates[eerThreshold].far + rates[eerThreshold].frr) / 2.0;
+    report["eer_threshold"] = eerThreshold;
+
+    QJsonArray thresholds;
+    for (int t : options.thresholds) {
+        thresholds.append(ratePoint(t, rates[t]));
+    }
+    report["thresholds"] = thresholds;
+
+    // Lowest threshold whose FAR meets the target, i.e. the best FRR at that FAR
+    QJsonArray farTargets;
+    for (double target : options.farTargets) {
+        QJsonObject point;
+        point["far_target"] = target;
+        for (int t = 0; t < kScoreBins; ++t) {
+            if (rates[t].far <= target) {
+                point = ratePoint(t, rates[t]);
+                point["far_target"] = target;
+                break;
+            }
+        }
+        farTargets.append(point);
+    }
+    report["far_targets"] = farTargets;
+
+    QJsonArray curve;
+    for (int t = 0; t < kScoreBins; ++t) {
+        curve.append(ratePoint(t, rates[t]));
+    }
+    report["curve"] = curve;
+    report["genuine_histogram"] = genuineHistogram;
+    report["impostor_histogram"] = impostorHistogram;
+
+    if (!options.curve.isEmpty() && !writeCurve(options.curve, rates)) {
+        report["curve_error"] = QString("Cannot write %1").arg(options.curve);
+    }
+    return report;
+}
+
+
+// One subdirectory of images per subject: the first frames enroll, the rest are probes
+QVector<LibraryScorer::Subject> loadFrames(const QString& path, int enrollFrames, int& skipped)
+{
+    QVector<LibraryScorer::Subject> subjects;
+    QDir root(path);
+    for (const QString& name : root.entryList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name)) {
+        QStringList frames = CaptureReplay::imageFiles(root.filePath(name));
+        if (frames.size() <= enrollFrames) {
+            qWarning() << "Subject" << name << "has" << frames.size() << "frames, needs more than" << enrollFrames;
+            skipped += int(frames.size());
+            continue;
+        }
+        LibraryScorer::Subject subject;
+        subject.name = name;
+        subject.enrollFrames = frames.mid(0, enrollFrames);
+        subject.probeFrames = frames.mid(enrollFrames);
+        subjects.append(subject);
+    }
+    return subjects;
+}
+
+QJsonObject matcherReport(const ScoreCounts& counts, int threshold)
+{
+    quint64 genuineTotal = 0, impostorTotal = 0;
+    QJsonArray genuineHistogram, impostorHistogram;
+    for (int s = 0; s < kScoreBins; ++s) {
+        genuineTotal += counts.genuine[s];
+        impostorTotal += counts.impostor[s];
+        genuineHistogram.append(double(counts.genuine[s]));
+        impostorHistogram.append(double(counts.impostor[s]));
+    }
+    QVector<ErrorRates> rates = errorRates(counts, genuineTotal, impostorTotal);
+
+    QJsonObject report = ratePoint(threshold, rates[threshold]);
+    QJsonArray curve;
+    for (int t = 0; t < kScoreBins; ++t) {
+        curve.append(ratePoint(t, rates[t]));
+    }
+    report["curve"] = curve;
+    report["genuine_histogram"] = genuineHistogram;
+    report["impostor_histogram"] = impostorHistogram;
+    return report;
+}
+
+// Both matchers on the pairs LibraryScorer recorded
+QJsonObject evaluateLibrary(const Options& options, const LibraryScorer& scorer, int subjects, int skipped)
+{
+    ScoreCounts library, fingerprintTemplate;
+    quint64 genuineTotal = 0, impostorTotal = 0;
+    quint64 genuineMatched = 0, impostorMatched = 0;
+    for (const LibraryScorer::PairScore& pair : scorer.scores()) {
+        int libraryScore = qBound(0, pair.libraryScore, kScoreBins - 1);
+        int templateScore = qBound(0, pair.templateScore, kScoreBins - 1);
+        if (pair.genuine) {
+            ++genuineTotal;
+            ++library.genuine[libraryScore];
+            ++fingerprintTemplate.genuine[templateScore];
+            if (pair.matched) ++genuineMatched;
+        } else {
+            ++impostorTotal;
+            ++library.impostor[libraryScore];
+            ++fingerprintTemplate.impostor[templateScore];
+            if (pair.matched) ++impostorMatched;
+        }
+    }
+
+    QJsonObject libraryReport = matcherReport(library, options.libraryThreshold);
+    // The library's own matched flag; the app ignores it and applies the threshold above
+    libraryReport["verify_far"] = impostorTotal ? double(impostorMatched) / impostorTotal : 0.0;
+    libraryReport["verify_frr"] = genuineTotal ? double(genuineTotal - genuineMatched) / genuineTotal : 0.0;
+
+    // The in-process threshold with the lowest FRR whose FAR is no worse than the library's
+    QJsonObject templateReport = matcherReport(fingerprintTemplate, 0);
+    double libraryFar = libraryReport["far"].toDouble();
+    double libraryFrr = libraryReport["frr"].toDouble();
+    QJsonObject best;
+    for (const QJsonValue& value : templateReport["curve"].toArray()) {
+        QJsonObject point = value.toObject();
+        if (point["far"].toDouble() <= libraryFar) {
+            best = point;
+            break;
+        }
+    }
+    templateReport["threshold"] = best.value("threshold").toInt(kScoreBins - 1);
+    templateReport["far"] = best.value("far").toDouble();
+    templateReport["frr"] = best.value("frr").toDouble(1.0);
+
+    QJsonObject comparison;
+    comparison["threshold"] = templateReport["threshold"];
+    comparison["library_threshold"] = options.libraryThreshold;
+    comparison["at_least_as_accurate"] = !best.isEmpty() && genuineTotal > 0 && impostorTotal > 0
+        && templateReport["frr"].toDouble() <= libraryFrr;
+
+    QJsonObject report;
+    report["corpus"] = options.corpus;
+    report["mode"] = "library";
+    report["subjects"] = subjects;
+    report["enrolled_subjects"] = scorer.enrolledSubjects();
+    report["enroll_frames"] = options.enrollFrames;
+    report["skipped"] = skipped + scorer.skippedFrames();
+    report["genuine_pairs"] = double(genuineTotal);
+    report["impostor_pairs"] = double(impostorTotal);
+    report["far_resolution"] = impostorTotal ? 1.0 / impostorTotal : 1.0;
+    report["library"] = libraryReport;
+    report["template"] = templateReport;
+    report["comparison"] = comparison;
+    return report;
+}
+
+// Drives the virtual reader until every pair is scored; false with the report's "error" set
+bool runLibrary(const Options& options, QJsonObject& report)
+{
+    int skipped = 0;
+    QVector<LibraryScorer::Subject> subjects = loadFrames(options.corpus, options.enrollFrames, skipped);
+    if (subjects.size() < 2) {
+        report["error"] = QString("Corpus %1 has fewer than two subjects with probe frames").arg(options.corpus);
+        return false;
+    }
+
+    DeviceWorker device;
+    CaptureReplay replay;
+    replay.setInterval(qEnvironmentVariableIsSet("FP_REPLAY_INTERVAL_MS")
+        ? qEnvironmentVariableIntValue("FP_REPLAY_INTERVAL_MS") : 100);
+    QObject::connect(&device, &DeviceWorker::captureStarted, &replay, &CaptureReplay::onCaptureStarted);
+    QObject::connect(&device, &DeviceWorker::enrollmentProgress, &replay, &CaptureReplay::onEnrollmentProgress);
+    QObject::connect(&replay, &CaptureReplay::replayError, [](const QString& error) {
+        qWarning() << "Capture replay:" << error;
+    });
+
+    LibraryScorer scorer(&device, &replay);
+    scorer.setSubjects(subjects);
+    int nextReport = 0;
+    QObject::connect(&scorer, &LibraryScorer::progress, [&nextReport](int done, int total) {
+        if (done >= nextReport) {
+            qInfo().noquote() << QString("Verified %1/%2 pairs").arg(done).arg(total);
+            nextReport = done + qMax(1, total / 10);
+        }
+    });
+    QObject::connect(&scorer, &LibraryScorer::finished, [](bool ok) {
+        QCoreApplication::exit(ok ? 0 : 1);
+    });
+
+    QElapsedTimer timer;
+    timer.start();
+    device.start();
+    scorer.start();
+    bool ok = QCoreApplication::exec() == 0;
+    device.shutdown();
+
+    if (!ok) {
+        report["error"] = scorer.getLastError();
+        return false;
+    }
+    report = evaluateLibrary(options, scorer, int(subjects.size()), skipped);
+    report["score_ms"] = double(timer.elapsed());
+    return true;
+}
+
+// To stdout when path is empty
+bool writeReport(const QString& path, const QJsonObject& report)
+{
+    QByteArray json = QJsonDocument(report).toJson(QJsonDocument::Indented);
+    if (path.isEmpty()) {
+        fputs(json.constData(), stdout);
+        return true;
+    }
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qCritical() << "Cannot write" << path << file.errorString();
+        return false;
+    }
+    file.write(json);
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    // Same GLib arrangement as the GUI app, see DeviceWorker; only --library opens a reader
+    qputenv("QT_NO_GLIB", "1");
+
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("match_evaluation");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("FAR/FRR evaluation of the template matcher over a labelled corpus");
+    parser.addHelpOption();
+    parser.addPositionalArgument("corpus", "Directory with one subdirectory of templates (images with --library) "
+                                           "per subject, or a user archive.");
+    parser.addOptions({
+        { "subject-pattern", "Archive only: regex whose first group is the subject in a user name.", "regex", "^(.*?)(?:#\\d+)?$" },
+        { "threads", "Scoring threads (0 = ideal).", "n", "0" },
+        { "thresholds", "Comma separated candidate thresholds to report.", "list", "20,30,40,50,60,70,80" },
+        { "far", "Comma separated target FARs to find thresholds for.", "list", "0.01,0.001,0.0001" },
+        { "output", "Write JSON here instead of stdout.", "file" },
+        { "curve", "Also write the DET/ROC curve as CSV.", "file" },
+        { "library", "Score recorded images with the library's matcher and compare (virtual reader)." },
+        { "enroll-frames", "--library: frames per subject used to enroll.", "n", "5" },
+        { "library-threshold", "--library: library score the app accepts a verify at.", "score", "60" }
+    });
+    parser.process(app);
+    Trace::configureFromEnvironment();
+
+    if (parser.positionalArguments().size() != 1) {
+        parser.showHelp(2);
+    }
+
+    Options options;
+    options.corpus = parser.positionalArguments().first();
+    options.subjectPattern.setPattern(parser.value("subject-pattern"));
+    if (!options.subjectPattern.isValid()) {
+        qCritical() << "Invalid --subject-pattern:" << options.subjectPattern.errorString();
+        return 2;
+    }
+    options.threads = parser.value("threads").toInt();
+    for (const QString& threshold : parser.value("thresholds").split(',', Qt::SkipEmptyParts)) {
+        bool ok = false;
+        int t = threshold.trimmed().toInt(&ok);
+        if (ok) options.thresholds.append(qBound(0, t, kScoreBins - 1));
+    }
+    for (const QString& far : parser.value("far").split(',', Qt::SkipEmptyParts)) {
+        double target = far.trimmed().toDouble();
+        if (target > 0.0) options.farTargets.append(target);
+    }
+    options.output = parser.value("output");
+    options.curve = parser.value("curve");
+    options.library = parser.isSet("library");
+    options.enrollFrames = qMax(1, parser.value("enroll-frames").toInt());
+    options.libraryThreshold = qBound(0, parser.value("library-threshold").toInt(), kScoreBins - 1);
+
+    if (options.library) {
+        // Before the worker creates the libfprint context
+        qputenv("FP_REPLAY_DIR", QFile::encodeName(options.corpus));
+        CaptureReplay::prepareEnvironment();
+
+        QJsonObject report;
+        if (!runLibrary(options, report)) {
+            qCritical().noquote() << report["error"].toString();
+            return 1;
+        }
+        report["qt_version"] = QString(qVersion());
+        bool written = writeReport(options.output, report);
+        Trace::writeAtExit();
+        return written ? 0 : 1;
+    }
+
+    Corpus corpus;
+    QElapsedTimer timer;
+    timer.start();
+    bool loaded = QFileInfo(options.corpus).isDir()
+        ? loadDirectory(options.corpus, corpus)
+        : loadArchive(options.corpus, options.subjectPattern, corpus);
+    if (!loaded) {
+        return 1;
+    }
+    if (corpus.samples.size() < 2) {
+        qCritical() << "Corpus" << options.corpus << "has fewer than two usable templates";
+        return 1;
+    }
+    qInfo() << "Loaded" << corpus.samples.size() << "templates of" << corpus.subjects.size() << "subjects in"
+            << timer.elapsed() << "ms," << corpus.skipped << "skipped";
+
+    QJsonObject report = evaluate(options, corpus);
+    if (report.value("genuine_pairs").toDouble() == 0) {
+        qWarning() << "No genuine pairs: every subject has a single template, FRR cannot be measured";
+    }
+    report["qt_version"] = QString(qVersion());
+
+    if (!writeReport(options.output, report)) {
+        return 1;
+    }
+    Trace::writeAtExit();
+    return report.contains("curve_error") ? 1 : 0;
+}
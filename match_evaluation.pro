@@ -0,0 +1,58 @@
+# Offline FAR/FRR evaluation of the template matcher (no reader needed);
+# --library also scores recorded images with the library on libfprint's virtual reader
+#   qmake match_evaluation.pro && make
+#   ./bin/match_evaluation corpus/ --curve det.csv --output evaluation.json
+#   ./bin/match_evaluation --library frames/ --output calibration.json
+
+QT += core gui sql widgets concurrent network
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = match_evaluation
+TEMPLATE = app
+
+DESTDIR = bin
+
+# Link to digitalpersonalib (Binary)
+INCLUDEPATH += $$PWD/digitalpersonalib/include
+
+LIBS += -L$$PWD/digitalpersonalib/lib -ldigitalpersona
+QMAKE_RPATHDIR += $$PWD/digitalpersonalib/lib
+
+# Libfprint - macOS Only (see fingerprint_app.pro)
+macx {
+    INCLUDEPATH += $$PWD/libfprint_repo/libfprint \
+                   /opt/homebrew/include/glib-2.0 \
+                   /opt/homebrew/lib/glib-2.0/include
+    LIBS += -L$$PWD/libfprint_repo/builddir/libfprint -lfprint-2 \
+            -L/opt/homebrew/lib -lglib-2.0 -lgobject-2.0 -lgio-2.0
+    QMAKE_RPATHDIR += $$PWD/libfprint_repo/builddir/libfprint
+}
+
+unix:!macx {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += libfprint-2 glib-2.0
+
+    QMAKE_LFLAGS += -Wl,-rpath,\'\$$ORIGIN/../digitalpersonalib/lib\'
+    QMAKE_LFLAGS += -Wl,-rpath,\'\$$ORIGIN/lib\'
+}
+
+SOURCES += \
+    match_evaluation.cpp \
+    fingerprint_template.cpp \
+    user_archive.cpp \
+    device_worker.cpp \
+    capture_replay.cpp \
+    library_scorer.cpp \
+    metrics.cpp \
+    trace.cpp
+
+HEADERS += \
+    fingerprint_template.h \
+    user_archive.h \
+    device_worker.h \
+    capture_replay.h \
+    library_scorer.h \
+    metrics.h \
+    trace.h
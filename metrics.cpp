@@ -0,0 +1,152 @@
+#include "metrics.h"
+#include <QMutex>
+#include <QHash>
+#include <memory>
+#include <vector>
+
+namespace Metrics {
+
+// Up to 30 s: identify and verify include waiting for the finger
+const qint64 Histogram::kUpperBounds[Histogram::Buckets] = {
+    500000LL, 1000000LL, 2500000LL, 5000000LL, 10000000LL, 25000000LL, 50000000LL,
+    100000000LL, 250000000LL, 500000000LL, 1000000000LL, 2500000000LL, 5000000000LL,
+    10000000000LL, 30000000000LL
+};
+
+void Histogram::observeNanoseconds(qint64 nanoseconds)
+{
+    int bucket = 0;
+    while (bucket < Buckets && nanoseconds > kUpperBounds[bucket]) {
+        ++bucket;
+    }
+    m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+}
+
+namespace {
+
+enum class Type { Counter, Gauge, Histogram };
+
+struct Series {
+    QString labels;
+    std::unique_ptr<Counter> counter;
+    std::unique_ptr<Gauge> gauge;
+    std::unique_ptr<Histogram> histogram;
+};
+
+struct Family {
+    const char* name;
+    const char* help;
+    Type type;
+    std::vector<std::unique_ptr<Series>> series; // Registration order
+};
+
+QMutex g_mutex; // Registration and rendering; updates never take it
+std::vector<std::unique_ptr<Family>> g_families;
+QHash<QString, Series*> g_index; // "name{labels}"
+
+Series* findOrCreate(const char* name, const char* help, Type type, const QString& labels)
+{
+    QString key = QString("%1{%2}").arg(QLatin1String(name)).arg(labels);
+
+    QMutexLocker locker(&g_mutex);
+    Series* existing = g_index.value(key);
+    if (existing) {
+        return existing;
+    }
+
+    Family* family = nullptr;
+    for (const auto& candidate : g_families) {
+        if (qstrcmp(candidate->name, name) == 0) {
+            family = candidate.get();
+            break;
+        }
+    }
+    if (!family) {
+        g_families.push_back(std::unique_ptr<Family>(new Family{ name, help, type, {} }));
+        family = g_families.back().get();
+    }
+    Q_ASSERT(family->type == type);
+
+    std::unique_ptr<Series> series(new Series());
+    series->labels = labels;
+    switch (type) {
+    case Type::Counter: series->counter.reset(new Counter()); break;
+    case Type::Gauge: series->gauge.reset(new Gauge()); break;
+    case Type::Histogram: series->histogram.reset(new Histogram()); break;
+    }
+    Series* result = series.get();
+    family->series.push_back(std::move(series));
+    g_index.insert(key, result);
+    return result;
+}
+
+QByteArray seriesName(const char* name, const char* suffix, const QString& labels, const QByteArray& extraLabel = QByteArray())
+{
+    QByteArray line = QByteArray(name) + suffix;
+    QByteArray labelSet = labels.toUtf8();
+    if (!extraLabel.isEmpty()) {
+        labelSet += (labelSet.isEmpty() ? "" : ",") + extraLabel;
+    }
+    if (!labelSet.isEmpty()) {
+        line += '{' + labelSet + '}';
+    }
+    return line;
+}
+
+QByteArray seconds(qint64 nanoseconds)
+{
+    return QByteArray::number(nanoseconds / 1e9, 'g', 10);
+}
+
+} // namespace
+
+Counter* counter(const char* name, const char* help, const QString& labels)
+{
+    return findOrCreate(name, help, Type::Counter, labels)->counter.get();
+}
+
+Gauge* gauge(const char* name, const char* help, const QString& labels)
+{
+    return findOrCreate(name, help, Type::Gauge, labels)->gauge.get();
+}
+
+Histogram* histogram(const char* name, const char* help, const QString& labels)
+{
+    return findOrCreate(name, help, Type::Histogram, labels)->histogram.get();
+}
+
+QByteArray renderPrometheus()
+{
+    QByteArray out;
+    QMutexLocker locker(&g_mutex);
+
+    for (const auto& family : g_families) {
+        const char* type = family->type == Type::Counter ? "counter"
+                         : family->type == Type::Gauge ? "gauge" : "histogram";
+        out += QByteArray("# HELP ") + family->name + ' ' + family->help + '\n';
+        out += QByteArray("# TYPE ") + family->name + ' ' + type + '\n';
+
+        for (const auto& series : family->series) {
+            if (series->counter) {
+                out += seriesName(family->name, "", series->labels) + ' ' + QByteArray::number(series->counter->value()) + '\n';
+            } else if (series->gauge) {
+                out += seriesName(family->name, "", series->labels) + ' ' + QByteArray::number(series->gauge->value()) + '\n';
+            } else {
+                const Histogram* histogram = series->histogram.get();
+                quint64 cumulative = 0;
+                for (int i = 0; i <= Histogram::Buckets; ++i) {
+                    cumulative += histogram->bucketCount(i);
+                    QByteArray le = i < Histogram::Buckets ? seconds(Histogram::kUpperBounds[i]) : QByteArray("+Inf");
+                    out += seriesName(family->name, "_bucket", series->labels, "le=\"" + le + '"')
+                         + ' ' + QByteArray::number(cumulative) + '\n';
+                }
+                out += seriesName(family->name, "_sum", series->labels) + ' ' + seconds(histogram->sumNanoseconds()) + '\n';
+                out += seriesName(family->name, "_count", series->labels) + ' ' + QByteArray::number(cumulative) + '\n';
+            }
+        }
+    }
+    return out;
+}
+
+} // namespace Metrics
@@ -0,0 +1,87 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QString>
+#include <atomic>
+
+// Process-wide counters, gauges and latency histograms, rendered in the
+// Prometheus text format (see MetricsServer).
+//
+// Metrics are created once and never freed, so call sites keep the pointer
+// in a function-local static and update it with plain atomics:
+//
+//   static Metrics::Histogram* const latency = Metrics::histogram(
+//       "fp_db_query_seconds", "Database call latency.", "op=\"addUser\"");
+//   Metrics::ScopedTimer timer(latency);
+//
+// Names and help texts must be string literals. labels is the inside of the
+// Prometheus label set, already quoted; the same name and labels always
+// return the same metric.
+namespace Metrics {
+
+class Counter {
+public:
+    void increment(quint64 amount = 1) { m_value.fetch_add(amount, std::memory_order_relaxed); }
+    quint64 value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<quint64> m_value{0};
+};
+
+class Gauge {
+public:
+    void set(qint64 value) { m_value.store(value, std::memory_order_relaxed); }
+    void add(qint64 amount) { m_value.fetch_add(amount, std::memory_order_relaxed); }
+    qint64 value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<qint64> m_value{0};
+};
+
+// Fixed latency buckets from 0.5 ms to 30 s
+class Histogram {
+public:
+    enum { Buckets = 15 };
+    static const qint64 kUpperBounds[Buckets]; // Nanoseconds, the +Inf bucket follows
+
+    void observeNanoseconds(qint64 nanoseconds);
+    void observe(double seconds) { observeNanoseconds(qint64(seconds * 1e9)); }
+
+    // Not a consistent snapshot: a scrape racing an observation can be off by one
+    quint64 bucketCount(int bucket) const { return m_buckets[bucket].load(std::memory_order_relaxed); }
+    qint64 sumNanoseconds() const { return m_sum.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<quint64> m_buckets[Buckets + 1] = {};
+    std::atomic<qint64> m_sum{0};
+};
+
+Counter* counter(const char* name, const char* help, const QString& labels = QString());
+Gauge* gauge(const char* name, const char* help, const QString& labels = QString());
+Histogram* histogram(const char* name, const char* help, const QString& labels = QString());
+
+// Every registered metric, Prometheus text exposition format 0.0.4
+QByteArray renderPrometheus();
+
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Histogram* histogram)
+        : m_histogram(histogram)
+    {
+        m_timer.start();
+    }
+    ~ScopedTimer() { m_histogram->observeNanoseconds(m_timer.nsecsElapsed()); }
+
+private:
+    Histogram* m_histogram;
+    QElapsedTimer m_timer;
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+};
+
+} // namespace Metrics
+
+#endif // METRICS_H
@@ -0,0 +1,85 @@
+#include "metrics_server.h"
+#include "metrics.h"
+#include <QTcpSocket>
+#include <QHostAddress>
+#include <QDebug>
+
+namespace {
+
+const qint64 kMaxRequestLine = 8192;
+
+QByteArray httpResponse(const char* status, const QByteArray& contentType, const QByteArray& body)
+{
+    return QByteArray("HTTP/1.1 ") + status + "\r\n"
+         + "Content-Type: " + contentType + "\r\n"
+         + "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+         + "Connection: close\r\n\r\n"
+         + body;
+}
+
+} // namespace
+
+MetricsServer::MetricsServer(QObject* parent)
+    : QObject(parent)
+    , m_server(new QTcpServer(this))
+{
+    connect(m_server, &QTcpServer::newConnection, this, &MetricsServer::onNewConnection);
+}
+
+MetricsServer::~MetricsServer()
+{
+    m_server->close();
+}
+
+bool MetricsServer::listen(quint16 port)
+{
+    // Loopback only: the numbers include user counts and are not meant for the network
+    if (!m_server->listen(QHostAddress::LocalHost, port)) {
+        m_lastError = QString("Failed to listen for metrics on port %1: %2").arg(port).arg(m_server->errorString());
+        return false;
+    }
+
+    qInfo() << "Metrics available at" << QString("http://127.0.0.1:%1/metrics").arg(m_server->serverPort());
+    return true;
+}
+
+bool MetricsServer::listenFromEnvironment()
+{
+    int port = qEnvironmentVariableIntValue("FP_METRICS_PORT");
+    if (port <= 0) {
+        return true;
+    }
+    return listen(quint16(port));
+}
+
+void MetricsServer::onNewConnection()
+{
+    while (QTcpSocket* socket = m_server->nextPendingConnection()) {
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket]() { handleRequest(socket); });
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+    }
+}
+
+void MetricsServer::handleRequest(QTcpSocket* socket)
+{
+    if (!socket->canReadLine()) {
+        if (socket->bytesAvailable() > kMaxRequestLine) {
+            socket->abort();
+            socket->deleteLater();
+        }
+        return;
+    }
+
+    // Only the request line matters; the headers are never read
+    QList<QByteArray> parts = socket->readLine().trimmed().split(' ');
+    disconnect(socket, &QTcpSocket::readyRead, this, nullptr);
+
+    if (parts.size() < 2 || parts[0] != "GET") {
+        socket->write(httpResponse("405 Method Not Allowed", "text/plain", "Only GET is supported\n"));
+    } else if (parts[1] != "/metrics") {
+        socket->write(httpResponse("404 Not Found", "text/plain", "Try /metrics\n"));
+    } else {
+        socket->write(httpResponse("200 OK", "text/plain; version=0.0.4; charset=utf-8", Metrics::renderPrometheus()));
+    }
+    socket->disconnectFromHost();
+}
@@ -0,0 +1,34 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <QObject>
+#include <QTcpServer>
+#include <QString>
+
+// Serves Metrics::renderPrometheus() at GET /metrics on 127.0.0.1 only.
+// One request per connection; the connection is closed after the reply.
+class MetricsServer : public QObject {
+    Q_OBJECT
+
+public:
+    explicit MetricsServer(QObject* parent = nullptr);
+    ~MetricsServer() override;
+
+    bool listen(quint16 port);
+    // FP_METRICS_PORT=<port> starts the endpoint; unset or 0 leaves it off
+    bool listenFromEnvironment();
+    quint16 port() const { return m_server->serverPort(); }
+
+    QString getLastError() const { return m_lastError; }
+
+private slots:
+    void onNewConnection();
+
+private:
+    void handleRequest(QTcpSocket* socket);
+
+    QTcpServer* m_server;
+    QString m_lastError;
+};
+
+#endif // METRICS_SERVER_H
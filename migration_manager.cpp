@@ -1,129 +1,273 @@
 #include "migration_manager.h"
+#include "trace.h"
 #include <QDir>
 #include <QFile>
 #include <QSqlQuery>
 #include <QSqlError>
+#include <QCryptographicHash>
+#include <QRegularExpression>
 #include <QDebug>
 
 MigrationManager::MigrationManager(QSqlDatabase& db, const QString& migrationsDir)
-    : m_db(db), m_migrationsDir(migrationsDir)
+    : m_db(db), m_migrationsDir(migrationsDir), m_appliedVersion(0)
 {
 }
 
 bool MigrationManager::migrate()
 {
+    TRACE_SCOPE("db", "migrate");
     if (!m_db.isOpen()) {
         m_lastError = "Database not open";
         return false;
     }
 
-    init();
+    bool hasVersionTable = tableExists("schema_version");
     if (!m_lastError.isEmpty()) return false;
 
-    QDir dir(m_migrationsDir);
-    QStringList files = dir.entryList({"*.sql"}, QDir::Files, QDir::Name); // Sorted by name
-    
-    bool started = false;
-    if (m_lastFile.isEmpty()) {
-        started = true;
-    }
-
-    for (const QString& file : files) {
-        if (!started) {
-            if (file == m_lastFile) {
-                started = true;
-                continue;
+    if (hasVersionTable) {
+        if (!readAppliedVersion()) return false;
+        if (m_appliedVersion >= kLatestVersion) {
+#ifndef QT_NO_DEBUG
+            // Debug builds check the constant against the embedded files
+            QVector<Migration> embedded;
+            if (loadMigrations(embedded) && !embedded.isEmpty() && embedded.last().version != kLatestVersion) {
+                qWarning() << "MigrationManager::kLatestVersion is" << kLatestVersion
+                           << "but the newest migration is" << embedded.last().name;
             }
-            continue;
+#endif
+            return true; // Up to date: no file is read
         }
+    }
+
+    QVector<Migration> migrations;
+    if (!loadMigrations(migrations)) return false;
 
-        qDebug() << "Executing migration:" << file;
-        if (!executeFile(dir.filePath(file))) {
+    if (!hasVersionTable) {
+        if (!createVersionTable(migrations)) return false;
+    } else {
+        verifyChecksums(migrations);
+    }
+
+    for (const Migration& migration : migrations) {
+        if (migration.version <= m_appliedVersion) continue;
+
+        qDebug() << "Executing migration:" << migration.name;
+        if (!apply(migration)) {
             return false;
         }
+        m_appliedVersion = migration.version;
+    }
 
-        // Update migration record
-        QSqlQuery query(m_db);
-        query.prepare("UPDATE migrations SET name = ?");
-        query.addBindValue(file);
-        if (!query.exec()) {
-             // If update fails (e.g. multiple rows?), try insert if empty?
-             // Actually init() ensures one row exists.
-             // But if it was empty string, update works.
-             m_lastError = "Failed to update migration record: " + query.lastError().text();
-             return false;
-        }
-        m_lastFile = file;
+    if (m_appliedVersion != kLatestVersion) {
+        qWarning() << "Schema is at version" << m_appliedVersion << "but MigrationManager::kLatestVersion is" << kLatestVersion;
     }
-    
     return true;
 }
 
-void MigrationManager::init()
+bool MigrationManager::tableExists(const QString& table)
 {
-    // Check if table exists
+    // Catalog lookup instead of a failing SELECT, which would abort an open PostgreSQL transaction
     QSqlQuery query(m_db);
-    if (!query.exec("SELECT 1 FROM migrations LIMIT 1")) {
-        // Check if the error is because the table doesn't exist
-        // Note: This check is simplistic. For more robust checks, query information_schema or sqlite_master.
-        // However, exec() returning false is a good enough indicator here to try creating it.
-        
-        // Explicitly clear error state if possible or just proceed to create
-        // Actually, if the error is "relation does not exist", we create the table.
-        
-        if (!query.exec("CREATE TABLE migrations (name VARCHAR(255) NOT NULL DEFAULT '')")) {
-            m_lastError = "Failed to create migrations table: " + query.lastError().text();
-            return;
+    if (m_db.driverName() == "QSQLITE") {
+        query.prepare("SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = ?");
+    } else {
+        query.prepare("SELECT COUNT(*) FROM information_schema.tables WHERE table_schema = current_schema() AND table_name = ?");
+    }
+    query.addBindValue(table);
+    if (!query.exec() || !query.next()) {
+        m_lastError = QString("Failed to look up table %1: %2").arg(table).arg(query.lastError().text());
+        return false;
+    }
+    return query.value(0).toInt() > 0;
+}
+
+bool MigrationManager::readAppliedVersion()
+{
+    QSqlQuery query(m_db);
+    if (!query.exec("SELECT MAX(version) FROM schema_version") || !query.next()) {
+        m_lastError = "Failed to read schema version: " + query.lastError().text();
+        return false;
+    }
+    m_appliedVersion = query.value(0).toInt(); // NULL on an empty table reads as 0
+    return true;
+}
+
+bool MigrationManager::createVersionTable(const QVector<Migration>& migrations)
+{
+    bool hasLegacyTable = tableExists("migrations");
+    if (!m_lastError.isEmpty()) return false;
+
+    // One transaction, so a failed conversion cannot leave an empty schema_version behind
+    if (!m_db.transaction()) {
+        m_lastError = "Failed to begin transaction: " + m_db.lastError().text();
+        return false;
+    }
+
+    QSqlQuery query(m_db);
+    if (!query.exec("CREATE TABLE IF NOT EXISTS schema_version ("
+                    "version INTEGER PRIMARY KEY, "
+                    "name VARCHAR(255) NOT NULL, "
+                    "checksum VARCHAR(64) NOT NULL, "
+                    "applied_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP)")) {
+        m_lastError = "Failed to create schema_version table: " + query.lastError().text();
+        m_db.rollback();
+        return false;
+    }
+
+    int version = 0;
+    if (hasLegacyTable && !convertLegacyTable(migrations, version)) {
+        m_db.rollback();
+        return false;
+    }
+
+    if (!m_db.commit()) {
+        m_lastError = "Failed to commit schema_version table: " + m_db.lastError().text();
+        m_db.rollback();
+        return false;
+    }
+    m_appliedVersion = version;
+    return true;
+}
+
+bool MigrationManager::convertLegacyTable(const QVector<Migration>& migrations, int& version)
+{
+    // Older builds kept only the last applied file name in a one-row migrations table
+    QSqlQuery query(m_db);
+    if (!query.exec("SELECT name FROM migrations")) {
+        m_lastError = "Failed to read legacy migrations table: " + query.lastError().text();
+        return false;
+    }
+    QString lastFile = query.next() ? query.value(0).toString() : QString();
+    query.finish();
+    if (lastFile.isEmpty()) {
+        return true; // Created but nothing applied
+    }
+
+    int lastVersion = -1;
+    for (const Migration& migration : migrations) {
+        if (migration.name == lastFile) {
+            lastVersion = migration.version;
+            break;
         }
-        if (!query.exec("INSERT INTO migrations (name) VALUES ('')")) {
-            m_lastError = "Failed to init migrations table: " + query.lastError().text();
-            return;
+    }
+    if (lastVersion < 0) {
+        m_lastError = QString("Legacy migrations table names unknown migration '%1'").arg(lastFile);
+        return false;
+    }
+
+    for (const Migration& migration : migrations) {
+        if (migration.version > lastVersion) break;
+        if (!recordVersion(migration)) {
+            return false;
         }
-        m_lastFile = "";
-    } else {
-        if (query.next()) {
-             // Table exists, read last file
-             QSqlQuery q2(m_db);
-             if (q2.exec("SELECT name FROM migrations LIMIT 1")) {
-                 if (q2.next()) {
-                     m_lastFile = q2.value(0).toString();
-                 }
-             }
+    }
+
+    // The legacy table stays behind, untouched, for builds that still read it
+    version = lastVersion;
+    qDebug() << "Converted legacy migrations table, schema at version" << lastVersion;
+    return true;
+}
+
+bool MigrationManager::loadMigrations(QVector<Migration>& migrations)
+{
+    static const QRegularExpression namePattern("^(\\d+)_.*\\.sql$");
+
+    QDir dir(m_migrationsDir);
+    QStringList files = dir.entryList({"*.sql"}, QDir::Files, QDir::Name); // Sorted by name
+
+    migrations.clear();
+    for (const QString& fileName : files) {
+        QRegularExpressionMatch match = namePattern.match(fileName);
+        if (!match.hasMatch()) {
+            m_lastError = QString("Migration file name has no version number: %1").arg(fileName);
+            return false;
         }
+
+        QFile file(dir.filePath(fileName));
+        if (!file.open(QIODevice::ReadOnly)) {
+            m_lastError = "Cannot open migration file: " + file.fileName();
+            return false;
+        }
+
+        Migration migration;
+        migration.version = match.captured(1).toInt();
+        migration.name = fileName;
+        migration.path = file.fileName();
+        migration.content = file.readAll();
+        migration.checksum = QString::fromLatin1(QCryptographicHash::hash(migration.content, QCryptographicHash::Sha256).toHex());
+
+        if (!migrations.isEmpty() && migrations.last().version == migration.version) {
+            m_lastError = QString("Duplicate migration version %1: %2 and %3")
+                .arg(migration.version).arg(migrations.last().name).arg(fileName);
+            return false;
+        }
+        migrations.append(migration);
     }
+    return true;
 }
 
-bool MigrationManager::executeFile(const QString& filePath)
+void MigrationManager::verifyChecksums(const QVector<Migration>& migrations)
 {
-    QFile file(filePath);
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        m_lastError = "Cannot open migration file: " + filePath;
-        return false;
+    QSqlQuery query(m_db);
+    if (!query.exec("SELECT version, checksum FROM schema_version")) {
+        qWarning() << "Failed to read migration checksums:" << query.lastError().text();
+        return;
+    }
+    while (query.next()) {
+        int version = query.value(0).toInt();
+        for (const Migration& migration : migrations) {
+            if (migration.version == version && migration.checksum != query.value(1).toString()) {
+                // Already applied, so the edit never reached this database
+                qWarning() << "Migration" << migration.name << "changed after it was applied";
+            }
+        }
     }
+}
 
-    QString content = QString::fromUtf8(file.readAll());
-    QStringList statements;
-    
-    if (m_db.driverName() == "QSQLITE") {
-        statements = content.split("-- separator", Qt::SkipEmptyParts);
-    } else {
-        // For Postgres, usually one block is fine, or use same separator logic
-        // The example implies separator is for sqlite but let's support it generally
-        statements = content.split("-- separator", Qt::SkipEmptyParts);
+bool MigrationManager::apply(const Migration& migration)
+{
+    TRACE_SCOPE("db", "migrationFile");
+    if (!m_db.transaction()) {
+        m_lastError = "Failed to begin transaction: " + m_db.lastError().text();
+        return false;
     }
 
+    QStringList statements = QString::fromUtf8(migration.content).split("-- separator", Qt::SkipEmptyParts);
     for (const QString& stmt : statements) {
         QString trimmed = stmt.trimmed();
         if (trimmed.isEmpty()) continue;
-        
+
         QSqlQuery query(m_db);
         if (!query.exec(trimmed)) {
-            m_lastError = QString("Migration error in %1: %2").arg(filePath).arg(query.lastError().text());
+            m_lastError = QString("Migration error in %1: %2").arg(migration.path).arg(query.lastError().text());
             qCritical() << m_lastError;
+            m_db.rollback();
             return false;
         }
     }
-    
+
+    if (!recordVersion(migration)) {
+        m_db.rollback();
+        return false;
+    }
+    if (!m_db.commit()) {
+        m_lastError = QString("Failed to commit migration %1: %2").arg(migration.name).arg(m_db.lastError().text());
+        m_db.rollback();
+        return false;
+    }
     return true;
 }
 
+bool MigrationManager::recordVersion(const Migration& migration)
+{
+    QSqlQuery query(m_db);
+    query.prepare("INSERT INTO schema_version (version, name, checksum) VALUES (?, ?, ?)");
+    query.addBindValue(migration.version);
+    query.addBindValue(migration.name);
+    query.addBindValue(migration.checksum);
+    if (!query.exec()) {
+        m_lastError = "Failed to record migration: " + query.lastError().text();
+        return false;
+    }
+    return true;
+}
@@ -4,23 +4,49 @@
 #include <QString>
 #include <QStringList>
 #include <QSqlDatabase>
+#include <QVector>
 
+// Applies the numbered NNN_name.sql files of a migrations directory.
+//
+// Applied versions are recorded with a SHA-256 of their file in
+// schema_version; each file runs in its own transaction together with its
+// record, so a failing statement leaves the schema at the previous version.
+// When the database already holds kLatestVersion, migrate() is one
+// catalog lookup and one indexed read, without touching the files.
 class MigrationManager {
 public:
+    // Highest NNN under migrations/; bump it with every new migration file
+    static const int kLatestVersion = 8;
+
     MigrationManager(QSqlDatabase& db, const QString& migrationsDir);
-    
+
     bool migrate();
     QString getLastError() const { return m_lastError; }
 
+    int appliedVersion() const { return m_appliedVersion; }
+
 private:
-    void init();
-    bool executeFile(const QString& filePath);
-    
+    struct Migration {
+        int version;
+        QString name;     // File name
+        QString path;
+        QByteArray content;
+        QString checksum; // Hex SHA-256 of content
+    };
+
+    bool tableExists(const QString& table);
+    bool readAppliedVersion();
+    bool createVersionTable(const QVector<Migration>& migrations);
+    bool convertLegacyTable(const QVector<Migration>& migrations, int& version);
+    bool loadMigrations(QVector<Migration>& migrations);
+    void verifyChecksums(const QVector<Migration>& migrations);
+    bool apply(const Migration& migration);
+    bool recordVersion(const Migration& migration);
+
     QSqlDatabase& m_db;
     QString m_migrationsDir;
     QString m_lastError;
-    QString m_lastFile;
+    int m_appliedVersion;
 };
 
 #endif // MIGRATION_MANAGER_H
-
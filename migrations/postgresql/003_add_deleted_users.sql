@@ -0,0 +1,21 @@
+CREATE TABLE IF NOT EXISTS deleted_users (
+    id INTEGER PRIMARY KEY,
+    deleted_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP
+);
+-- separator
+CREATE OR REPLACE FUNCTION users_record_delete() RETURNS TRIGGER AS $$
+BEGIN
+    INSERT INTO deleted_users (id, deleted_at) VALUES (OLD.id, CURRENT_TIMESTAMP)
+    ON CONFLICT (id) DO UPDATE SET deleted_at = EXCLUDED.deleted_at;
+    RETURN OLD;
+END;
+$$ LANGUAGE plpgsql;
+-- separator
+DROP TRIGGER IF EXISTS users_record_delete ON users;
+-- separator
+CREATE TRIGGER users_record_delete AFTER DELETE ON users
+    FOR EACH ROW EXECUTE FUNCTION users_record_delete();
+-- separator
+CREATE INDEX IF NOT EXISTS idx_users_updated_at ON users (updated_at);
+-- separator
+CREATE INDEX IF NOT EXISTS idx_deleted_users_deleted_at ON deleted_users (deleted_at);
@@ -0,0 +1,7 @@
+-- Trigram GIN indexes serve ILIKE '%term%' on name and email.
+-- CREATE EXTENSION needs a role allowed to create it (pg_trgm is trusted from PostgreSQL 13).
+CREATE EXTENSION IF NOT EXISTS pg_trgm;
+-- separator
+CREATE INDEX IF NOT EXISTS idx_users_name_trgm ON users USING gin (name gin_trgm_ops);
+-- separator
+CREATE INDEX IF NOT EXISTS idx_users_email_trgm ON users USING gin (email gin_trgm_ops);
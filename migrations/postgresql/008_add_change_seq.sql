@@ -0,0 +1,48 @@
+-- Change feed sequence: every template write and every delete takes the next
+-- value and records its transaction id. nextval() runs before commit, so a
+-- lower value can become visible after a higher one; readers re-scan rows of
+-- transactions that were still running at their last read (change_xid, see
+-- DatabaseManager::fetchChangesSince). pg_current_xact_id() needs PostgreSQL 13.
+CREATE SEQUENCE IF NOT EXISTS user_change_seq;
+-- separator
+ALTER TABLE users ADD COLUMN IF NOT EXISTS change_seq BIGINT NOT NULL DEFAULT 0;
+-- separator
+ALTER TABLE users ADD COLUMN IF NOT EXISTS change_xid xid8;
+-- separator
+ALTER TABLE deleted_users ADD COLUMN IF NOT EXISTS change_seq BIGINT NOT NULL DEFAULT 0;
+-- separator
+ALTER TABLE deleted_users ADD COLUMN IF NOT EXISTS change_xid xid8;
+-- separator
+-- Existing rows are committed; their change_xid stays NULL
+UPDATE users SET change_seq = nextval('user_change_seq');
+-- separator
+CREATE OR REPLACE FUNCTION users_bump_change_seq() RETURNS TRIGGER AS $$
+BEGIN
+    NEW.change_xid := pg_current_xact_id();
+    NEW.change_seq := nextval('user_change_seq');
+    RETURN NEW;
+END;
+$$ LANGUAGE plpgsql;
+-- separator
+DROP TRIGGER IF EXISTS users_bump_change_seq ON users;
+-- separator
+CREATE TRIGGER users_bump_change_seq BEFORE INSERT OR UPDATE OF fingerprint_template ON users
+    FOR EACH ROW EXECUTE FUNCTION users_bump_change_seq();
+-- separator
+CREATE OR REPLACE FUNCTION users_record_delete() RETURNS TRIGGER AS $$
+BEGIN
+    INSERT INTO deleted_users (id, deleted_at, change_seq, change_xid)
+    VALUES (OLD.id, CURRENT_TIMESTAMP, nextval('user_change_seq'), pg_current_xact_id())
+    ON CONFLICT (id) DO UPDATE SET deleted_at = EXCLUDED.deleted_at,
+        change_seq = EXCLUDED.change_seq, change_xid = EXCLUDED.change_xid;
+    RETURN OLD;
+END;
+$$ LANGUAGE plpgsql;
+-- separator
+CREATE INDEX IF NOT EXISTS idx_users_change_seq ON users (change_seq);
+-- separator
+CREATE INDEX IF NOT EXISTS idx_users_change_xid ON users (change_xid);
+-- separator
+CREATE INDEX IF NOT EXISTS idx_deleted_users_change_seq ON deleted_users (change_seq);
+-- separator
+CREATE INDEX IF NOT EXISTS idx_deleted_users_change_xid ON deleted_users (change_xid);
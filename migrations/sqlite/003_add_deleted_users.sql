@@ -0,0 +1,13 @@
+CREATE TABLE IF NOT EXISTS deleted_users (
+    id INTEGER PRIMARY KEY,
+    deleted_at DATETIME DEFAULT CURRENT_TIMESTAMP
+);
+-- separator
+CREATE TRIGGER IF NOT EXISTS users_record_delete AFTER DELETE ON users
+BEGIN
+    INSERT OR REPLACE INTO deleted_users (id, deleted_at) VALUES (OLD.id, CURRENT_TIMESTAMP);
+END;
+-- separator
+CREATE INDEX IF NOT EXISTS idx_users_updated_at ON users (updated_at);
+-- separator
+CREATE INDEX IF NOT EXISTS idx_deleted_users_deleted_at ON deleted_users (deleted_at);
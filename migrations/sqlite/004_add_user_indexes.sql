@@ -0,0 +1,4 @@
+-- (name, id) matches the listing order and the keyset paging predicate
+CREATE INDEX IF NOT EXISTS idx_users_name_id ON users (name, id);
+-- separator
+ANALYZE;
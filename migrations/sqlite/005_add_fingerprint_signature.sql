@@ -0,0 +1,3 @@
+-- Coarse pre-filter signature (TemplateSignature bytes), written with the template.
+-- Existing rows are filled in by the application on the next gallery load.
+ALTER TABLE users ADD COLUMN fingerprint_signature BLOB;
@@ -0,0 +1,25 @@
+-- Trigram full-text index over name and email (needs SQLite 3.34+ with FTS5).
+-- External content: the index stores no copy of the text, users stays the source.
+CREATE VIRTUAL TABLE IF NOT EXISTS users_fts USING fts5(
+    name, email,
+    content='users', content_rowid='id',
+    tokenize='trigram'
+);
+-- separator
+CREATE TRIGGER IF NOT EXISTS users_fts_insert AFTER INSERT ON users
+BEGIN
+    INSERT INTO users_fts (rowid, name, email) VALUES (NEW.id, NEW.name, NEW.email);
+END;
+-- separator
+CREATE TRIGGER IF NOT EXISTS users_fts_delete AFTER DELETE ON users
+BEGIN
+    INSERT INTO users_fts (users_fts, rowid, name, email) VALUES ('delete', OLD.id, OLD.name, OLD.email);
+END;
+-- separator
+CREATE TRIGGER IF NOT EXISTS users_fts_update AFTER UPDATE OF name, email ON users
+BEGIN
+    INSERT INTO users_fts (users_fts, rowid, name, email) VALUES ('delete', OLD.id, OLD.name, OLD.email);
+    INSERT INTO users_fts (rowid, name, email) VALUES (NEW.id, NEW.name, NEW.email);
+END;
+-- separator
+INSERT INTO users_fts (users_fts) VALUES ('rebuild');
@@ -0,0 +1,16 @@
+-- Audit trail of verify and identify outcomes, written in batches by AccessLog.
+-- No foreign key on user_id: events outlive the user they name.
+CREATE TABLE IF NOT EXISTS access_events (
+    id INTEGER PRIMARY KEY AUTOINCREMENT,
+    occurred_at DATETIME NOT NULL,
+    kind TEXT NOT NULL,
+    result TEXT NOT NULL,
+    user_id INTEGER,
+    score INTEGER NOT NULL DEFAULT 0,
+    latency_ms INTEGER NOT NULL DEFAULT 0,
+    reader TEXT NOT NULL
+);
+-- separator
+CREATE INDEX IF NOT EXISTS idx_access_events_occurred_at ON access_events (occurred_at);
+-- separator
+CREATE INDEX IF NOT EXISTS idx_access_events_user ON access_events (user_id, occurred_at);
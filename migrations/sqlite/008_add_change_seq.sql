@@ -0,0 +1,38 @@
+-- Change feed sequence: every template write and every delete takes the next
+-- value. SQLite has a single writer, so values become visible in commit order.
+CREATE TABLE IF NOT EXISTS change_sequence (
+    value INTEGER NOT NULL
+);
+-- separator
+ALTER TABLE users ADD COLUMN change_seq INTEGER NOT NULL DEFAULT 0;
+-- separator
+ALTER TABLE deleted_users ADD COLUMN change_seq INTEGER NOT NULL DEFAULT 0;
+-- separator
+UPDATE users SET change_seq = id;
+-- separator
+INSERT INTO change_sequence (value) SELECT COALESCE(MAX(id), 0) FROM users;
+-- separator
+CREATE TRIGGER IF NOT EXISTS users_change_seq_insert AFTER INSERT ON users
+BEGIN
+    UPDATE change_sequence SET value = value + 1;
+    UPDATE users SET change_seq = (SELECT value FROM change_sequence) WHERE id = NEW.id;
+END;
+-- separator
+CREATE TRIGGER IF NOT EXISTS users_change_seq_update AFTER UPDATE OF fingerprint_template ON users
+BEGIN
+    UPDATE change_sequence SET value = value + 1;
+    UPDATE users SET change_seq = (SELECT value FROM change_sequence) WHERE id = NEW.id;
+END;
+-- separator
+DROP TRIGGER IF EXISTS users_record_delete;
+-- separator
+CREATE TRIGGER users_record_delete AFTER DELETE ON users
+BEGIN
+    UPDATE change_sequence SET value = value + 1;
+    INSERT OR REPLACE INTO deleted_users (id, deleted_at, change_seq)
+    VALUES (OLD.id, CURRENT_TIMESTAMP, (SELECT value FROM change_sequence));
+END;
+-- separator
+CREATE INDEX IF NOT EXISTS idx_users_change_seq ON users (change_seq);
+-- separator
+CREATE INDEX IF NOT EXISTS idx_deleted_users_change_seq ON deleted_users (change_seq);
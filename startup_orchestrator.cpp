@@ -0,0 +1,122 @@
+#include "startup_orchestrator.h"
+#include "database_manager.h"
+#include "template_gallery.h"
+#include "device_worker.h"
+#include "metrics.h"
+#include <QtConcurrent>
+#include <QDebug>
+
+StartupOrchestrator::StartupOrchestrator(DatabaseManager* dbManager, TemplateGallery* gallery, DeviceWorker* device,
+                                         QObject* parent)
+    : QObject(parent)
+    , m_dbManager(dbManager)
+    , m_gallery(gallery)
+    , m_device(device)
+{
+    for (int i = 0; i < SubsystemCount; ++i) {
+        m_state[i] = Idle;
+        m_elapsed[i] = -1;
+    }
+
+    connect(&m_schema, &QFutureWatcher<QString>::finished, this, &StartupOrchestrator::onSchemaReady);
+    connect(m_gallery, &TemplateGallery::loadFinished, this, &StartupOrchestrator::onGalleryLoaded);
+    connect(m_device, &DeviceWorker::readerInitialized, this, &StartupOrchestrator::onReaderInitialized);
+}
+
+StartupOrchestrator::~StartupOrchestrator()
+{
+    waitForFinished();
+}
+
+const char* StartupOrchestrator::subsystemName(Subsystem subsystem)
+{
+    switch (subsystem) {
+    case Database: return "database";
+    case Gallery: return "gallery";
+    case Reader: return "reader";
+    default: return "unknown";
+    }
+}
+
+void StartupOrchestrator::start(const DatabaseConfigDialog::Config& config)
+{
+    m_config = config;
+    m_clock.start();
+    for (int i = 0; i < SubsystemCount; ++i) {
+        m_state[i] = Pending;
+        m_elapsed[i] = -1;
+    }
+
+    // USB enumeration and reader open take longest, start them first
+    m_device->initializeReader();
+
+    // Migrations run against a private connection: a QSqlDatabase belongs to
+    // the thread that opened it, so the UI connection is opened afterwards
+    m_schema.setFuture(QtConcurrent::run([config]() {
+        DatabaseManager schema;
+        return schema.initialize(config) ? QString() : schema.getLastError();
+    }));
+}
+
+void StartupOrchestrator::waitForFinished()
+{
+    m_schema.waitForFinished();
+}
+
+void StartupOrchestrator::onSchemaReady()
+{
+    QString error = m_schema.result();
+    // Schema is current now, so this is the migration fast path
+    if (error.isEmpty() && !m_dbManager->initialize(m_config)) {
+        error = m_dbManager->getLastError();
+    }
+
+    bool ok = error.isEmpty();
+    settle(Database, ok, error);
+    if (!ok) {
+        settle(Gallery, false, "Database unavailable");
+        return;
+    }
+
+    m_gallery->applyDatabaseDefaults();
+    m_gallery->loadAsync();
+}
+
+void StartupOrchestrator::onGalleryLoaded(bool ok, const QString& error)
+{
+    if (isPending(Gallery)) {
+        settle(Gallery, ok, error);
+    }
+}
+
+void StartupOrchestrator::onReaderInitialized(bool ok, const QString& error)
+{
+    if (isPending(Reader)) {
+        settle(Reader, ok, error);
+    }
+}
+
+void StartupOrchestrator::settle(Subsystem subsystem, bool ok, const QString& error)
+{
+    qint64 elapsed = m_clock.elapsed();
+    m_state[subsystem] = ok ? Ready : Failed;
+    m_elapsed[subsystem] = elapsed;
+
+    Metrics::gauge("fp_startup_milliseconds", "Time from launch to each subsystem settling.",
+                   QString("subsystem=\"%1\"").arg(subsystemName(subsystem)))->set(elapsed);
+    qInfo() << "Startup:" << subsystemName(subsystem) << (ok ? "ready" : "failed") << "after" << elapsed << "ms";
+    emit subsystemReady(subsystem, ok, error, elapsed);
+
+    bool allReady = true;
+    bool allSettled = true;
+    for (int i = 0; i < SubsystemCount; ++i) {
+        allReady = allReady && m_state[i] == Ready;
+        allSettled = allSettled && m_state[i] != Pending;
+    }
+    if (allReady) {
+        emit terminalReady(elapsed);
+    }
+    if (allSettled) {
+        emit finished(elapsed);
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef STARTUP_ORCHESTRATOR_H
+#define STARTUP_ORCHESTRATOR_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QString>
+
+#include "database_config_dialog.h"
+
+class DatabaseManager;
+class TemplateGallery;
+class DeviceWorker;
+
+// Brings the terminal up in the background once the window is showing.
+//
+//   reader:   FingerprintManager init + open on the device thread
+//   database: open and migrate on a pool thread (own connection), then a
+//             fast-path open of the UI thread connection
+//   gallery:  after the database; rows read and decoded on a pool thread
+//
+// The reader overlaps the other two. Each subsystem reports once through
+// subsystemReady(); terminalReady() fires when all three are up.
+class StartupOrchestrator : public QObject {
+    Q_OBJECT
+
+public:
+    enum Subsystem { Database, Gallery, Reader, SubsystemCount };
+    Q_ENUM(Subsystem)
+
+    StartupOrchestrator(DatabaseManager* dbManager, TemplateGallery* gallery, DeviceWorker* device,
+                        QObject* parent = nullptr);
+    ~StartupOrchestrator() override;
+
+    void start(const DatabaseConfigDialog::Config& config);
+    void waitForFinished(); // Joins the schema step (call before the database goes away)
+
+    bool isPending(Subsystem subsystem) const { return m_state[subsystem] == Pending; }
+    bool isReady(Subsystem subsystem) const { return m_state[subsystem] == Ready; }
+    qint64 readyAfter(Subsystem subsystem) const { return m_elapsed[subsystem]; } // ms since start(), -1 until settled
+
+    static const char* subsystemName(Subsystem subsystem);
+
+signals:
+    void subsystemReady(StartupOrchestrator::Subsystem subsystem, bool ok, const QString& error, qint64 elapsedMs);
+    void terminalReady(qint64 elapsedMs); // Accepting fingers
+    void finished(qint64 elapsedMs);      // Every subsystem settled, ok or not
+
+private slots:
+    void onSchemaReady();
+    void onGalleryLoaded(bool ok, const QString& error);
+    void onReaderInitialized(bool ok, const QString& error);
+
+private:
+    enum State { Idle, Pending, Ready, Failed };
+
+    void settle(Subsystem subsystem, bool ok, const QString& error);
+
+    DatabaseManager* m_dbManager;
+    TemplateGallery* m_gallery;
+    DeviceWorker* m_device;
+
+    DatabaseConfigDialog::Config m_config;
+    QFutureWatcher<QString> m_schema; // Empty string on success
+    QElapsedTimer m_clock;
+    State m_state[SubsystemCount];
+    qint64 m_elapsed[SubsystemCount];
+};
+
+#endif // STARTUP_ORCHESTRATOR_H
@@ -0,0 +1,507 @@
+#include "template_gallery.h"
+#include "database_manager.h"
+#include "gallery_cache.h"
+#include "trace.h"
+#include "metrics.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QtConcurrent>
+
+TemplateGallery::TemplateGallery(DatabaseManager* dbManager, QObject* parent)
+    : QObject(parent)
+    , m_dbManager(dbManager)
+    , m_templatesMapped(false)
+    , m_loaded(false)
+    , m_watermarkKnown(false)
+    , m_loadGeneration(0)
+{
+    connect(m_dbManager, &DatabaseManager::userAdded, this, &TemplateGallery::onUserAdded);
+    connect(m_dbManager, &DatabaseManager::userFingerprintUpdated, this, &TemplateGallery::onUserFingerprintUpdated);
+    connect(m_dbManager, &DatabaseManager::userDeleted, this, &TemplateGallery::onUserDeleted);
+    connect(m_dbManager, &DatabaseManager::usersImported, this, [this]() {
+        if (isLoaded()) load(); // Bulk imports skip per-row signals
+    });
+    connect(this, &TemplateGallery::galleryChanged, this, [](int count) {
+        static Metrics::Gauge* const size = Metrics::gauge("fp_gallery_templates", "Enrolled templates in the resident gallery.");
+        size->set(count);
+    });
+
+    // Enrollment bursts are coalesced into one rewrite
+    m_cacheTimer.setSingleShot(true);
+    m_cacheTimer.setInterval(30000);
+    connect(&m_cacheTimer, &QTimer::timeout, this, &TemplateGallery::writeCache);
+
+    connect(&m_syncTimer, &QTimer::timeout, this, &TemplateGallery::syncChanges);
+}
+
+void TemplateGallery::setSyncInterval(int msec)
+{
+    if (msec > 0) {
+        m_syncTimer.start(msec);
+    } else {
+        m_syncTimer.stop();
+    }
+}
+
+void TemplateGallery::applyDatabaseDefaults()
+{
+    QString dbPath = m_dbManager->databaseFilePath();
+    setCacheFile(dbPath.isEmpty() ? QString() : dbPath + ".gallery");
+    // Other processes (GUI, other daemons) write the same database file, and a
+    // deleted user must stop matching here too; change_seq keeps the poll cheap
+    setSyncInterval(dbPath.isEmpty() ? 15000 : 2000);
+}
+
+void TemplateGallery::flushCache()
+{
+    if (m_cacheTimer.isActive()) {
+        writeCache();
+    }
+}
+
+void TemplateGallery::setCacheFile(const QString& path)
+{
+    m_cacheTimer.stop();
+    m_cachePath = path;
+}
+
+bool TemplateGallery::load()
+{
+    TRACE_SCOPE("gallery", "load");
+    waitForLoad();
+    ++m_loadGeneration; // A background load finishing later is stale now
+
+    if (!beginLoad()) {
+        return true; // Served from the cache file
+    }
+
+    DatabaseLoad loaded = readDatabase(m_dbManager);
+    if (!loaded.ok) {
+        return false;
+    }
+    install(loaded);
+    return true;
+}
+
+void TemplateGallery::loadAsync()
+{
+    waitForLoad();
+    int generation = ++m_loadGeneration;
+
+    if (!beginLoad()) {
+        emit loadFinished(true, QString());
+        return;
+    }
+
+    // Rows are fetched on a per-thread clone connection and decoded off the UI thread
+    DatabaseManager* dbManager = m_dbManager;
+    QFutureWatcher<DatabaseLoad>* watcher = new QFutureWatcher<DatabaseLoad>(this);
+    connect(watcher, &QFutureWatcher<DatabaseLoad>::finished, this, [this, watcher, generation]() {
+        DatabaseLoad loaded = watcher->result();
+        watcher->deleteLater();
+        if (generation != m_loadGeneration) {
+            return; // Superseded by load(), loadAsync() or clear()
+        }
+        if (!loaded.ok) {
+            emit loadFinished(false, loaded.error);
+            return;
+        }
+        install(loaded);
+        // Writes that landed while the rows were read; the cursor predates the read
+        if (!m_syncCursor.isEmpty()) {
+            syncChanges();
+        }
+        emit loadFinished(true, QString());
+    });
+    m_loading = QtConcurrent::run(&TemplateGallery::readDatabase, dbManager);
+    watcher->setFuture(m_loading);
+}
+
+void TemplateGallery::waitForLoad()
+{
+    m_loading.waitForFinished();
+}
+
+bool TemplateGallery::beginLoad()
+{
+    m_cacheTimer.stop();
+
+    // Cursor first: anything written while loading is replayed by the next sync
+    if (!m_dbManager->changeCursor(m_syncCursor)) {
+        m_syncCursor.clear();
+    }
+
+    return m_cachePath.isEmpty() || !loadFromCache();
+}
+
+TemplateGallery::DatabaseLoad TemplateGallery::readDatabase(DatabaseManager* dbManager)
+{
+    TRACE_SCOPE("gallery", "readDatabase");
+    DatabaseLoad loaded;
+    QElapsedTimer timer;
+    timer.start();
+
+    QMap<int, QByteArray> stored;
+    if (!dbManager->getAllTemplates(loaded.templates, &stored, &loaded.watermark)) {
+        loaded.error = dbManager->getLastError();
+        return loaded;
+    }
+
+    // Decode outside the lock, identification keeps using the old snapshot meanwhile
+    for (auto it = loaded.templates.constBegin(); it != loaded.templates.constEnd(); ++it) {
+        FingerprintTemplate fp = FingerprintTemplate::fromSerialized(it.value());
+        if (!fp.isValid()) continue;
+
+        loaded.decoded.insert(it.key(), fp);
+        TemplateSignature signature = TemplateSignature::fromBytes(stored.value(it.key()));
+        if (signature.isNull()) {
+            signature = fp.signature();
+            loaded.missingSignatures.insert(it.key(), signature.toBytes());
+        }
+        loaded.signatures.insert(it.key(), signature);
+    }
+
+    loaded.elapsedMs = timer.elapsed();
+    loaded.ok = true;
+    return loaded;
+}
+
+void TemplateGallery::install(const DatabaseLoad& loaded)
+{
+    int count = loaded.templates.size();
+    {
+        QWriteLocker locker(&m_lock);
+        m_templates = loaded.templates;
+        m_templatesMapped = false;
+        m_decoded = loaded.decoded;
+        m_signatures = loaded.signatures;
+        m_snapshot.reset();
+        m_watermark = loaded.watermark;
+        m_watermarkKnown = true;
+        m_loaded = true;
+    }
+    m_cache.reset(); // templates() only hands out copies, so nothing else points into the mapping
+
+    qDebug() << "Gallery loaded:" << count << "templates (" << loaded.decoded.size() << "decoded) in" << loaded.elapsedMs << "ms";
+    emit galleryChanged(count);
+
+    if (!loaded.missingSignatures.isEmpty()) {
+        if (m_dbManager->updateSignatures(loaded.missingSignatures)) {
+            qDebug() << "Stored pre-filter signatures for" << loaded.missingSignatures.size() << "users";
+        } else {
+            qWarning() << "Failed to store pre-filter signatures:" << m_dbManager->getLastError();
+        }
+    }
+
+    if (!m_cachePath.isEmpty()) {
+        writeCache();
+    }
+}
+
+bool TemplateGallery::loadFromCache()
+{
+    TRACE_SCOPE("gallery", "loadFromCache");
+    QElapsedTimer timer;
+    timer.start();
+
+    GalleryWatermark current;
+    if (!m_dbManager->getGalleryWatermark(current)) {
+        return false;
+    }
+
+    QScopedPointer<GalleryCache> cache(new GalleryCache());
+    if (!cache->open(m_cachePath)) {
+        qDebug() << "Gallery cache not used:" << cache->getLastError();
+        return false;
+    }
+    if (cache->watermark() != current) {
+        qDebug() << "Gallery cache is stale, reloading from database";
+        return false;
+    }
+
+    QMap<int, QByteArray> templates;
+    QMap<int, FingerprintTemplate> decoded;
+    QMap<int, TemplateSignature> signatures;
+    if (!cache->read(templates, decoded, signatures)) {
+        qWarning() << "Gallery cache is corrupt, reloading from database";
+        return false;
+    }
+    for (auto it = decoded.constBegin(); it != decoded.constEnd(); ++it) {
+        if (!signatures.contains(it.key())) {
+            signatures.insert(it.key(), it.value().signature());
+        }
+    }
+
+    int count = templates.size();
+    {
+        QWriteLocker locker(&m_lock);
+        m_templates = templates;
+        m_templatesMapped = true;
+        m_decoded = decoded;
+        m_signatures = signatures;
+        m_snapshot.reset();
+        m_watermark = current;
+        m_watermarkKnown = true;
+        m_loaded = true;
+    }
+    m_cache.swap(cache); // Previous mapping released once the new one is installed
+
+    qDebug() << "Gallery loaded from cache:" << count << "templates in" << timer.elapsed() << "ms";
+    emit galleryChanged(count);
+    return true;
+}
+
+bool TemplateGallery::syncChanges()
+{
+    TRACE_SCOPE("gallery", "syncChanges");
+    if (!isLoaded()) return false;
+    if (m_syncCursor.isEmpty()) {
+        return load(); // No cursor from the last load, start over
+    }
+
+    // Watermark first: once the changes below are applied the gallery holds at
+    // least this state, and anything written meanwhile only makes it newer
+    GalleryWatermark watermark;
+    bool watermarkKnown = m_dbManager->getGalleryWatermark(watermark);
+
+    QVector<UserChange> changes;
+    QString nextCursor;
+    if (!m_dbManager->fetchChangesSince(m_syncCursor, changes, nextCursor)) {
+        qWarning() << "Gallery sync failed:" << m_dbManager->getLastError();
+        return false;
+    }
+    m_syncCursor = nextCursor;
+
+    // The feed overlaps on purpose; keep only real differences and decode them unlocked
+    QList<UserChange> pending;
+    {
+        QReadLocker locker(&m_lock);
+        for (const UserChange& change : changes) {
+            auto it = m_templates.constFind(change.id);
+            bool present = it != m_templates.constEnd();
+            if (change.deleted || change.fingerprintTemplate.isEmpty()) {
+                if (present) pending.append(change);
+            } else if (!present || it.value() != change.fingerprintTemplate) {
+                pending.append(change);
+            }
+        }
+    }
+    if (pending.isEmpty()) {
+        // Writes this process made were already patched in from signals
+        if (watermarkKnown) {
+            bool advanced;
+            {
+                QWriteLocker locker(&m_lock);
+                advanced = !m_watermarkKnown || m_watermark != watermark;
+                m_watermark = watermark;
+                m_watermarkKnown = true;
+            }
+            if (advanced) scheduleCacheWrite();
+        }
+        return true;
+    }
+
+    QMap<int, FingerprintTemplate> decoded;
+    QMap<int, TemplateSignature> signatures;
+    for (const UserChange& change : pending) {
+        if (!change.deleted && !change.fingerprintTemplate.isEmpty()) {
+            FingerprintTemplate fp = FingerprintTemplate::fromSerialized(change.fingerprintTemplate);
+            decoded.insert(change.id, fp);
+            signatures.insert(change.id, fp.signature());
+        }
+    }
+
+    int count;
+    {
+        QWriteLocker locker(&m_lock);
+        for (const UserChange& change : pending) {
+            if (change.deleted || change.fingerprintTemplate.isEmpty()) {
+                m_templates.remove(change.id);
+                m_decoded.remove(change.id);
+                m_signatures.remove(change.id);
+                continue;
+            }
+
+            m_templates.insert(change.id, change.fingerprintTemplate);
+            FingerprintTemplate fp = decoded.value(change.id);
+            if (fp.isValid()) {
+                m_decoded.insert(change.id, fp);
+                m_signatures.insert(change.id, signatures.value(change.id));
+            } else {
+                m_decoded.remove(change.id);
+                m_signatures.remove(change.id);
+            }
+        }
+        m_snapshot.reset();
+        m_watermark = watermark;
+        m_watermarkKnown = watermarkKnown;
+        count = m_templates.size();
+    }
+
+    qDebug() << "Gallery sync applied" << pending.size() << "changes";
+    scheduleCacheWrite();
+    emit galleryChanged(count);
+    emit changesSynced(pending.size());
+    return true;
+}
+
+void TemplateGallery::scheduleCacheWrite()
+{
+    if (!m_cachePath.isEmpty()) {
+        m_cacheTimer.start();
+    }
+}
+
+void TemplateGallery::writeCache()
+{
+    TRACE_SCOPE("gallery", "writeCache");
+    m_cacheTimer.stop();
+    if (m_cachePath.isEmpty() || !isLoaded()) return;
+
+    // Stamped with the watermark taken when these templates were read or
+    // last synced, never a fresh one: writes that landed since then (other
+    // processes, imports whose signal is still queued) may be missing here.
+    // Local patches since then only make the file newer than its stamp,
+    // which the next warm start treats as stale.
+    GalleryWatermark watermark;
+    QMap<int, QByteArray> templates;
+    QMap<int, FingerprintTemplate> decoded;
+    QMap<int, TemplateSignature> signatures;
+    {
+        QReadLocker locker(&m_lock);
+        if (!m_watermarkKnown) {
+            qDebug() << "Gallery cache not written: watermark unknown until the next sync";
+            return;
+        }
+        watermark = m_watermark;
+        templates = m_templates;
+        decoded = m_decoded;
+        signatures = m_signatures;
+    }
+
+    QString error;
+    if (!GalleryCache::write(m_cachePath, watermark, templates, decoded, signatures, &error)) {
+        qWarning() << error;
+    }
+}
+
+bool TemplateGallery::isLoaded() const
+{
+    QReadLocker locker(&m_lock);
+    return m_loaded;
+}
+
+int TemplateGallery::size() const
+{
+    QReadLocker locker(&m_lock);
+    return m_templates.size();
+}
+
+QMap<int, QByteArray> TemplateGallery::templates() const
+{
+    {
+        QReadLocker locker(&m_lock);
+        if (!m_templatesMapped) return m_templates;
+    }
+
+    // Callers pass templates to other threads (library identify), which may
+    // still read them after a reload has unmapped the cache file
+    QWriteLocker locker(&m_lock);
+    if (m_templatesMapped) {
+        TRACE_SCOPE("gallery", "copyMappedTemplates");
+        for (auto it = m_templates.begin(); it != m_templates.end(); ++it) {
+            it.value() = QByteArray(it.value().constData(), it.value().size());
+        }
+        m_templatesMapped = false;
+    }
+    return m_templates;
+}
+
+GallerySnapshot TemplateGallery::snapshot() const
+{
+    {
+        QReadLocker locker(&m_lock);
+        if (m_snapshot) return m_snapshot;
+    }
+
+    QWriteLocker locker(&m_lock);
+    if (!m_snapshot) {
+        TRACE_SCOPE("gallery", "buildSnapshot");
+        // Contiguous copy so matcher threads walk memory linearly
+        QVector<GalleryEntry>* entries = new QVector<GalleryEntry>();
+        entries->reserve(m_decoded.size());
+        for (auto it = m_decoded.constBegin(); it != m_decoded.constEnd(); ++it) {
+            GalleryEntry entry = { it.key(), it.value(), m_signatures.value(it.key()) };
+            entries->append(entry);
+        }
+        m_snapshot = GallerySnapshot(entries);
+    }
+    return m_snapshot;
+}
+
+void TemplateGallery::clear()
+{
+    ++m_loadGeneration;
+    {
+        QWriteLocker locker(&m_lock);
+        m_templates.clear();
+        m_templatesMapped = false;
+        m_decoded.clear();
+        m_signatures.clear();
+        m_snapshot.reset();
+        m_watermarkKnown = false;
+        m_loaded = false;
+    }
+    m_cacheTimer.stop();
+    m_cache.reset();
+    m_syncCursor.clear();
+    emit galleryChanged(0);
+}
+
+void TemplateGallery::onUserAdded(int userId, const QByteArray& fingerprintTemplate)
+{
+    onUserFingerprintUpdated(userId, fingerprintTemplate);
+}
+
+void TemplateGallery::onUserFingerprintUpdated(int userId, const QByteArray& fingerprintTemplate)
+{
+    if (fingerprintTemplate.isEmpty()) {
+        return;
+    }
+
+    FingerprintTemplate decoded = FingerprintTemplate::fromSerialized(fingerprintTemplate);
+    TemplateSignature signature = decoded.signature();
+
+    int count;
+    {
+        QWriteLocker locker(&m_lock);
+        if (!m_loaded) return; // Picked up by the next full load
+        m_templates.insert(userId, fingerprintTemplate);
+        if (decoded.isValid()) {
+            m_decoded.insert(userId, decoded);
+            m_signatures.insert(userId, signature);
+        } else {
+            m_decoded.remove(userId);
+            m_signatures.remove(userId);
+        }
+        m_snapshot.reset();
+        count = m_templates.size();
+    }
+    scheduleCacheWrite();
+    emit galleryChanged(count);
+}
+
+void TemplateGallery::onUserDeleted(int userId)
+{
+    int count;
+    {
+        QWriteLocker locker(&m_lock);
+        if (m_templates.remove(userId) == 0) return;
+        m_decoded.remove(userId);
+        m_signatures.remove(userId);
+        m_snapshot.reset();
+        count = m_templates.size();
+    }
+    scheduleCacheWrite();
+    emit galleryChanged(count);
+}
@@ -0,0 +1,113 @@
+#ifndef TEMPLATE_GALLERY_H
+#define TEMPLATE_GALLERY_H
+
+#include <QObject>
+#include <QMap>
+#include <QByteArray>
+#include <QReadWriteLock>
+#include <QScopedPointer>
+#include <QTimer>
+#include <QFuture>
+
+#include "match_engine.h"
+
+class DatabaseManager;
+class GalleryCache;
+
+// Long-lived 1:N gallery (user id -> fingerprint template).
+// Loaded once from the database and then patched from DatabaseManager
+// change signals, so identification no longer re-reads every row per scan.
+// With a cache file set, load() maps it instead when its watermark still
+// matches the database and rewrites it after changes settle.
+// With a sync interval set, changes made by other clients of a shared
+// database are pulled from the change feed and patched in.
+class TemplateGallery : public QObject {
+    Q_OBJECT
+
+public:
+    explicit TemplateGallery(DatabaseManager* dbManager, QObject* parent = nullptr);
+
+    // Empty path disables the cache; takes effect on the next load()
+    void setCacheFile(const QString& path);
+    QString cacheFile() const { return m_cachePath; }
+    void flushCache(); // Writes a pending cache update now (call before the database goes away)
+
+    // 0 disables periodic delta sync
+    void setSyncInterval(int msec);
+
+    // SQLite: cache file beside the database and 2 s sync; PostgreSQL: 15 s sync.
+    // Both backends can be shared, so sync is never off by default.
+    void applyDatabaseDefaults();
+
+    bool load(); // Full (re)load from cache or database
+    // Same, with the database read and decode on a pool thread; ends in loadFinished()
+    void loadAsync();
+    void waitForLoad(); // Joins a background read (call before the database goes away)
+    bool isLoaded() const;
+    int size() const;
+
+    // Implicitly shared snapshot, cheap to copy and safe to hand to worker threads.
+    // After a cache load the first call copies the templates out of the mapping.
+    QMap<int, QByteArray> templates() const;
+
+    // Pre-decoded templates for MatchEngine; rebuilt lazily after changes
+    GallerySnapshot snapshot() const;
+
+public slots:
+    void clear();
+    bool syncChanges(); // Applies changes since the last load/sync
+    void onUserAdded(int userId, const QByteArray& fingerprintTemplate);
+    void onUserFingerprintUpdated(int userId, const QByteArray& fingerprintTemplate);
+    void onUserDeleted(int userId);
+
+signals:
+    void galleryChanged(int size);
+    void changesSynced(int changed); // Only emitted when something was applied
+    void loadFinished(bool ok, const QString& error);
+
+private slots:
+    void writeCache();
+
+private:
+    struct DatabaseLoad {
+        bool ok = false;
+        QString error;
+        QMap<int, QByteArray> templates;
+        QMap<int, FingerprintTemplate> decoded;
+        QMap<int, TemplateSignature> signatures;
+        QMap<int, QByteArray> missingSignatures; // Rows enrolled before signatures existed
+        GalleryWatermark watermark; // Read together with the rows
+        qint64 elapsedMs = 0;
+    };
+
+    bool beginLoad(); // False when the cache file served the load
+    static DatabaseLoad readDatabase(DatabaseManager* dbManager); // Any thread
+    void install(const DatabaseLoad& loaded);
+    bool loadFromCache();
+    void scheduleCacheWrite();
+
+    DatabaseManager* m_dbManager;
+    mutable QReadWriteLock m_lock;
+    mutable QMap<int, QByteArray> m_templates;
+    mutable bool m_templatesMapped; // m_templates are views into m_cache, never handed out
+    QMap<int, FingerprintTemplate> m_decoded;
+    QMap<int, TemplateSignature> m_signatures; // Same keys as m_decoded
+    mutable GallerySnapshot m_snapshot;
+    bool m_loaded;
+
+    // Database state the templates are known to include; stamped into the cache
+    GalleryWatermark m_watermark;
+    bool m_watermarkKnown;
+
+    QString m_cachePath;
+    QScopedPointer<GalleryCache> m_cache; // Backs m_templates while m_templatesMapped
+    QTimer m_cacheTimer;
+
+    QString m_syncCursor;
+    QTimer m_syncTimer;
+
+    QFuture<DatabaseLoad> m_loading;
+    int m_loadGeneration;
+};
+
+#endif // TEMPLATE_GALLERY_H
@@ -0,0 +1,125 @@
+// Checks that a resident gallery drops users deleted by another process.
+//
+//   qmake6 test_gallery_sync.pro && make
+//   ./bin/test_gallery_sync
+//
+// The daemon's gallery sits on one DatabaseManager; a second DatabaseManager
+// on the same SQLite file stands in for the GUI (or another daemon). After
+// the second one deletes an enrolled user, the gallery's default change-feed
+// sync must pick the deletion up and identify() must stop matching that
+// user. Exits non-zero on the first failure.
+
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <QVector>
+#include <cstdio>
+
+#include "database_manager.h"
+#include "fingerprint_template.h"
+#include "template_gallery.h"
+#include "match_engine.h"
+#include "test_support.h"
+
+namespace {
+
+const int kThreshold = 40;
+const int kSyncWaitMsec = 10000; // Several default SQLite sync intervals
+
+DatabaseConfigDialog::Config sqliteConfig(const QString& path)
+{
+    DatabaseConfigDialog::Config config;
+    config.type = "SQLITE";
+    config.port = 0;
+    config.name = path;
+    return config;
+}
+
+// Runs the event loop until the gallery applies a change or the wait runs out
+bool waitForSync(TemplateGallery& gallery)
+{
+    QEventLoop loop;
+    QTimer timeout;
+    timeout.setSingleShot(true);
+    QObject::connect(&timeout, &QTimer::timeout, &loop, &QEventLoop::quit);
+    QObject::connect(&gallery, &TemplateGallery::changesSynced, &loop, &QEventLoop::quit);
+    timeout.start(kSyncWaitMsec);
+    loop.exec();
+    return timeout.isActive();
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QTemporaryDir dir;
+    if (!dir.isValid()) {
+        std::printf("FAIL: cannot create a temporary directory\n");
+        return 1;
+    }
+    QString path = dir.filePath("gallery_sync.db");
+
+    DatabaseManager daemonDb;
+    if (!daemonDb.initialize(sqliteConfig(path))) {
+        std::printf("FAIL: daemon database: %s\n", qPrintable(daemonDb.getLastError()));
+        return 1;
+    }
+
+    QByteArray enrolled = syntheticTemplate(1);
+    int deletedId = 0;
+    int keptId = 0;
+    if (!daemonDb.addUser("deleted", "", enrolled, deletedId)
+        || !daemonDb.addUser("kept", "", syntheticTemplate(2), keptId)) {
+        std::printf("FAIL: enroll: %s\n", qPrintable(daemonDb.getLastError()));
+        return 1;
+    }
+
+    TemplateGallery gallery(&daemonDb);
+    gallery.applyDatabaseDefaults();
+    if (!gallery.load()) {
+        std::printf("FAIL: gallery load: %s\n", qPrintable(daemonDb.getLastError()));
+        return 1;
+    }
+
+    MatchEngine engine;
+    FingerprintTemplate probe = FingerprintTemplate::fromSerialized(enrolled);
+    MatchResult before = engine.identify(probe, gallery.snapshot(), kThreshold);
+    if (before.userId != deletedId) {
+        std::printf("FAIL: enrolled user not identified before the delete (got %d, score %d)\n", before.userId, before.score);
+        return 1;
+    }
+    std::printf("ok: user %d identified, score %d\n", before.userId, before.score);
+
+    // Another process on the same file; the daemon's manager sees no signal
+    DatabaseManager otherDb;
+    if (!otherDb.initialize(sqliteConfig(path))) {
+        std::printf("FAIL: second database: %s\n", qPrintable(otherDb.getLastError()));
+        return 1;
+    }
+    if (!otherDb.deleteUser(deletedId)) {
+        std::printf("FAIL: delete: %s\n", qPrintable(otherDb.getLastError()));
+        return 1;
+    }
+
+    if (!waitForSync(gallery)) {
+        std::printf("FAIL: gallery did not sync within %d ms\n", kSyncWaitMsec);
+        return 1;
+    }
+
+    MatchResult after = engine.identify(probe, gallery.snapshot(), kThreshold);
+    if (after.userId == deletedId) {
+        std::printf("FAIL: deleted user %d still identified, score %d\n", after.userId, after.score);
+        return 1;
+    }
+    if (gallery.size() != 1) {
+        std::printf("FAIL: gallery holds %d templates, expected 1\n", gallery.size());
+        return 1;
+    }
+    std::printf("ok: deleted user no longer identified (got %d, score %d)\n", after.userId, after.score);
+
+    gallery.flushCache();
+    return 0;
+}
@@ -0,0 +1,51 @@
+# Resident gallery vs. deletes from another process (no reader needed)
+#   qmake6 test_gallery_sync.pro && make
+#   ./bin/test_gallery_sync
+
+QT += core sql widgets concurrent
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = test_gallery_sync
+TEMPLATE = app
+
+DESTDIR = bin
+
+macx {
+    INCLUDEPATH += /opt/homebrew/include/glib-2.0 \
+                   /opt/homebrew/lib/glib-2.0/include
+    LIBS += -L/opt/homebrew/lib -lglib-2.0
+}
+
+unix:!macx {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += glib-2.0
+}
+
+SOURCES += \
+    test_gallery_sync.cpp \
+    database_manager.cpp \
+    migration_manager.cpp \
+    template_gallery.cpp \
+    gallery_cache.cpp \
+    fingerprint_template.cpp \
+    test_support.cpp \
+    trace.cpp \
+    metrics.cpp \
+    match_engine.cpp \
+    user_archive.cpp
+
+HEADERS += \
+    database_manager.h \
+    migration_manager.h \
+    template_gallery.h \
+    gallery_cache.h \
+    fingerprint_template.h \
+    test_support.h \
+    trace.h \
+    metrics.h \
+    match_engine.h \
+    user_archive.h
+
+RESOURCES += migrations.qrc
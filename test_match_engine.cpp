@@ -0,0 +1,122 @@
+// Checks that MatchEngine returns the gallery's best match, not a chunk's.
+//
+//   qmake6 test_match_engine.pro && make
+//   ./bin/test_match_engine
+//
+// A weaker false match (above the threshold) sits in the first chunk and the
+// true match in a later one, with one-entry chunks spread over four workers.
+// Every pass, with or without an early-stop score above the false match, must
+// come back with the true match; repeated passes guard against thread-timing
+// luck. Exits non-zero on the first failure.
+
+#include <QCoreApplication>
+#include <QVector>
+#include <cstdio>
+
+#include "fingerprint_template.h"
+#include "match_engine.h"
+#include "test_support.h"
+
+namespace {
+
+const int kThreshold = 40;
+const int kGallerySize = 64;
+const int kReplaced = 10; // Of 40 minutiae per print, taken from another finger
+const int kPasses = 20;
+
+// Same finger with part of every print swapped out: matches, but below the original
+FingerprintTemplate weakerMatch(int finger, quint32 seed)
+{
+    QVector<QVector<Minutia>> prints = syntheticPrints(finger);
+    QVector<QVector<Minutia>> foreign = randomPrints(seed);
+    for (int p = 0; p < prints.size(); ++p) {
+        for (int m = prints[p].size() - kReplaced; m < prints[p].size(); ++m) {
+            prints[p][m] = foreign[p][m];
+        }
+    }
+    return FingerprintTemplate::fromPrints(prints);
+}
+
+GalleryEntry entry(int userId, const FingerprintTemplate& fingerprint)
+{
+    GalleryEntry e = { userId, fingerprint, fingerprint.signature() };
+    return e;
+}
+
+bool expectTrueMatch(const char* what, const MatchResult& result, int userId, int score)
+{
+    if (result.userId != userId || result.score != score) {
+        std::printf("FAIL: %s returned user %d, score %d; expected user %d, score %d\n",
+                    what, result.userId, result.score, userId, score);
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    FingerprintTemplate probe = FingerprintTemplate::fromPrints(syntheticPrints(1));
+    FingerprintTemplate weaker = weakerMatch(1, 7);
+
+    // Weaker false match first, random prints between, the true match last
+    QVector<GalleryEntry> entries;
+    entries.append(entry(1, weaker));
+    int noiseBest = 0;
+    for (int i = 1; i < kGallerySize - 1; ++i) {
+        FingerprintTemplate noise = FingerprintTemplate::fromPrints(randomPrints(100 + i));
+        noiseBest = qMax(noiseBest, FingerprintTemplate::match(probe, noise));
+        entries.append(entry(i + 1, noise));
+    }
+    const int trueUserId = kGallerySize;
+    entries.append(entry(trueUserId, probe));
+    GallerySnapshot gallery(new QVector<GalleryEntry>(entries));
+
+    int weakerScore = FingerprintTemplate::match(probe, weaker);
+    int trueScore = FingerprintTemplate::match(probe, probe);
+    if (weakerScore < kThreshold || weakerScore >= trueScore || noiseBest >= trueScore) {
+        std::printf("FAIL: setup, weaker match %d, true match %d, best unrelated %d, threshold %d\n",
+                    weakerScore, trueScore, noiseBest, kThreshold);
+        return 1;
+    }
+    std::printf("ok: setup, weaker match %d in chunk 0, true match %d in chunk %d\n",
+                weakerScore, trueScore, kGallerySize - 1);
+
+    MatchEngine engine(4);
+    engine.setChunkSize(1);
+
+    for (int pass = 0; pass < kPasses; ++pass) {
+        if (!expectTrueMatch("identify", engine.identify(probe, gallery, kThreshold), trueUserId, trueScore)) {
+            return 1;
+        }
+    }
+    std::printf("ok: identify over the whole gallery, %d passes\n", kPasses);
+
+    QVector<FingerprintTemplate> probes(2, probe);
+    QVector<int> thresholds(2, kThreshold);
+    for (int pass = 0; pass < kPasses; ++pass) {
+        QVector<MatchResult> results = engine.identifyBatch(probes, gallery, thresholds);
+        if (!expectTrueMatch("identifyBatch", results.value(0), trueUserId, trueScore)
+            || !expectTrueMatch("identifyBatch", results.value(1), trueUserId, trueScore)) {
+            return 1;
+        }
+    }
+    std::printf("ok: identifyBatch over the whole gallery, %d passes\n", kPasses);
+
+    // A stop score clearly above the false match must not let it end the pass
+    engine.setEarlyStopScore((weakerScore + trueScore + 1) / 2);
+    for (int pass = 0; pass < kPasses; ++pass) {
+        if (!expectTrueMatch("identify with early stop", engine.identify(probe, gallery, kThreshold), trueUserId, trueScore)) {
+            return 1;
+        }
+        QVector<MatchResult> results = engine.identifyBatch(probes, gallery, thresholds);
+        if (!expectTrueMatch("identifyBatch with early stop", results.value(0), trueUserId, trueScore)) {
+            return 1;
+        }
+    }
+    std::printf("ok: early stop at %d, %d passes\n", engine.earlyStopScore(), kPasses);
+    return 0;
+}
@@ -0,0 +1,40 @@
+# MatchEngine best-of-gallery check (no reader needed)
+#   qmake6 test_match_engine.pro && make
+#   ./bin/test_match_engine
+
+QT += core
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = test_match_engine
+TEMPLATE = app
+
+DESTDIR = bin
+
+macx {
+    INCLUDEPATH += /opt/homebrew/include/glib-2.0 \
+                   /opt/homebrew/lib/glib-2.0/include
+    LIBS += -L/opt/homebrew/lib -lglib-2.0
+}
+
+unix:!macx {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += glib-2.0
+}
+
+SOURCES += \
+    test_match_engine.cpp \
+    match_engine.cpp \
+    fingerprint_template.cpp \
+    test_support.cpp \
+    trace.cpp \
+    metrics.cpp
+
+HEADERS += \
+    match_engine.h \
+    fingerprint_template.h \
+    test_support.h \
+    trace.h \
+    metrics.h
@@ -0,0 +1,44 @@
+#include "test_support.h"
+#include <random>
+
+QVector<QVector<Minutia>> syntheticPrints(int finger)
+{
+    QVector<QVector<Minutia>> prints;
+    for (int stage = 0; stage < 5; ++stage) {
+        QVector<Minutia> minutiae;
+        for (int i = 0; i < 40; ++i) {
+            Minutia minutia = { 20 + (i * 37 + finger * 101 + stage * 3) % 360,
+                                20 + (i * 53 + finger * 67 + stage * 5) % 460,
+                                (i * 29 + finger * 41 + stage) % 360 };
+            minutiae.append(minutia);
+        }
+        prints.append(minutiae);
+    }
+    return prints;
+}
+
+QByteArray syntheticTemplate(int finger)
+{
+    return FingerprintTemplate::fromPrints(syntheticPrints(finger)).toSerialized();
+}
+
+QVector<QVector<Minutia>> randomPrints(quint32 seed)
+{
+    std::mt19937 rng(seed);
+    QVector<Minutia> base;
+    for (int i = 0; i < 40; ++i) {
+        Minutia minutia = { 20 + int(rng() % 360), 20 + int(rng() % 460), int(rng() % 360) };
+        base.append(minutia);
+    }
+
+    QVector<QVector<Minutia>> prints;
+    for (int stage = 0; stage < 5; ++stage) {
+        QVector<Minutia> minutiae;
+        for (const Minutia& m : base) {
+            Minutia minutia = { m.x + stage * 3, m.y + stage * 5, (m.theta + stage) % 360 };
+            minutiae.append(minutia);
+        }
+        prints.append(minutiae);
+    }
+    return prints;
+}
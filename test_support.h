@@ -0,0 +1,19 @@
+#ifndef TEST_SUPPORT_H
+#define TEST_SUPPORT_H
+
+#include <QByteArray>
+#include <QVector>
+#include "fingerprint_template.h"
+
+// Deterministic synthetic minutiae for the test programs: five enrollment
+// stages of 40 minutiae, slightly shifted per stage. The same finger always
+// gives the same prints. Fingers share one lattice, so some pairs of finger
+// numbers still score high against each other; randomPrints() does not.
+QVector<QVector<Minutia>> syntheticPrints(int finger = 0);
+QByteArray syntheticTemplate(int finger = 0); // Serialized FP1 of syntheticPrints()
+
+// Same layout with positions and directions drawn from a seeded generator;
+// different seeds give prints that barely match each other or any finger
+QVector<QVector<Minutia>> randomPrints(quint32 seed);
+
+#endif // TEST_SUPPORT_H
@@ -0,0 +1,104 @@
+// Checks FingerprintTemplate against libfprint's own print serialization.
+//
+//   qmake6 test_template_decode.pro && make
+//   ./bin/test_template_decode [template.fp1 ...]
+//
+// A synthetic NBIS print is read back by fp_print_deserialize() and written
+// again by fp_print_serialize(); the bytes libfprint produces must decode to
+// the same minutiae. Template files given as arguments (raw "FP1" blobs, e.g.
+// enrolled on a reader and saved from the database) must decode to at least
+// one print. Exits non-zero on the first failure.
+
+#include <QByteArray>
+#include <QFile>
+#include <QVector>
+#include <cstdio>
+#include <fprint.h>
+
+#include "fingerprint_template.h"
+#include "test_support.h"
+
+namespace {
+
+bool sameMinutiae(const FingerprintTemplate& a, const FingerprintTemplate& b)
+{
+    if (a.prints().size() != b.prints().size()) return false;
+    for (int p = 0; p < a.prints().size(); ++p) {
+        const QVector<Minutia>& x = a.prints()[p];
+        const QVector<Minutia>& y = b.prints()[p];
+        if (x.size() != y.size()) return false;
+        for (int m = 0; m < x.size(); ++m) {
+            if (x[m].x != y[m].x || x[m].y != y[m].y || x[m].theta != y[m].theta) return false;
+        }
+    }
+    return true;
+}
+
+bool checkLibfprintRoundTrip()
+{
+    FingerprintTemplate original = FingerprintTemplate::fromPrints(syntheticPrints());
+    QByteArray ours = original.toSerialized();
+
+    GError* error = nullptr;
+    FpPrint* print = fp_print_deserialize(reinterpret_cast<const guchar*>(ours.constData()), gsize(ours.size()), &error);
+    if (!print) {
+        std::printf("FAIL: fp_print_deserialize rejected toSerialized(): %s\n", error ? error->message : "?");
+        g_clear_error(&error);
+        return false;
+    }
+
+    guchar* data = nullptr;
+    gsize length = 0;
+    bool serialized = fp_print_serialize(print, &data, &length, &error);
+    g_object_unref(print);
+    if (!serialized) {
+        std::printf("FAIL: fp_print_serialize: %s\n", error ? error->message : "?");
+        g_clear_error(&error);
+        return false;
+    }
+    QByteArray theirs(reinterpret_cast<const char*>(data), int(length));
+    g_free(data);
+
+    FingerprintTemplate decoded = FingerprintTemplate::fromSerialized(theirs);
+    if (!decoded.isValid()) {
+        std::printf("FAIL: print written by fp_print_serialize decodes as invalid\n");
+        return false;
+    }
+    if (!sameMinutiae(original, decoded)) {
+        std::printf("FAIL: print written by fp_print_serialize decodes to different minutiae\n");
+        return false;
+    }
+    std::printf("ok: libfprint round trip, %d prints, %d minutiae\n", int(decoded.prints().size()), decoded.minutiaeCount());
+    return true;
+}
+
+bool checkFile(const char* path)
+{
+    QFile file(QString::fromLocal8Bit(path));
+    if (!file.open(QIODevice::ReadOnly)) {
+        std::printf("FAIL: cannot read %s\n", path);
+        return false;
+    }
+    FingerprintTemplate decoded = FingerprintTemplate::fromSerialized(file.readAll());
+    if (!decoded.isValid()) {
+        std::printf("FAIL: %s decodes as invalid\n", path);
+        return false;
+    }
+    std::printf("ok: %s, %d prints, %d minutiae\n", path, int(decoded.prints().size()), decoded.minutiaeCount());
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    if (!checkLibfprintRoundTrip()) {
+        return 1;
+    }
+    for (int i = 1; i < argc; ++i) {
+        if (!checkFile(argv[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
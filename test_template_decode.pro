@@ -0,0 +1,40 @@
+# FingerprintTemplate decode check against libfprint (no reader needed)
+#   qmake6 test_template_decode.pro && make
+#   ./bin/test_template_decode
+
+QT += core
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = test_template_decode
+TEMPLATE = app
+
+DESTDIR = bin
+
+# Libfprint - macOS Only (see fingerprint_app.pro)
+macx {
+    INCLUDEPATH += $$PWD/libfprint_repo/libfprint \
+                   /opt/homebrew/include/glib-2.0 \
+                   /opt/homebrew/lib/glib-2.0/include
+    LIBS += -L$$PWD/libfprint_repo/builddir/libfprint -lfprint-2 \
+            -L/opt/homebrew/lib -lglib-2.0 -lgobject-2.0 -lgio-2.0
+    QMAKE_RPATHDIR += $$PWD/libfprint_repo/builddir/libfprint
+}
+
+unix:!macx {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += libfprint-2 glib-2.0
+}
+
+SOURCES += \
+    test_template_decode.cpp \
+    fingerprint_template.cpp \
+    test_support.cpp \
+    trace.cpp
+
+HEADERS += \
+    fingerprint_template.h \
+    test_support.h \
+    trace.h
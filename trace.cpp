@@ -0,0 +1,280 @@
+#include "trace.h"
+#include <QCoreApplication>
+#include <QFile>
+#include <QMutex>
+#include <QThread>
+#include <QDebug>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+namespace Trace {
+
+std::atomic<bool> g_enabled(false);
+
+namespace {
+
+const int kBufferCapacity = 1 << 15; // Spans per thread, later spans are counted as dropped
+const size_t kMaxBuffers = 256;       // About 1 MB each; pool threads come and go, buffers are reused
+
+struct Span {
+    const char* category;
+    const char* name;
+    qint64 start;
+    qint64 duration;
+};
+
+// Written only by its thread; count is the published prefix of spans
+struct ThreadBuffer {
+    int trackId = 0;
+    QString defaultName; // Changed only under g_registryMutex
+    std::atomic<const char*> name{nullptr};
+    std::atomic<int> generation{-1};
+    std::atomic<int> count{0};
+    std::atomic<qint64> dropped{0};
+    bool exited = false;   // Owner thread is gone, under g_registryMutex
+    bool exported = false; // Dumped since the owner exited, under g_registryMutex
+    Span spans[kBufferCapacity];
+};
+
+// clear() bumps the generation; stale buffers are skipped by the dump and
+// reset by their owner on its next span, so no thread touches another's buffer
+std::atomic<int> g_generation(0);
+
+QMutex g_registryMutex; // Registration, clear and dump; never taken while recording
+std::vector<std::unique_ptr<ThreadBuffer>> g_buffers; // Kept after thread exit so the dump still sees them
+std::atomic<qint64> g_lostSpans(0); // No buffer to record into, or overwritten before a dump
+QString g_outputPath;
+
+// Marks the buffer free for another thread when this one exits
+struct LocalBuffer {
+    ThreadBuffer* buffer = nullptr;
+    bool denied = false; // Registry full of live threads, this thread records nothing
+
+    ~LocalBuffer()
+    {
+        if (!buffer) return;
+        QMutexLocker locker(&g_registryMutex);
+        buffer->exited = true;
+        buffer->exported = false;
+    }
+};
+
+thread_local LocalBuffer t_buffer; // Assigned on the thread's first span
+thread_local const char* t_name = nullptr;
+
+// An exited thread's buffer is taken over once nothing in it is still
+// waiting for a dump; with the registry at kMaxBuffers the oldest one is
+// taken regardless and its spans are counted as lost. Caller holds the mutex.
+ThreadBuffer* acquireBuffer()
+{
+    const int generation = g_generation.load(std::memory_order_acquire);
+    ThreadBuffer* reuse = nullptr;
+    ThreadBuffer* oldest = nullptr;
+    for (const std::unique_ptr<ThreadBuffer>& candidate : g_buffers) {
+        if (!candidate->exited) continue;
+        if (candidate->exported || candidate->count.load(std::memory_order_relaxed) == 0
+            || candidate->generation.load(std::memory_order_relaxed) != generation) {
+            reuse = candidate.get();
+            break;
+        }
+        if (!oldest) oldest = candidate.get();
+    }
+    if (!reuse && g_buffers.size() >= kMaxBuffers && oldest) {
+        g_lostSpans.fetch_add(oldest->count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        reuse = oldest;
+    }
+
+    if (reuse) {
+        reuse->generation.store(-1, std::memory_order_relaxed);
+        reuse->count.store(0, std::memory_order_relaxed);
+        reuse->dropped.store(0, std::memory_order_relaxed);
+        reuse->exited = false;
+        reuse->exported = false;
+        return reuse;
+    }
+    if (g_buffers.size() >= kMaxBuffers) {
+        return nullptr;
+    }
+
+    g_buffers.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer()));
+    ThreadBuffer* buffer = g_buffers.back().get();
+    buffer->trackId = int(g_buffers.size());
+    return buffer;
+}
+
+ThreadBuffer* localBuffer()
+{
+    LocalBuffer& local = t_buffer;
+    if (!local.buffer && !local.denied) {
+        QString objectName = QThread::currentThread()->objectName();
+        QMutexLocker locker(&g_registryMutex);
+        ThreadBuffer* buffer = acquireBuffer();
+        if (!buffer) {
+            local.denied = true;
+            return nullptr;
+        }
+        buffer->name.store(t_name, std::memory_order_relaxed);
+        buffer->defaultName = objectName.isEmpty() ? QString("Thread %1").arg(buffer->trackId) : objectName;
+        local.buffer = buffer;
+    }
+    return local.buffer;
+}
+
+QByteArray jsonString(const QString& text)
+{
+    QString escaped = text;
+    escaped.replace('\\', "\\\\").replace('"', "\\\"").replace('\n', "\\n");
+    return '"' + escaped.toUtf8() + '"';
+}
+
+} // namespace
+
+void setEnabled(bool enabled)
+{
+    g_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void clear()
+{
+    QMutexLocker locker(&g_registryMutex);
+    g_generation.fetch_add(1, std::memory_order_acq_rel);
+    g_lostSpans.store(0, std::memory_order_relaxed);
+}
+
+bool configureFromEnvironment()
+{
+    QString value = qEnvironmentVariable("FP_TRACE");
+    if (value.isEmpty() || value == "0") {
+        return false;
+    }
+    if (value != "1") {
+        g_outputPath = value;
+    }
+    setEnabled(true);
+    qInfo() << "Tracing enabled" << (g_outputPath.isEmpty() ? QString() : "-> " + g_outputPath);
+    return true;
+}
+
+void writeAtExit()
+{
+    if (g_outputPath.isEmpty()) return;
+
+    QString error;
+    if (writeChromeTrace(g_outputPath, &error)) {
+        qInfo() << "Trace written to" << g_outputPath;
+    } else {
+        qWarning() << error;
+    }
+}
+
+void setThreadName(const char* name)
+{
+    t_name = name;
+    if (t_buffer.buffer) {
+        t_buffer.buffer->name.store(name, std::memory_order_release);
+    }
+}
+
+qint64 Scope::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Scope::record(const char* category, const char* name, qint64 start, qint64 duration)
+{
+    ThreadBuffer* buffer = localBuffer();
+    if (!buffer) {
+        g_lostSpans.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    int generation = g_generation.load(std::memory_order_acquire);
+    if (buffer->generation.load(std::memory_order_relaxed) != generation) {
+        buffer->count.store(0, std::memory_order_relaxed);
+        buffer->dropped.store(0, std::memory_order_relaxed);
+        buffer->generation.store(generation, std::memory_order_release);
+    }
+
+    int count = buffer->count.load(std::memory_order_relaxed);
+    if (count >= kBufferCapacity) {
+        buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    Span& span = buffer->spans[count];
+    span.category = category;
+    span.name = name;
+    span.start = start;
+    span.duration = duration;
+    buffer->count.store(count + 1, std::memory_order_release); // Publishes the span to the dump
+}
+
+bool writeChromeTrace(const QString& path, QString* error)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        if (error) *error = QString("Failed to write trace: %1").arg(file.errorString());
+        return false;
+    }
+
+    QMutexLocker locker(&g_registryMutex);
+    const int generation = g_generation.load(std::memory_order_acquire);
+    const QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+
+    qint64 spans = 0, dropped = g_lostSpans.load(std::memory_order_relaxed);
+    bool first = true;
+    auto separator = [&]() -> QByteArray {
+        if (first) {
+            first = false;
+            return "\n";
+        }
+        return ",\n";
+    };
+
+    file.write("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (const std::unique_ptr<ThreadBuffer>& buffer : g_buffers) {
+        if (buffer->generation.load(std::memory_order_acquire) != generation) continue;
+        int count = buffer->count.load(std::memory_order_acquire);
+        if (count == 0) continue;
+
+        const QByteArray tid = QByteArray::number(buffer->trackId);
+        const char* name = buffer->name.load(std::memory_order_acquire);
+        file.write(separator() + "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" + pid + ",\"tid\":" + tid
+                   + ",\"args\":{\"name\":" + jsonString(name ? QString::fromUtf8(name) : buffer->defaultName) + "}}");
+
+        QByteArray chunk;
+        for (int i = 0; i < count; ++i) {
+            const Span& span = buffer->spans[i];
+            chunk += separator() + "{\"ph\":\"X\",\"cat\":\"" + span.category + "\",\"name\":\"" + span.name
+                   + "\",\"pid\":" + pid + ",\"tid\":" + tid
+                   + ",\"ts\":" + QByteArray::number(span.start / 1000.0, 'f', 3)
+                   + ",\"dur\":" + QByteArray::number(span.duration / 1000.0, 'f', 3) + "}";
+            if (chunk.size() > 64 * 1024) {
+                file.write(chunk);
+                chunk.clear();
+            }
+        }
+        file.write(chunk);
+
+        spans += count;
+        dropped += buffer->dropped.load(std::memory_order_relaxed);
+    }
+    file.write("\n]}\n");
+
+    if (file.error() != QFileDevice::NoError) {
+        if (error) *error = QString("Failed to write trace: %1").arg(file.errorString());
+        return false;
+    }
+
+    // Spans of exited threads are in the file now, their buffers may be reused
+    for (const std::unique_ptr<ThreadBuffer>& buffer : g_buffers) {
+        if (buffer->exited) buffer->exported = true;
+    }
+
+    qDebug() << "Trace:" << spans << "spans written," << dropped << "dropped (buffers full or reused)";
+    return true;
+}
+
+} // namespace Trace
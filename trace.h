@@ -0,0 +1,69 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QString>
+#include <atomic>
+
+// In-process span tracing, dumped as Chrome trace JSON (chrome://tracing,
+// ui.perfetto.dev).
+//
+// Every thread records into its own fixed-size buffer that only it writes,
+// so recording takes no lock; the dump reads the published prefix of each
+// buffer. A buffer outlives its thread until a dump has written its spans
+// (or clear() dropped them) and is then handed to the next new thread, so
+// pool threads that expire and respawn do not add buffers. Span names and
+// categories must be string literals. With tracing disabled a span costs one
+// relaxed atomic load.
+//
+//   TRACE_SCOPE("db", "getAllTemplates");
+//
+// FP_TRACE=1 enables tracing at startup; any other non-empty value is also
+// taken as the file written by Trace::writeAtExit().
+namespace Trace {
+
+extern std::atomic<bool> g_enabled;
+
+inline bool isEnabled() { return g_enabled.load(std::memory_order_relaxed); }
+void setEnabled(bool enabled);
+void clear(); // Drops recorded spans; threads reset their buffer on their next span
+
+bool configureFromEnvironment();
+void writeAtExit(); // Writes to the FP_TRACE path, if one was given
+
+void setThreadName(const char* name); // Shown as the track name, literal only
+
+// Spans recorded so far, across all threads
+bool writeChromeTrace(const QString& path, QString* error = nullptr);
+
+class Scope {
+public:
+    Scope(const char* category, const char* name)
+        : m_category(category)
+        , m_name(name)
+        , m_start(isEnabled() ? now() : -1)
+    {
+    }
+    ~Scope()
+    {
+        if (m_start >= 0) record(m_category, m_name, m_start, now() - m_start);
+    }
+
+private:
+    static qint64 now(); // Nanoseconds on a monotonic clock
+    static void record(const char* category, const char* name, qint64 start, qint64 duration);
+
+    const char* m_category;
+    const char* m_name;
+    qint64 m_start;
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+};
+
+} // namespace Trace
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(category, name) Trace::Scope TRACE_CONCAT(traceScope_, __LINE__)(category, name)
+
+#endif // TRACE_H
@@ -0,0 +1,96 @@
+#include "user_archive.h"
+#include <QIODevice>
+
+namespace {
+
+const quint32 kMagic = 0x46505541; // "FPUA"
+const quint32 kVersion = 1;
+const quint8 kRecordTag = 1;
+const quint8 kEndTag = 0;
+
+} // namespace
+
+UserArchiveWriter::UserArchiveWriter(QIODevice* device)
+    : m_stream(device)
+{
+    m_stream.setVersion(QDataStream::Qt_6_0);
+}
+
+bool UserArchiveWriter::writeHeader()
+{
+    m_stream << kMagic << kVersion;
+    return check();
+}
+
+bool UserArchiveWriter::writeUser(const User& user)
+{
+    m_stream << kRecordTag << user.name << user.email << user.fingerprintTemplate << user.createdAt;
+    return check();
+}
+
+bool UserArchiveWriter::finish()
+{
+    m_stream << kEndTag;
+    return check();
+}
+
+bool UserArchiveWriter::check()
+{
+    if (m_stream.status() != QDataStream::Ok) {
+        m_lastError = QString("Failed to write archive: %1").arg(m_stream.device()->errorString());
+        return false;
+    }
+    return true;
+}
+
+UserArchiveReader::UserArchiveReader(QIODevice* device)
+    : m_stream(device)
+    , m_atEnd(false)
+{
+    m_stream.setVersion(QDataStream::Qt_6_0);
+}
+
+bool UserArchiveReader::readHeader()
+{
+    quint32 magic = 0;
+    quint32 version = 0;
+    m_stream >> magic >> version;
+
+    if (m_stream.status() != QDataStream::Ok || magic != kMagic) {
+        m_lastError = "Not a user archive";
+        return false;
+    }
+    if (version != kVersion) {
+        m_lastError = QString("Unsupported archive version %1").arg(version);
+        return false;
+    }
+    return true;
+}
+
+bool UserArchiveReader::readNext(User& user)
+{
+    if (m_atEnd) return false;
+
+    quint8 tag = kEndTag;
+    m_stream >> tag;
+    if (m_stream.status() != QDataStream::Ok) {
+        m_lastError = "Archive is truncated";
+        return false;
+    }
+    if (tag == kEndTag) {
+        m_atEnd = true;
+        return false;
+    }
+    if (tag != kRecordTag) {
+        m_lastError = "Corrupt archive record";
+        return false;
+    }
+
+    user = User();
+    m_stream >> user.name >> user.email >> user.fingerprintTemplate >> user.createdAt;
+    if (m_stream.status() != QDataStream::Ok) {
+        m_lastError = "Archive is truncated";
+        return false;
+    }
+    return true;
+}
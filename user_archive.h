@@ -0,0 +1,48 @@
+#ifndef USER_ARCHIVE_H
+#define USER_ARCHIVE_H
+
+#include <QDataStream>
+#include <QString>
+
+#include "database_manager.h"
+
+// Streaming user + template archive for moving enrollments between sites.
+//
+// QDataStream layout: magic, version, then one tagged record per user
+// (name, email, template, created_at) and an end tag. Records are read and
+// written one at a time, so archives of any size never sit in memory.
+class UserArchiveWriter {
+public:
+    explicit UserArchiveWriter(QIODevice* device);
+
+    bool writeHeader();
+    bool writeUser(const User& user);
+    bool finish(); // Writes the end tag
+
+    QString getLastError() const { return m_lastError; }
+
+private:
+    bool check();
+
+    QDataStream m_stream;
+    QString m_lastError;
+};
+
+class UserArchiveReader {
+public:
+    explicit UserArchiveReader(QIODevice* device);
+
+    bool readHeader();
+    // False at the end tag or on error; check atEnd() to tell them apart
+    bool readNext(User& user);
+    bool atEnd() const { return m_atEnd; }
+
+    QString getLastError() const { return m_lastError; }
+
+private:
+    QDataStream m_stream;
+    bool m_atEnd;
+    QString m_lastError;
+};
+
+#endif // USER_ARCHIVE_H
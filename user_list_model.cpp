@@ -0,0 +1,210 @@
+#include "user_list_model.h"
+#include "trace.h"
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QtConcurrent>
+#include <QDebug>
+
+UserListModel::UserListModel(DatabaseManager* dbManager, QObject* parent)
+    : QAbstractListModel(parent)
+    , m_dbManager(dbManager)
+    , m_pageSize(200)
+    , m_total(0)
+    , m_atEnd(true)
+    , m_searchGeneration(0)
+    , m_searchPending(false)
+{
+    connect(m_dbManager, &DatabaseManager::userAdded, this, &UserListModel::onUserAdded);
+    connect(m_dbManager, &DatabaseManager::userDeleted, this, &UserListModel::onUserDeleted);
+    connect(m_dbManager, &DatabaseManager::usersImported, this, &UserListModel::reload);
+}
+
+int UserListModel::rowCount(const QModelIndex& parent) const
+{
+    return parent.isValid() ? 0 : m_rows.size();
+}
+
+QVariant UserListModel::data(const QModelIndex& index, int role) const
+{
+    if (!index.isValid() || index.row() >= m_rows.size()) {
+        return QVariant();
+    }
+
+    const UserSummary& user = m_rows[index.row()];
+    switch (role) {
+    case Qt::DisplayRole:
+        return QString("%1 - %2").arg(user.name).arg(user.email.isEmpty() ? "No email" : user.email);
+    case UserIdRole:
+        return user.id;
+    case NameRole:
+        return user.name;
+    case EmailRole:
+        return user.email;
+    default:
+        return QVariant();
+    }
+}
+
+bool UserListModel::canFetchMore(const QModelIndex& parent) const
+{
+    // Rows on screen belong to the previous term until the new search lands
+    return !parent.isValid() && !m_atEnd && !m_searchPending;
+}
+
+void UserListModel::fetchMore(const QModelIndex& parent)
+{
+    if (!canFetchMore(parent)) return;
+    TRACE_SCOPE("ui", "userList.fetchMore");
+
+    QVector<UserSummary> page = m_rows.isEmpty()
+        ? queryPage(QString(), 0)
+        : queryPage(m_rows.last().name, m_rows.last().id);
+    m_atEnd = page.size() < m_pageSize;
+
+    QVector<UserSummary> fresh;
+    fresh.reserve(page.size());
+    for (const UserSummary& user : page) {
+        if (!m_ids.contains(user.id)) fresh.append(user);
+    }
+    if (fresh.isEmpty()) return;
+
+    beginInsertRows(QModelIndex(), m_rows.size(), m_rows.size() + fresh.size() - 1);
+    for (const UserSummary& user : fresh) {
+        m_rows.append(user);
+        m_ids.insert(user.id);
+    }
+    endInsertRows();
+}
+
+void UserListModel::reload()
+{
+    ++m_searchGeneration; // Supersedes a search still running
+    m_searchPending = false;
+
+    setTotal(m_dbManager->countUsers());
+    resetRows(queryPage(QString(), 0));
+}
+
+void UserListModel::setSearchTerm(const QString& term)
+{
+    QString trimmed = term.trimmed();
+    if (trimmed == m_searchTerm) return;
+    m_searchTerm = trimmed;
+
+    int generation = ++m_searchGeneration;
+    m_searchPending = true;
+
+    DatabaseManager* db = m_dbManager;
+    int pageSize = m_pageSize;
+    QElapsedTimer timer;
+    timer.start();
+
+    QFutureWatcher<QVector<UserSummary>>* watcher = new QFutureWatcher<QVector<UserSummary>>(this);
+    connect(watcher, &QFutureWatcher<QVector<UserSummary>>::finished, this, [this, watcher, generation, trimmed, timer]() {
+        QVector<UserSummary> page = watcher->result();
+        watcher->deleteLater();
+        m_searches.removeIf([](const QFuture<QVector<UserSummary>>& search) { return search.isFinished(); });
+        if (generation != m_searchGeneration) return; // Another keystroke already won
+
+        m_searchPending = false;
+        resetRows(page);
+        emit searchFinished(trimmed, page.size(), timer.elapsed());
+    });
+
+    // Pool thread, DatabaseManager hands it its own connection
+    QFuture<QVector<UserSummary>> search = QtConcurrent::run([db, trimmed, pageSize]() {
+        return trimmed.isEmpty() ? db->getUserSummaries(pageSize) : db->searchUserSummaries(trimmed, pageSize);
+    });
+    m_searches.append(search);
+    watcher->setFuture(search);
+}
+
+void UserListModel::waitForSearch()
+{
+    // Superseded searches still hold a database connection until they return
+    for (QFuture<QVector<UserSummary>>& search : m_searches) {
+        search.waitForFinished();
+    }
+    m_searches.clear();
+}
+
+QVector<UserSummary> UserListModel::queryPage(const QString& afterName, int afterId)
+{
+    if (m_searchTerm.isEmpty()) {
+        return m_dbManager->getUserSummaries(m_pageSize, afterName, afterId);
+    }
+    return m_dbManager->searchUserSummaries(m_searchTerm, m_pageSize, afterName, afterId);
+}
+
+void UserListModel::resetRows(const QVector<UserSummary>& firstPage)
+{
+    TRACE_SCOPE("ui", "userList.reset");
+    beginResetModel();
+    m_rows = firstPage;
+    m_ids.clear();
+    for (const UserSummary& user : m_rows) {
+        m_ids.insert(user.id);
+    }
+    m_atEnd = firstPage.size() < m_pageSize;
+    endResetModel();
+}
+
+bool UserListModel::matchesSearch(const UserSummary& user) const
+{
+    return m_searchTerm.isEmpty()
+        || user.name.contains(m_searchTerm, Qt::CaseInsensitive)
+        || user.email.contains(m_searchTerm, Qt::CaseInsensitive);
+}
+
+void UserListModel::onUserAdded(int userId)
+{
+    UserSummary user;
+    if (!m_dbManager->getUserSummaryById(userId, user)) {
+        qWarning() << "User list: added user not found:" << m_dbManager->getLastError();
+        return;
+    }
+    setTotal(m_total + 1);
+    if (m_ids.contains(userId) || m_searchPending || !matchesSearch(user)) return;
+
+    // The database orders names by its own collation, so it names the row the
+    // new user goes before. Past the loaded tail the row arrives with a later page.
+    QVector<UserSummary> next = m_searchTerm.isEmpty()
+        ? m_dbManager->getUserSummaries(1, user.name, user.id)
+        : m_dbManager->searchUserSummaries(m_searchTerm, 1, user.name, user.id);
+    int row = m_rows.size();
+    if (!next.isEmpty()) {
+        if (!m_ids.contains(next.first().id)) return;
+        row = 0;
+        while (m_rows[row].id != next.first().id) ++row;
+    } else if (!m_atEnd) {
+        return;
+    }
+
+    beginInsertRows(QModelIndex(), row, row);
+    m_rows.insert(row, user);
+    m_ids.insert(userId);
+    endInsertRows();
+}
+
+void UserListModel::onUserDeleted(int userId)
+{
+    setTotal(qMax(0, m_total - 1));
+    if (!m_ids.contains(userId)) return;
+
+    for (int row = 0; row < m_rows.size(); ++row) {
+        if (m_rows[row].id == userId) {
+            beginRemoveRows(QModelIndex(), row, row);
+            m_rows.removeAt(row);
+            m_ids.remove(userId);
+            endRemoveRows();
+            return;
+        }
+    }
+}
+
+void UserListModel::setTotal(int count)
+{
+    if (count == m_total) return;
+    m_total = count;
+    emit totalCountChanged(count);
+}
@@ -0,0 +1,75 @@
+#ifndef USER_LIST_MODEL_H
+#define USER_LIST_MODEL_H
+
+#include <QAbstractListModel>
+#include <QFuture>
+#include <QSet>
+#include <QVector>
+
+#include "database_manager.h"
+
+// Registered users for the main window list, in (name, id) order.
+// Rows are fetched a page at a time through keyset-paged, template-free
+// queries as the view scrolls, so memory follows what has been shown rather
+// than the table size. Adds and deletes reported by DatabaseManager become
+// single-row inserts and removes; bulk changes reset the model.
+// A search term narrows the list to matching names or emails; the first
+// page of a new search is queried on a pool thread so typing never waits
+// on the database, and results of superseded searches are dropped.
+class UserListModel : public QAbstractListModel {
+    Q_OBJECT
+
+public:
+    enum Roles {
+        UserIdRole = Qt::UserRole,
+        NameRole,
+        EmailRole
+    };
+
+    explicit UserListModel(DatabaseManager* dbManager, QObject* parent = nullptr);
+
+    void setPageSize(int size) { m_pageSize = qMax(1, size); }
+    int pageSize() const { return m_pageSize; }
+
+    int totalCount() const { return m_total; } // All users, loaded or not
+
+    void setSearchTerm(const QString& term); // Empty lists everyone
+    QString searchTerm() const { return m_searchTerm; }
+    void waitForSearch(); // Joins every running search query, call before the database goes away
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+    bool canFetchMore(const QModelIndex& parent) const override;
+    void fetchMore(const QModelIndex& parent) override;
+
+public slots:
+    void reload(); // Drops loaded rows and fetches the first page again
+
+signals:
+    void totalCountChanged(int count);
+    void searchFinished(const QString& term, int rows, qint64 elapsedMs); // rows: first page only
+
+private slots:
+    void onUserAdded(int userId);
+    void onUserDeleted(int userId);
+
+private:
+    void setTotal(int count);
+    void resetRows(const QVector<UserSummary>& firstPage);
+    QVector<UserSummary> queryPage(const QString& afterName, int afterId);
+    bool matchesSearch(const UserSummary& user) const;
+
+    DatabaseManager* m_dbManager;
+    QVector<UserSummary> m_rows;
+    QSet<int> m_ids; // Guards against a page returning a row already inserted locally
+    int m_pageSize;
+    int m_total;
+    bool m_atEnd;
+
+    QString m_searchTerm;
+    int m_searchGeneration; // Bumped per search, stale results are ignored
+    bool m_searchPending;
+    QVector<QFuture<QVector<UserSummary>>> m_searches; // In flight, superseded ones included
+};
+
+#endif // USER_LIST_MODEL_H
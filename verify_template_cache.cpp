@@ -0,0 +1,123 @@
+#include "verify_template_cache.h"
+#include "metrics.h"
+#include <QtConcurrent>
+#include <QDebug>
+
+VerifyTemplateCache::VerifyTemplateCache(DatabaseManager* dbManager, int capacity, QObject* parent)
+    : QObject(parent)
+    , m_dbManager(dbManager)
+    , m_cache(capacity) // Cost 1 per user
+    , m_generation(0)
+{
+    connect(m_dbManager, &DatabaseManager::userFingerprintUpdated, this, [this](int userId) { invalidate(userId); });
+    connect(m_dbManager, &DatabaseManager::userDeleted, this, &VerifyTemplateCache::invalidate);
+    connect(m_dbManager, &DatabaseManager::usersImported, this, &VerifyTemplateCache::clear);
+}
+
+VerifyTemplateCache::~VerifyTemplateCache()
+{
+    waitForPrefetch();
+}
+
+void VerifyTemplateCache::prefetch(int userId)
+{
+    if (userId < 0 || m_pending.contains(userId)) {
+        return;
+    }
+
+    const User* cached = m_cache.object(userId); // Also marks it recently used
+    qint64 cachedChangeSeq = cached ? cached->changeSeq : 0;
+
+    QFutureWatcher<Fetch>* watcher = new QFutureWatcher<Fetch>(this);
+    connect(watcher, &QFutureWatcher<Fetch>::finished, this, [this, userId, watcher]() {
+        finishPrefetch(userId, watcher);
+    });
+    m_pending.insert(userId, Pending{ watcher, m_generation });
+    watcher->setFuture(QtConcurrent::run(&VerifyTemplateCache::fetch, m_dbManager, userId, cachedChangeSeq));
+}
+
+bool VerifyTemplateCache::get(int userId, User& user)
+{
+    static Metrics::Counter* const hits = Metrics::counter(
+        "fp_verify_cache_total", "Verification template lookups by outcome.", "result=\"hit\"");
+    static Metrics::Counter* const misses = Metrics::counter(
+        "fp_verify_cache_total", "Verification template lookups by outcome.", "result=\"miss\"");
+
+    if (m_pending.contains(userId)) {
+        QFutureWatcher<Fetch>* watcher = m_pending.value(userId).watcher;
+        watcher->waitForFinished(); // Started on selection, usually done by now
+        finishPrefetch(userId, watcher);
+    }
+
+    if (const User* cached = m_cache.object(userId)) {
+        hits->increment();
+        user = *cached;
+        return true;
+    }
+
+    misses->increment();
+    if (!m_dbManager->getUserById(userId, user)) {
+        return false;
+    }
+    m_cache.insert(userId, new User(user));
+    return true;
+}
+
+void VerifyTemplateCache::waitForPrefetch()
+{
+    for (const Pending& pending : m_pending) {
+        pending.watcher->waitForFinished();
+    }
+}
+
+void VerifyTemplateCache::invalidate(int userId)
+{
+    ++m_generation;
+    m_cache.remove(userId);
+}
+
+void VerifyTemplateCache::clear()
+{
+    ++m_generation;
+    m_cache.clear();
+}
+
+VerifyTemplateCache::Fetch VerifyTemplateCache::fetch(DatabaseManager* dbManager, int userId, qint64 cachedChangeSeq)
+{
+    Fetch result;
+    // change_seq, unlike updated_at (whole seconds), moves on every template write
+    if (cachedChangeSeq > 0) {
+        qint64 changeSeq = 0;
+        if (dbManager->getUserChangeSeq(userId, changeSeq) && changeSeq == cachedChangeSeq) {
+            result.ok = true;
+            result.current = true;
+            return result;
+        }
+    }
+    result.ok = dbManager->getUserById(userId, result.user);
+    return result;
+}
+
+void VerifyTemplateCache::finishPrefetch(int userId, QFutureWatcher<Fetch>* watcher)
+{
+    auto it = m_pending.find(userId);
+    if (it == m_pending.end() || it->watcher != watcher) {
+        return; // Already taken by get()
+    }
+    int generation = it->generation;
+    m_pending.erase(it);
+    watcher->disconnect(this);
+    watcher->deleteLater();
+
+    Fetch result = watcher->result();
+    if (generation != m_generation) {
+        return; // Read before a write that invalidated it
+    }
+
+    if (!result.ok) {
+        m_cache.remove(userId); // Deleted meanwhile, or the database is gone
+    } else if (!result.current) {
+        m_cache.insert(userId, new User(result.user));
+    }
+    emit prefetched(userId, result.ok);
+}
@@ -0,0 +1,58 @@
+#ifndef VERIFY_TEMPLATE_CACHE_H
+#define VERIFY_TEMPLATE_CACHE_H
+
+#include <QObject>
+#include <QCache>
+#include <QHash>
+#include <QFutureWatcher>
+
+#include "database_manager.h"
+
+// Recently verified users, least recently used dropped first.
+//
+// prefetch() reads the selected user on a pool thread while the operator is
+// still reaching for the reader. An entry that is already cached is
+// revalidated with its change_seq only, so the template blob is read once
+// per change. get() on capture then needs no database round trip.
+// Local writes invalidate through DatabaseManager's change signals.
+class VerifyTemplateCache : public QObject {
+    Q_OBJECT
+
+public:
+    explicit VerifyTemplateCache(DatabaseManager* dbManager, int capacity = 32, QObject* parent = nullptr);
+    ~VerifyTemplateCache() override;
+
+    void prefetch(int userId);
+    // Cached row, waiting for a running prefetch of it; reads synchronously on a miss
+    bool get(int userId, User& user);
+    void waitForPrefetch(); // Joins running reads (call before the database goes away)
+
+signals:
+    void prefetched(int userId, bool ok);
+
+public slots:
+    void invalidate(int userId);
+    void clear();
+
+private:
+    struct Fetch {
+        bool ok = false;
+        bool current = false; // The cached entry is still up to date
+        User user;
+    };
+
+    struct Pending {
+        QFutureWatcher<Fetch>* watcher;
+        int generation;
+    };
+
+    static Fetch fetch(DatabaseManager* dbManager, int userId, qint64 cachedChangeSeq);
+    void finishPrefetch(int userId, QFutureWatcher<Fetch>* watcher);
+
+    DatabaseManager* m_dbManager;
+    QCache<int, User> m_cache;
+    QHash<int, Pending> m_pending;
+    int m_generation; // Bumped on invalidation; reads started before it are dropped
+};
+
+#endif // VERIFY_TEMPLATE_CACHE_H